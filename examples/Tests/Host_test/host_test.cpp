@@ -0,0 +1,301 @@
+/*************************************************************************
+ * This test uses the BAGuitar library host emulation to check the
+ * external memory stack on a PC, without a Teensy or a TGA Pro.
+ *
+ * The latest copy of the BA Guitar library can be obtained from
+ * https://github.com/Blackaddr/BAGuitar
+ *
+ * It checks that
+ *  - samples written to an ExtMemSlot read back the same, within the
+ *    quantization of each SampleCodec, with blocking and DMA memories
+ *  - AudioDelay returns the samples from the requested delay
+ *  - every tap of BAAudioEffectDelayExternal outputs its input delayed
+ *    by the tap's delay
+ *  - AudioEffectAnalogDelay has the same impulse response with a PCM16 and
+ *    a PACKED24 memory, for each filter
+ *
+ * Build it from the top of the library with
+ *
+ *   g++ -std=gnu++11 -pthread -DBAGUITAR_HOST -D__MK66FX1M0__ -Isrc/host -Isrc \
+ *     examples/Tests/Host_test/host_test.cpp src/host/\*.cpp src/common/\*.cpp \
+ *     src/peripherals/BASpiMemory.cpp src/effects/BAAudioEffectDelayExternal.cpp \
+ *     src/effects/AudioEffectAnalogDelay.cpp -o host_test
+ *
+ * Each check prints a PASS or FAIL line. The program returns 0 when all of
+ * them pass.
+ *
+ */
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "BAHost.h"
+#include "LibBasicFunctions.h"
+#include "LibMemoryManagement.h"
+#include "BAAudioEffectDelayExternal.h"
+#include "AudioEffectAnalogDelay.h"
+
+using namespace BAGuitar;
+
+constexpr size_t TEST_BLOCKS = 24;
+constexpr size_t TEST_SAMPLES = TEST_BLOCKS*AUDIO_BLOCK_SAMPLES;
+
+unsigned numFailures = 0;
+
+void report(bool pass, const char *name, const char *detail = "")
+{
+  printf("%s %s %s\n", pass ? "PASS" : "FAIL", name, detail);
+  if (!pass) { numFailures++; }
+}
+
+// A test signal that changes every sample and covers most of the 16-bit range
+int16_t testSample(long index)
+{
+  if (index < 0) { return 0; }
+  return static_cast<int16_t>(20000.0*sin(index*0.013) + 7000.0*sin(index*0.31) + (index % 17));
+}
+
+// Samples IMA ADPCM needs at the start for its step size to catch up with the signal
+constexpr size_t ADPCM_SETTLE_SAMPLES = 16;
+
+// The largest error each codec is allowed for a sample of the test signal
+long codecTolerance(SampleCodec codec, size_t index, int16_t sample)
+{
+  switch (codec) {
+  case SampleCodec::PACKED12  : return 16;
+  case SampleCodec::MULAW     : return 16 + std::abs(sample)/16;
+  case SampleCodec::IMA_ADPCM : return (index < ADPCM_SETTLE_SAMPLES) ? 65535 : 2048;
+  default : return 0;
+  }
+}
+
+const char *codecName(SampleCodec codec)
+{
+  switch (codec) {
+  case SampleCodec::PCM16     : return "PCM16";
+  case SampleCodec::PACKED12  : return "PACKED12";
+  case SampleCodec::MULAW     : return "MULAW";
+  case SampleCodec::IMA_ADPCM : return "IMA_ADPCM";
+  case SampleCodec::PACKED24  : return "PACKED24";
+  default : return "?";
+  }
+}
+
+// Write the test signal a block at a time, then read it back in one go
+void testCodecRoundTrip(ExternalSramManager &manager, SampleCodec codec, MemSelect mem, bool useDma)
+{
+  char name[64];
+  snprintf(name, sizeof(name), "round trip %s %s", codecName(codec), useDma ? "dma" : "blocking");
+
+  ExtMemSlot slot;
+  if (!manager.requestMemory(&slot, TEST_SAMPLES*sizeof(int16_t), mem, useDma, true, codec)) {
+    report(false, name, "no memory");
+    return;
+  }
+
+  static int16_t samples[TEST_SAMPLES];
+  static int16_t readBack[TEST_SAMPLES];
+  for (size_t i=0; i < TEST_SAMPLES; i++) { samples[i] = testSample(i); }
+  for (size_t block=0; block < TEST_BLOCKS; block++) {
+    slot.writeAdvance16(samples + block*AUDIO_BLOCK_SAMPLES, AUDIO_BLOCK_SAMPLES);
+  }
+  slot.waitForWrite();
+  slot.read16(0, readBack, TEST_SAMPLES);
+  slot.waitForRead();
+
+  long worst = 0;
+  bool pass = true;
+  for (size_t i=0; i < TEST_SAMPLES; i++) {
+    long error = std::abs(static_cast<long>(readBack[i]) - samples[i]);
+    if (codec != SampleCodec::IMA_ADPCM || i >= ADPCM_SETTLE_SAMPLES) { worst = (error > worst) ? error : worst; }
+    if (error > codecTolerance(codec, i, samples[i])) { pass = false; }
+  }
+  char detail[64];
+  snprintf(detail, sizeof(detail), "(worst error %ld)", worst);
+  report(pass, name, detail);
+}
+
+// 24-bit samples must come back unchanged from a PACKED24 slot
+void testWideRoundTrip(ExternalSramManager &manager, MemSelect mem, bool useDma)
+{
+  const char *name = useDma ? "round trip PACKED24 32-bit dma" : "round trip PACKED24 32-bit blocking";
+  ExtMemSlot slot;
+  if (!manager.requestMemory(&slot, TEST_SAMPLES*sizeof(int16_t), mem, useDma, true, SampleCodec::PACKED24)) {
+    report(false, name, "no memory");
+    return;
+  }
+
+  static int32_t samples[TEST_SAMPLES];
+  static int32_t readBack[TEST_SAMPLES];
+  for (size_t i=0; i < TEST_SAMPLES; i++) {
+    samples[i] = testSample(i)*(1 << SAMPLE24_SHIFT) + static_cast<int32_t>(i % 251) - 125;
+  }
+  slot.writeAdvance32(samples, TEST_SAMPLES);
+  slot.waitForWrite();
+  slot.readAdvance32(readBack, TEST_SAMPLES);
+  slot.waitForRead();
+
+  bool pass = true;
+  for (size_t i=0; i < TEST_SAMPLES; i++) {
+    if (readBack[i] != samples[i]) { pass = false; }
+  }
+  report(pass, name);
+}
+
+// getSamples() counts the delay from the start of the most recent block added
+void testAudioDelayOffsets(ExternalSramManager &manager, MemSelect mem, bool useDma)
+{
+  const char *name = useDma ? "AudioDelay offsets dma" : "AudioDelay offsets blocking";
+  ExtMemSlot slot;
+  if (!manager.requestMemory(&slot, TEST_SAMPLES*sizeof(int16_t), mem, useDma, true)) {
+    report(false, name, "no memory");
+    return;
+  }
+  AudioDelay delay(&slot);
+
+  const size_t delays[] = {0, 1, 127, 128, 300, 1000, TEST_SAMPLES - 2*AUDIO_BLOCK_SAMPLES};
+  bool pass = true;
+  long blockStart = 0;
+  for (size_t block=0; block < 2*TEST_BLOCKS; block++) {
+    audio_block_t *in = AudioStream::hostAllocate();
+    for (size_t i=0; i < AUDIO_BLOCK_SAMPLES; i++) { in->data[i] = testSample(blockStart + i); }
+    AudioStream::hostRelease(delay.addBlock(in));
+
+    for (size_t d : delays) {
+      int16_t dest[AUDIO_BLOCK_SAMPLES];
+      delay.getSamples(dest, d);
+      slot.waitForRead();
+      for (size_t i=0; i < AUDIO_BLOCK_SAMPLES; i++) {
+        if (dest[i] != testSample(blockStart - static_cast<long>(d) + i)) { pass = false; }
+      }
+    }
+    blockStart += AUDIO_BLOCK_SAMPLES;
+  }
+  report(pass, name);
+}
+
+// Each tap gets a different delay, all eight must output the input delayed by their own
+void testDelayExternalTaps()
+{
+  const float tapMs[BAAudioEffectDelayExternal::NUM_TAPS] = {0.0f, 1.0f, 2.9f, 5.0f, 10.0f, 25.0f, 50.0f, 100.0f};
+  BAAudioEffectDelayExternal delay(MemSelect::MEM1, 200.0f);
+  long tapSamples[BAAudioEffectDelayExternal::NUM_TAPS];
+  for (unsigned tap=0; tap < BAAudioEffectDelayExternal::NUM_TAPS; tap++) {
+    delay.delay(tap, tapMs[tap]);
+    tapSamples[tap] = static_cast<long>(tapMs[tap]*(AUDIO_SAMPLE_RATE_EXACT/1000.0f) + 0.5f);
+  }
+
+  unsigned tapFailures = 0;
+  long blockStart = 0;
+  for (size_t block=0; block < 64; block++) {
+    audio_block_t *in = AudioStream::hostAllocate();
+    for (size_t i=0; i < AUDIO_BLOCK_SAMPLES; i++) { in->data[i] = testSample(blockStart + i); }
+    delay.hostSetInput(0, in);
+    AudioStream::hostRelease(in);
+    delay.update();
+
+    for (unsigned tap=0; tap < BAAudioEffectDelayExternal::NUM_TAPS; tap++) {
+      audio_block_t *out = delay.hostTakeOutput(tap);
+      if (!out) {
+        tapFailures |= (1 << tap);
+        continue;
+      }
+      for (size_t i=0; i < AUDIO_BLOCK_SAMPLES; i++) {
+        if (out->data[i] != testSample(blockStart - tapSamples[tap] + i)) { tapFailures |= (1 << tap); }
+      }
+      AudioStream::hostRelease(out);
+    }
+    blockStart += AUDIO_BLOCK_SAMPLES;
+  }
+  char detail[64];
+  snprintf(detail, sizeof(detail), "(failing taps mask 0x%02x)", tapFailures);
+  report(tapFailures == 0, "BAAudioEffectDelayExternal taps", detail);
+}
+
+// Run an impulse through an analog delay on an external memory slot with the given codec
+void analogDelayImpulse(ExternalSramManager &manager, SampleCodec codec, AudioEffectAnalogDelay::Filter filter,
+    float feedback, int16_t *response, size_t numBlocks)
+{
+  ExtMemSlot slot;
+  if (!manager.requestMemory(&slot, 50.0f, MemSelect::MEM0, false, true, codec)) { return; }
+  AudioEffectAnalogDelay delay(&slot);
+  delay.setFilter(filter);
+  delay.delay(static_cast<size_t>(300));
+  delay.mix(1.0f);
+  delay.feedback(feedback);
+  delay.volume(1.0f);
+  delay.bypass(false);
+  delay.enable();
+
+  for (size_t block=0; block < numBlocks; block++) {
+    audio_block_t *in = AudioStream::hostAllocate();
+    memset(in->data, 0, sizeof(in->data));
+    // the first block is stored before there is any feedback to filter, so start later
+    if (block == 4) { in->data[0] = 4096; }
+    delay.hostSetInput(0, in);
+    AudioStream::hostRelease(in);
+    delay.update();
+    audio_block_t *out = delay.hostTakeOutput(0);
+    if (out) {
+      memcpy(response + block*AUDIO_BLOCK_SAMPLES, out->data, sizeof(out->data));
+      AudioStream::hostRelease(out);
+    } else {
+      memset(response + block*AUDIO_BLOCK_SAMPLES, 0, sizeof(out->data));
+    }
+  }
+}
+
+// The 24-bit feedback path keeps more precision, but must otherwise sound the same as the 16-bit one
+void testAnalogDelayWide(ExternalSramManager &manager)
+{
+  constexpr size_t RESPONSE_BLOCKS = 32;
+  static int16_t narrow[RESPONSE_BLOCKS*AUDIO_BLOCK_SAMPLES];
+  static int16_t wide[RESPONSE_BLOCKS*AUDIO_BLOCK_SAMPLES];
+  const AudioEffectAnalogDelay::Filter filters[] = {AudioEffectAnalogDelay::Filter::DM3,
+      AudioEffectAnalogDelay::Filter::WARM, AudioEffectAnalogDelay::Filter::DARK};
+  const char *filterNames[] = {"DM3", "WARM", "DARK"};
+
+  for (unsigned f=0; f < 3; f++) {
+    for (float feedback : {0.0f, 0.25f}) {
+      analogDelayImpulse(manager, SampleCodec::PCM16, filters[f], feedback, narrow, RESPONSE_BLOCKS);
+      analogDelayImpulse(manager, SampleCodec::PACKED24, filters[f], feedback, wide, RESPONSE_BLOCKS);
+
+      long narrowPeak = 0, widePeak = 0, worst = 0;
+      for (size_t i=0; i < RESPONSE_BLOCKS*AUDIO_BLOCK_SAMPLES; i++) {
+        narrowPeak = std::max(narrowPeak, std::abs(static_cast<long>(narrow[i])));
+        widePeak = std::max(widePeak, std::abs(static_cast<long>(wide[i])));
+        worst = std::max(worst, std::abs(static_cast<long>(narrow[i]) - wide[i]));
+      }
+      char name[64], detail[96];
+      snprintf(name, sizeof(name), "AnalogDelay PCM16 vs PACKED24 %s feedback %.2f", filterNames[f], feedback);
+      snprintf(detail, sizeof(detail), "(peaks %ld and %ld, worst difference %ld)", narrowPeak, widePeak, worst);
+      // the 16-bit path truncates to 16 bits on each pass through the feedback loop,
+      // so with feedback the difference grows with the echoes
+      long tolerance = (feedback > 0.0f) ? 16 + narrowPeak/64 : 8;
+      report((narrowPeak > 0) && (worst <= tolerance), name, detail);
+    }
+  }
+}
+
+int main()
+{
+  ExternalSramManager manager(NUM_MEM_SLOTS);
+  const SampleCodec codecs[] = {SampleCodec::PCM16, SampleCodec::PACKED12, SampleCodec::MULAW,
+      SampleCodec::IMA_ADPCM, SampleCodec::PACKED24};
+
+  // the first request on a memory decides whether it uses DMA, so the blocking
+  // checks run on MEM0 and the DMA ones on MEM1
+  for (bool useDma : {false, true}) {
+    MemSelect mem = useDma ? MemSelect::MEM1 : MemSelect::MEM0;
+    for (SampleCodec codec : codecs) { testCodecRoundTrip(manager, codec, mem, useDma); }
+    testWideRoundTrip(manager, mem, useDma);
+    testAudioDelayOffsets(manager, mem, useDma);
+  }
+  testDelayExternalTaps();
+  testAnalogDelayWide(manager);
+
+  printf("%u failures, %u blocks still in use\n", numFailures, AudioStream::hostBlocksInUse());
+  return (numFailures == 0) ? 0 : 1;
+}
@@ -0,0 +1,266 @@
+/*************************************************************************
+ * This demo uses the BAGuitar library to provide enhanced control of
+ * the TGA Pro board.
+ *
+ * The latest copy of the BA Guitar library can be obtained from
+ * https://github.com/Blackaddr/BAGuitar
+ *
+ * This sketch benchmarks the SPI memory on MEM0 (and MEM1 if enabled)
+ * with both the blocking BASpiMemory and the DMA BASpiMemoryDMA interfaces.
+ * For each SPI clock and transfer size it measures the sustained read,
+ * write and mixed throughput, and the latency of a single transfer.
+ *
+ * The results are printed as CSV on the serial port, one line per
+ * measurement after a header line. Lines starting with '#' are comments.
+ * The columns are:
+ *   interface    blocking or dma
+ *   mem          0 or 1
+ *   clock_hz     the requested SPI clock
+ *   op           read, write or mixed (a write then a read of the same size)
+ *   size_bytes   bytes in each transfer
+ *   transfers    number of transfers timed
+ *   cycles       CPU cycles for all the transfers
+ *   mb_per_s     sustained throughput in MB/s (1e6 bytes per second)
+ *   cycles_per_block  cycles to move one audio block (AUDIO_BLOCK_SAMPLES 16-bit samples)
+ *   latency_avg  average cycles from starting one transfer to its completion
+ *   latency_max  worst case cycles for one transfer
+ *   busy_pct     percentage of the time the CPU spent waiting on the memory
+ *   ok           1 if the data read back matched what was written
+ *
+ * The clocks are the rates the SPI can divide from the bus clock, from
+ * DEFAULT_CLOCK_HZ up to MAX_CALIBRATION_CLOCK_HZ, e.g. 20 and 30 MHz with a
+ * 60 MHz bus.
+ *
+ * NOTE: Clocks above 20 MHz are beyond the 23LC1024 datasheet rating, the
+ * ok column shows whether the memory kept up.
+ *
+ * The sketch also runs on a PC with the host emulation in src/host, see
+ * src/host/BAHost.h. Build it from the top of the library with
+ *
+ *   g++ -std=gnu++11 -pthread -DBAGUITAR_HOST -D__MK66FX1M0__ -Isrc/host -Isrc \
+ *     -x c++ examples/Tests/SPI_MEM_benchmark/SPI_MEM_benchmark.ino -x none \
+ *     src/host/\*.cpp src/common/\*.cpp src/peripherals/BASpiMemory.cpp -o spi_mem_benchmark
+ *
+ * There the transfers run as fast as the PC copies them, add a HostSpiRamConfig
+ * with realTime set to time them at the SPI clock.
+ *
+ */
+#include <AudioStream.h>
+#include "BASpiMemory.h"
+#include "LibMemoryManagement.h"
+#include "BAHardware.h"
+
+using namespace BAGuitar;
+
+//#define BENCHMARK_MEM1 // uncomment to also benchmark MEM1 (Teensy 3.5/3.6)
+
+constexpr size_t MAX_TRANSFER_SIZE = 16384;
+constexpr size_t TEST_REGION_SIZE = 65536; // transfers cycle through this region of the memory
+constexpr size_t BYTES_PER_MEASUREMENT = 65536; // each throughput measurement moves at least this much
+constexpr size_t MIN_TRANSFERS = 8;
+constexpr size_t LATENCY_TRANSFERS = 16;
+constexpr size_t BLOCK_BYTES = AUDIO_BLOCK_SAMPLES * sizeof(int16_t);
+
+const size_t transferSizes[] = {2, 16, 64, 256, 1024, 4096, 16384};
+
+enum class BenchOp { READ, WRITE, MIXED };
+const BenchOp benchOps[] = {BenchOp::READ, BenchOp::WRITE, BenchOp::MIXED};
+
+uint8_t srcBuffer[MAX_TRANSFER_SIZE];
+uint8_t destBuffer[MAX_TRANSFER_SIZE];
+
+struct BenchResult {
+  size_t transfers;
+  uint32_t cycles;
+  uint32_t latencyAvg;
+  uint32_t latencyMax;
+  uint32_t busyPct;
+  bool ok;
+};
+
+const char *opName(BenchOp op)
+{
+  switch (op) {
+    case BenchOp::READ  : return "read";
+    case BenchOp::WRITE : return "write";
+    default             : return "mixed";
+  }
+}
+
+// With DMA the transfers are queued back to back, the queue only blocks when it is full
+void startTransfer(BASpiMemory *mem, bool useDma, bool isRead, size_t address, size_t numBytes)
+{
+  if (useDma) {
+    BASpiMemoryDMA *memDma = static_cast<BASpiMemoryDMA*>(mem);
+    if (isRead) { memDma->readAsync(address, destBuffer, numBytes); }
+    else        { memDma->writeAsync(address, srcBuffer, numBytes); }
+  } else {
+    if (isRead) { mem->read(address, destBuffer, numBytes); }
+    else        { mem->write(address, srcBuffer, numBytes); }
+  }
+}
+
+void waitForAll(BASpiMemory *mem, bool useDma)
+{
+  if (useDma) {
+    BASpiMemoryDMA *memDma = static_cast<BASpiMemoryDMA*>(mem);
+    memDma->waitFor(memDma->getLastToken());
+  }
+}
+
+BenchResult runBenchmark(BASpiMemory *mem, bool useDma, BenchOp op, size_t size)
+{
+  BenchResult result;
+  size_t transfers = BYTES_PER_MEASUREMENT / size;
+  if (transfers < MIN_TRANSFERS) { transfers = MIN_TRANSFERS; }
+  size_t regionTransfers = TEST_REGION_SIZE / size;
+
+  // mixed reads come from the half of the region the writes are not using
+  size_t readOffset = (op == BenchOp::MIXED) ? TEST_REGION_SIZE / 2 : 0;
+  if (op == BenchOp::MIXED) { regionTransfers /= 2; }
+  if (regionTransfers == 0) { regionTransfers = 1; }
+
+  // make sure there is known data to read back
+  for (size_t i=0; i < regionTransfers; i++) {
+    startTransfer(mem, useDma, false, readOffset + i*size, size);
+  }
+  waitForAll(mem, useDma);
+  mem->snapshotStats();
+
+  // sustained throughput
+  uint32_t start = ARM_DWT_CYCCNT;
+  for (size_t i=0; i < transfers; i++) {
+    size_t address = (i % regionTransfers) * size;
+    if (op != BenchOp::READ)  { startTransfer(mem, useDma, false, address, size); }
+    if (op != BenchOp::WRITE) { startTransfer(mem, useDma, true, readOffset + address, size); }
+  }
+  waitForAll(mem, useDma);
+  result.cycles = ARM_DWT_CYCCNT - start;
+  result.transfers = transfers;
+
+  SpiMemStats stats = mem->snapshotStats();
+  result.busyPct = (stats.elapsedCycles > 0) ? (uint32_t)((100ULL * stats.busyCycles) / stats.elapsedCycles) : 0;
+
+  // every write used the same source buffer, so anything read back must match it
+  memset(destBuffer, 0, size);
+  startTransfer(mem, useDma, true, readOffset, size);
+  waitForAll(mem, useDma);
+  result.ok = (memcmp(srcBuffer, destBuffer, size) == 0);
+
+  // latency of a single transfer on an idle bus
+  uint64_t latencyTotal = 0;
+  result.latencyMax = 0;
+  for (size_t i=0; i < LATENCY_TRANSFERS; i++) {
+    size_t address = (i % regionTransfers) * size;
+    uint32_t latencyStart = ARM_DWT_CYCCNT;
+    if (op != BenchOp::READ)  { startTransfer(mem, useDma, false, address, size); waitForAll(mem, useDma); }
+    if (op != BenchOp::WRITE) { startTransfer(mem, useDma, true, readOffset + address, size); waitForAll(mem, useDma); }
+    uint32_t latency = ARM_DWT_CYCCNT - latencyStart;
+    latencyTotal += latency;
+    if (latency > result.latencyMax) { result.latencyMax = latency; }
+  }
+  result.latencyAvg = (uint32_t)(latencyTotal / LATENCY_TRANSFERS);
+  return result;
+}
+
+void printResult(const char *interfaceName, unsigned memIndex, uint32_t clockHz, BenchOp op, size_t size,
+                 const BenchResult &result)
+{
+  // mixed transfers move the data twice
+  uint64_t totalBytes = (uint64_t)result.transfers * size * ((op == BenchOp::MIXED) ? 2 : 1);
+  float seconds = (float)result.cycles / (float)F_CPU;
+  float mbPerSec = (seconds > 0.0f) ? ((float)totalBytes / seconds / 1e6f) : 0.0f;
+  uint32_t cyclesPerBlock = (uint32_t)(((uint64_t)result.cycles * BLOCK_BYTES) / totalBytes);
+
+  Serial.print(interfaceName); Serial.print(",");
+  Serial.print(memIndex); Serial.print(",");
+  Serial.print(clockHz); Serial.print(",");
+  Serial.print(opName(op)); Serial.print(",");
+  Serial.print(size); Serial.print(",");
+  Serial.print(result.transfers); Serial.print(",");
+  Serial.print(result.cycles); Serial.print(",");
+  Serial.print(mbPerSec, 3); Serial.print(",");
+  Serial.print(cyclesPerBlock); Serial.print(",");
+  Serial.print(result.latencyAvg); Serial.print(",");
+  Serial.print(result.latencyMax); Serial.print(",");
+  Serial.print(result.busyPct); Serial.print(",");
+  Serial.println(result.ok ? 1 : 0);
+}
+
+void benchmarkMemory(BASpiMemory *mem, bool useDma, unsigned memIndex)
+{
+  const char *interfaceName = useDma ? "dma" : "blocking";
+  uint32_t clockRates[BASpiMemory::NUM_CLOCK_RATES];
+  BASpiMemory::getClockRates(clockRates);
+
+  // the rates are fastest first, sweep them from slowest to fastest
+  for (size_t i=BASpiMemory::NUM_CLOCK_RATES; i > 0; i--) {
+    uint32_t clockHz = clockRates[i-1];
+    if ((clockHz < BASpiMemory::DEFAULT_CLOCK_HZ) || (clockHz > BASpiMemory::MAX_CALIBRATION_CLOCK_HZ)) { continue; }
+    mem->setClock(clockHz);
+    for (auto size : transferSizes) {
+      for (auto op : benchOps) {
+        BenchResult result = runBenchmark(mem, useDma, op, size);
+        printResult(interfaceName, memIndex, clockHz, op, size, result);
+      }
+    }
+  }
+  mem->setClock(BASpiMemory::DEFAULT_CLOCK_HZ);
+}
+
+void setup() {
+
+  Serial.begin(57600);
+  while (!Serial) {}
+  delay(5);
+
+  for (size_t i=0; i < MAX_TRANSFER_SIZE; i++) {
+    srcBuffer[i] = (uint8_t)(i * 7 + 1);
+  }
+
+  Serial.print("# SPI memory benchmark, F_CPU="); Serial.println(F_CPU);
+  Serial.println("interface,mem,clock_hz,op,size_bytes,transfers,cycles,mb_per_s,cycles_per_block,"
+                 "latency_avg,latency_max,busy_pct,ok");
+}
+
+void loop() {
+
+  // The blocking interface runs first, the DMA interface takes over the SPI port once started
+  {
+    BASpiMemory spiMem0(SpiDeviceId::SPI_DEVICE0);
+    spiMem0.begin();
+    benchmarkMemory(&spiMem0, false, 0);
+  }
+  {
+    BASpiMemoryDMA spiMem0(SpiDeviceId::SPI_DEVICE0);
+    spiMem0.begin();
+    benchmarkMemory(&spiMem0, true, 0);
+  }
+
+#ifdef BENCHMARK_MEM1
+  {
+    BASpiMemory spiMem1(SpiDeviceId::SPI_DEVICE1);
+    spiMem1.begin();
+    benchmarkMemory(&spiMem1, false, 1);
+  }
+  {
+    BASpiMemoryDMA spiMem1(SpiDeviceId::SPI_DEVICE1);
+    spiMem1.begin();
+    benchmarkMemory(&spiMem1, true, 1);
+  }
+#endif
+
+  Serial.println("# done");
+#if !defined(BAGUITAR_HOST)
+  while(true) {}
+#endif
+}
+
+#if defined(BAGUITAR_HOST)
+int main()
+{
+  setup();
+  loop();
+  return 0;
+}
+#endif
@@ -35,7 +35,9 @@ namespace BAGuitar {
  * for delay, feedback (or regen), mix and output level. All parameters can be
  * controlled by MIDI. The class supports internal memory, or external SPI
  * memory by providing an ExtMemSlot. External memory access uses DMA to reduce
- * process load.
+ * process load.<br>
+ * When the slot stores SampleCodec::PACKED24 samples, the whole feedback loop runs
+ * on 24-bit samples, so the echoes aren't rounded to 16 bits on every pass.
  *****************************************************************************/
 class AudioEffectAnalogDelay : public AudioStream {
 public:
@@ -71,7 +73,8 @@ public:
 
 	/// Construct an analog delay using external SPI via an ExtMemSlot. The amount of
 	/// delay will be determined by the amount of memory in the slot.
-	/// @param slot A pointer to the ExtMemSlot to use for the delay.
+	/// @param slot A pointer to the ExtMemSlot to use for the delay. A PACKED24 slot
+	/// gives a lower noise feedback path for 1.5 times the memory.
 	AudioEffectAnalogDelay(ExtMemSlot *slot); // requires sufficiently sized pre-allocated memory
 
 	virtual ~AudioEffectAnalogDelay(); ///< Destructor
@@ -166,9 +169,20 @@ private:
 	AudioDelay *m_memory = nullptr;
 	size_t m_maxDelaySamples = 0;
 	audio_block_t *m_previousBlock = nullptr;
-	audio_block_t *m_blockToRelease  = nullptr;
 	IirBiQuadFilterHQ *m_iir = nullptr;
 
+	// External memory DMA reads one block ahead
+	int16_t m_prefetchBuffer[AUDIO_BLOCK_SAMPLES]; // the delayed samples for the next update
+	bool m_prefetchValid = false;                  // a read into m_prefetchBuffer has been issued
+	size_t m_prefetchDelaySamples = 0;             // the delay the prefetch was issued for
+
+	// 24-bit feedback path, used with PACKED24 slots
+	bool m_wideFeedback = false;
+	int32_t *m_widePrefetch = nullptr;             // replaces m_prefetchBuffer
+	int32_t *m_widePrevious = nullptr;             // replaces m_previousBlock
+	bool m_widePreviousValid = false;
+	int m_wideFilterShift = 0;                     // left shift still owed by the filter output, see m_loadFilter()
+
 	// Controls
 	int m_midiConfig[NUM_CONTROLS][2]; // stores the midi parameter mapping
 	size_t m_delaySamples = 0;
@@ -178,9 +192,13 @@ private:
 
 	void m_preProcessing(audio_block_t *out, audio_block_t *dry, audio_block_t *wet);
 	void m_postProcessing(audio_block_t *out, audio_block_t *dry, audio_block_t *wet);
+	void m_preProcessing(int32_t *out, int32_t *dry, int32_t *wet);
+	void m_postProcessing(int32_t *out, int32_t *dry, int32_t *wet);
+	void m_updateWide(audio_block_t *inputAudioBlock);
 
 	// Coefficients
 	void m_constructFilter(void);
+	void m_loadFilter(unsigned numStages, const int32_t *coeffs, int coeffShift);
 };
 
 }
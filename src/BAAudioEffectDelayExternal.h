@@ -29,12 +29,22 @@
 #include "AudioStream.h"
 
 #include "BAHardware.h"
+#include "LibMemoryManagement.h"
 
 namespace BAGuitar {
 
 /**************************************************************************//**
  * BAAudioEffectDelayExternal can use external SPI RAM for delay rather than
  * the limited RAM available on the Teensy itself.
+ * @details The memory comes from the ExternalSramManager and is transferred
+ * with DMA. Taps longer than two audio blocks are read one block ahead, all in
+ * a single request, so their data is waiting when the next update() runs.
+ * Shorter taps, and taps whose delay was just changed, are read during
+ * update() after the incoming block has been written.<br>
+ * The read-ahead only runs in the background while the memory's DMA queue can
+ * hold all of it and its schedule window is the whole queue, the defaults for
+ * the memory the ExternalSramManager creates. Otherwise the rest of the reads
+ * are waited for in the next update().
  *****************************************************************************/
 class BAAudioEffectDelayExternal : public AudioStream
 {
@@ -54,6 +64,7 @@ public:
 	virtual ~BAAudioEffectDelayExternal();
 
 	/// set the actual amount of delay on a given delay tap
+	/// @details the external memory is allocated the first time a tap is set
 	/// @param channel specify channel tap 1-8
 	/// @param milliseconds specify how much delay for the specified tap
 	void delay(uint8_t channel, float milliseconds);
@@ -64,31 +75,26 @@ public:
 
 	virtual void update(void);
 
-	static unsigned m_usingSPICount[2]; // internal use for all instances
+	static constexpr unsigned NUM_TAPS = 8; ///< the number of delay taps
 
 private:
-	void initialize(BAGuitar::MemSelect mem, unsigned delayLength = 1e6);
-	void read(uint32_t address, uint32_t count, int16_t *data);
-	void write(uint32_t address, uint32_t count, const int16_t *data);
-	void zero(uint32_t address, uint32_t count);
-	unsigned m_memoryStart;    // the first address in the memory we're using
-	unsigned m_memoryLength;   // the amount of memory we're using
-	unsigned m_headOffset;     // head index (incoming) data into external memory
-	unsigned m_channelDelayLength[8]; // # of sample delay for each channel (128 = no delay)
-	unsigned  m_activeMask;      // which output channels are active
-	static unsigned m_allocated[2];
+	void initialize(BAGuitar::MemSelect mem, unsigned delayLength = (SPI_MAX_ADDR_24BIT+1)/sizeof(int16_t));
+	bool m_allocateMemory();
+	unsigned m_tapOffset(unsigned channel, unsigned headOffset) const;
+
+	unsigned m_requestedLength; // the amount of memory requested, in samples
+	unsigned m_memoryLength;    // the amount of memory we're using, in samples
+	unsigned m_headOffset;      // head index (incoming) data into external memory
+	unsigned m_channelDelayLength[NUM_TAPS]; // # of sample delay for each channel (128 = no delay)
+	volatile unsigned m_activeMask;   // which output channels are active
+	volatile unsigned m_prefetchMask; // which channels have their next block in m_tapBuffer
 	audio_block_t *m_inputQueueArray[1];
 
 	BAGuitar::MemSelect m_mem;
-	SPIClass *m_spi = nullptr;
-	int m_spiChannel = 0;
-	int m_misoPin = 0;
-	int m_mosiPin = 0;
-	int m_sckPin = 0;
-	int m_csPin = 0;
-
-	void m_startUsingSPI(int spiBus);
-	void m_stopUsingSPI(int spiBus);
+	ExtMemSlot m_slot;
+	int16_t m_tapBuffer[NUM_TAPS][AUDIO_BLOCK_SAMPLES]; // the output block for each channel
+
+	static ExternalSramManager m_memoryManager; // shared by all instances
 };
 
 
@@ -3,9 +3,9 @@
  *  @author Steve Lascos
  *  @company Blackaddr Audio
  *
- *  BAAudioEffectDelayExternal is a class for using an external SPI SRAM chip
- *  as an audio delay line. The external memory can be shared among several
- *  different instances of BAAudioEffectDelayExternal by specifying the max delay
+ *  BAAudioEffectLoopExternal is a class for using an external SPI SRAM chip
+ *  as an audio looper. The external memory can be shared among several
+ *  different instances of BAAudioEffectLoopExternal by specifying the max loop
  *  length during construction.
  *
  *  @copyright This program is free software: you can redistribute it and/or modify
@@ -29,12 +29,19 @@
 #include "AudioStream.h"
 
 #include "BAHardware.h"
+#include "LibMemoryManagement.h"
 
 namespace BAGuitar {
 
 /**************************************************************************//**
- * BAAudioEffectDelayExternal can use external SPI RAM for delay rather than
- * the limited RAM available on the Teensy itself.
+ * BAAudioEffectLoopExternal records its input to external SPI RAM and can loop
+ * the most recent part of the recording.
+ * @details While the loop is off the input passes through and is recorded. When
+ * the loop is turned on, recording stops and the last part of the recording is
+ * played back repeatedly. The loop boundaries are sample accurate, a block that
+ * crosses the end of the loop continues from the loop start in the same block.
+ * The memory is transferred with DMA and each playback block is read one block
+ * ahead, so looping costs about the same CPU as pass-through.
  *****************************************************************************/
 class BAAudioEffectLoopExternal : public AudioStream
 {
@@ -49,46 +56,43 @@ public:
 
 	/// Specify external memory, and how much of the memory to use
 	/// @param type specify which memory to use
-	/// @param delayLengthMs maximum delay length in milliseconds
+	/// @param delayLengthMs maximum loop length in milliseconds
     BAAudioEffectLoopExternal(BAGuitar::MemSelect type, float delayLengthMs);
 	virtual ~BAAudioEffectLoopExternal();
 
-	/// set the actual amount of delay on a given delay tap
-	/// @param channel specify channel tap 1-8
-	/// @param milliseconds specify how much delay for the specified tap
+	/// Start looping the most recently recorded audio
+	/// @details calling this while already looping restarts the loop with the new length,
+	/// ending at the same place. The external memory is allocated by the first update(),
+	/// so this does nothing until the audio is running.
+	/// @param milliseconds the length of the loop, at least one audio block
 	void delay(float milliseconds);
 
-	/// Disable a delay channel tap
-	/// @param channel specify channel tap 1-8
+	/// Stop looping, the input passes through and is recorded again
 	void disable();
 
 	virtual void update(void);
 
-	static unsigned m_usingSPICount[2]; // internal use for all instances
-
 private:
-	void initialize(BAGuitar::MemSelect mem, unsigned delayLength = 1e6);
-	void read(uint32_t address, uint32_t count, int16_t *data);
-	void write(uint32_t address, uint32_t count, const int16_t *data);
-	void zero(uint32_t address, uint32_t count);
-	unsigned m_memoryStart;    // the first address in the memory we're using
-	unsigned m_memoryLength;   // the amount of memory we're using
+	void initialize(BAGuitar::MemSelect mem, unsigned delayLength = (SPI_MAX_ADDR_24BIT+1)/sizeof(int16_t));
+	bool m_allocateMemory();
+	void m_readLoopBlock();
+
+	unsigned m_requestedLength; // the amount of memory requested, in samples
+	bool m_allocationFailed;    // true when the memory could not be allocated
+	unsigned m_memoryLength;   // the amount of memory we're using, in samples
 	unsigned m_headOffset;     // head index (incoming) data into external memory
-	unsigned m_channelDelayLength; // # of sample delay for each channel (128 = no delay)
-	unsigned  m_activeMask;      // which output channels are active
-    unsigned read_offset;
+	unsigned m_loopStart;      // first sample of the loop in the memory
+	unsigned m_loopLength;     // # of samples in the loop
+	unsigned m_loopPosition;   // next sample to read, relative to m_loopStart
+	volatile unsigned m_activeMask; // non-zero when looping
+	volatile bool m_prefetched;     // true when m_playBuffer holds the next block of the loop
 	audio_block_t *m_inputQueueArray[1];
 
 	BAGuitar::MemSelect m_mem;
-	SPIClass *m_spi = nullptr;
-	int m_spiChannel = 0;
-	int m_misoPin = 0;
-	int m_mosiPin = 0;
-	int m_sckPin = 0;
-	int m_csPin = 0;
-
-	void m_startUsingSPI(int spiBus);
-	void m_stopUsingSPI(int spiBus);
+	ExtMemSlot m_slot;
+	int16_t m_playBuffer[AUDIO_BLOCK_SAMPLES];  // the next block of the loop
+
+	static ExternalSramManager m_memoryManager; // shared by all instances
 };
 
 
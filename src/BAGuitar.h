@@ -33,5 +33,6 @@
 #include "AudioEffectAnalogDelay.h"
 #include "LibBasicFunctions.h"
 #include "LibMemoryManagement.h"
+#include "LibSampleCodecs.h"
 
 #endif /* __BATGUITAR_H */
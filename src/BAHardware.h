@@ -66,7 +66,8 @@ enum MemSelect : unsigned {
 };
 
 /**************************************************************************//**
- * Set the maximum address (byte-based) in the external SPI memories
+ * Set the maximum address (byte-based) in the external SPI memories. This is
+ * the size of the stock 23LC1024 parts, larger parts are detected at runtime.
  *****************************************************************************/
 constexpr size_t MEM_MAX_ADDR[NUM_MEM_SLOTS] = { 131071, 131071 };
 
@@ -78,7 +79,8 @@ enum SpiDeviceId : unsigned {
 	SPI_DEVICE0 = 0, ///< Arduino SPI device
 	SPI_DEVICE1 = 1  ///< Arduino SPI1 device
 };
-constexpr int SPI_MAX_ADDR = 131071; ///< Max address size per chip
+constexpr int SPI_MAX_ADDR = 131071; ///< Max address size per chip, for the stock 23LC1024 parts
+constexpr size_t SPI_MAX_ADDR_24BIT = 0xFFFFFF; ///< Max address reachable with 24-bit addressing
 
 
 #else
@@ -31,6 +31,62 @@
 
 namespace BAGuitar {
 
+/// Identifies a transfer queued with BASpiMemoryDMA so its completion can be checked later.
+using DmaToken = uint32_t;
+
+/// A token that is never issued by BASpiMemoryDMA. It is always considered complete.
+constexpr DmaToken DMA_TOKEN_NONE = 0;
+
+/// Function called when a queued DMA transfer has completed.
+/// @param context the user pointer provided when the transfer was queued
+/// @param token the token of the transfer that completed
+using DmaCallback = void (*)(void *context, DmaToken token);
+
+/// Scheduling priority of a queued DMA transfer. Lower values are sent to the memory first.
+enum class SpiPriority : uint8_t {
+	OUTPUT_READ = 0, ///< reads needed to produce the current audio output
+	AUDIO_WRITE = 1, ///< writes of new audio data
+	BACKGROUND  = 2, ///< housekeeping that can wait, such as clearing memory
+};
+
+/// The number of SpiPriority levels
+constexpr unsigned NUM_SPI_PRIORITIES = 3;
+
+/// Operating modes of the 23LC1024 class SPI RAMs, as written to the mode register
+enum class SpiMemMode : uint8_t {
+	BYTE       = 0x00, ///< each transaction accesses a single byte
+	PAGE       = 0x80, ///< transactions wrap around within a 32 byte page
+	SEQUENTIAL = 0x40  ///< transactions continue across the entire array
+};
+
+/// The kinds of SPI RAM the library can drive, detected by begin()
+enum class SpiMemDevice : uint8_t {
+	SRAM_23LC1024, ///< Microchip 23LC1024 class SRAM, with a mode register and no page limits
+	PSRAM,         ///< ESP-PSRAM64/APS6404 class PSRAM, up to 8 MB with 1 KB pages and no mode register
+};
+
+/// Describes one part of a scatter-gather read from the SPI RAM
+struct SpiGatherEntry {
+	size_t address;   ///< the address in the SPI RAM to read from
+	uint8_t *dest;    ///< pointer to the destination for this part
+	size_t numBytes;  ///< number of bytes to read for this part
+};
+
+/**************************************************************************//**
+ *  SpiMemStats holds traffic counters for an SPI memory, or for the part of its
+ *  traffic that came from one ExtMemSlot.
+ *  @details Cycles are CPU cycles from the ARM cycle counter. It wraps about every
+ *  23 seconds at 180 MHz, so take snapshots more often than that.
+ *****************************************************************************/
+struct SpiMemStats {
+	uint32_t bytesRead = 0;     ///< bytes read from the memory
+	uint32_t bytesWritten = 0;  ///< bytes written to the memory, including zeros
+	uint32_t transactions = 0;  ///< read, write and zero requests. A DMA gather is one request.
+	uint32_t dmaChunks = 0;     ///< DMA transactions sent, requests are split at MAX_DMA_XFER_SIZE and page boundaries
+	uint64_t busyCycles = 0;    ///< cycles the CPU spent waiting on the memory
+	uint32_t elapsedCycles = 0; ///< cycles since the counters were last reset
+};
+
 /**************************************************************************//**
  *  This wrapper class uses the Arduino SPI (Wire) library to access the SPI ram.
  *  @details The purpose of this class is primilary for functional testing since
@@ -39,9 +95,21 @@ namespace BAGuitar {
  *****************************************************************************/
 class BASpiMemory {
 public:
+	/// Default SPI clock, the rated speed of the 23LC1024
+	static constexpr uint32_t DEFAULT_CLOCK_HZ = 20000000;
+
+	/// Default upper limit for the clocks tried by calibrateClock()
+	static constexpr uint32_t MAX_CALIBRATION_CLOCK_HZ = 60000000;
+
+	/// Default size of the scratch region tested by calibrateClock()
+	static constexpr size_t DEFAULT_CALIBRATION_BYTES = 4096;
+
+	/// Number of clock rates returned by getClockRates()
+	static constexpr size_t NUM_CLOCK_RATES = 9;
+
 	BASpiMemory() = delete;
 	/// Create an object to control either MEM0 (via SPI1) or MEM1 (via SPI2).
-	/// @details default is 20 Mhz
+	/// @details default is DEFAULT_CLOCK_HZ, 20 Mhz
 	/// @param memDeviceId specify which MEM to control with SpiDeviceId.
 	BASpiMemory(SpiDeviceId memDeviceId);
 	/// Create an object to control either MEM0 (via SPI1) or MEM1 (via SPI2)
@@ -51,8 +119,94 @@ public:
 	virtual ~BASpiMemory();
 
 	/// initialize and configure the SPI peripheral
+	/// @details This also returns the SPI RAM to single-bit SPI and sequential mode
+	/// in case it was left in another mode, e.g. by a previous program. The type
+	/// of memory and its size are detected, see getDevice() and getSize(). Detecting
+	/// the size writes to the memory, the bytes it writes over are put back afterwards.
 	virtual void begin();
 
+	/// Set the operating mode of the SPI RAM via its mode register. All library
+	/// transfers require SpiMemMode::SEQUENTIAL, which begin() sets.
+	/// @details This is a blocking transfer. When using DMA, only call it when
+	/// no transfers are in progress. PSRAM has no mode register, this does nothing.
+	/// @param mode the new operating mode
+	void setMode(SpiMemMode mode);
+
+	/// Read the operating mode from the mode register of the SPI RAM
+	/// @details This is a blocking transfer. When using DMA, only call it when
+	/// no transfers are in progress.
+	/// @returns the current operating mode. PSRAM always reports SpiMemMode::SEQUENTIAL.
+	SpiMemMode getMode();
+
+	/// Get the type of memory detected by begin()
+	/// @returns the memory type
+	SpiMemDevice getDevice() const { return m_device; }
+
+	/// Get the size of the memory detected by begin()
+	/// @details Until begin() is called this is the default size, SPI_MAX_ADDR+1.
+	/// @returns the memory size in bytes, or 0 if no memory responded
+	size_t getSize() const { return m_size; }
+
+	/// Get the largest number of bytes a single transaction can access
+	/// @details Transfers are split automatically so transactions never cross a
+	/// page. 16-bit transfers must start on an even address for this to work.
+	/// PSRAM transactions are also kept short enough for chip select to go high
+	/// within the tCEM limit of 8 us, only a few bytes at 20 MHz, so each transfer
+	/// is split into many transactions and carries much more command overhead.
+	/// @returns the page size in bytes, or 0 if the memory has no page limit
+	size_t getPageSize() const;
+
+	/// Change the SPI clock
+	/// @details The SPI rounds the clock down to the nearest rate it can divide
+	/// from the bus clock. When using DMA, any transfers in progress are completed first.
+	/// @param speedHz the new clock in Hz
+	virtual void setClock(uint32_t speedHz);
+
+	/// Get the SPI clock
+	/// @returns the clock in Hz as requested by the constructor, setClock() or calibrateClock()
+	uint32_t getClock() const { return m_clockHz; }
+
+	/// Get the fastest clock rates the SPI can divide from the bus clock
+	/// @details Other rates passed to setClock() run at the next one down. The rates
+	/// are in decreasing order, starting at half the bus clock.
+	/// @param rates array of NUM_CLOCK_RATES the rates in Hz are written to
+	static void getClockRates(uint32_t *rates);
+
+	/// Find the fastest SPI clock the memory works reliably at.
+	/// @details The clock is stepped up from DEFAULT_CLOCK_HZ through the rates the
+	/// SPI can divide from the bus clock, e.g. 20 and 30 MHz with a 60 MHz bus or
+	/// 20, 24, 30, 40 and 60 MHz with a 120 MHz bus, running a pattern test over a
+	/// scratch region at each one.
+	/// The clock is set one step below the fastest rate that passed, leaving some
+	/// margin, whether the next rate failed or was above maxSpeedHz. When only the
+	/// first rate passed, it's used as is. Store the result and pass it to the constructor
+	/// or setClock() at the next boot to skip calibration. Call after begin() and
+	/// before the memory is in use, the scratch region is left cleared and rates
+	/// that fail may corrupt other addresses. Clocks above DEFAULT_CLOCK_HZ are
+	/// beyond the 23LC1024 datasheet rating.
+	/// @param maxSpeedHz the fastest clock to try
+	/// @param address the start of the scratch region
+	/// @param numBytes the size of the scratch region in bytes
+	/// @returns the calibrated clock in Hz, or 0 if no clock passed and the clock is unchanged
+	uint32_t calibrateClock(uint32_t maxSpeedHz = MAX_CALIBRATION_CLOCK_HZ, size_t address = 0,
+			size_t numBytes = DEFAULT_CALIBRATION_BYTES);
+
+	/// Get the traffic counters
+	/// @details The counters are always running. They are reset at the end of begin()
+	/// and calibrateClock(). For blocking transfers, the whole transfer counts as busy.
+	/// With DMA, busy cycles are spent waiting for a transfer or for a free queue entry.
+	/// @returns a copy of the counters
+	SpiMemStats getStats() const;
+
+	/// Get the traffic counters and reset them, as a single operation
+	/// @returns a copy of the counters before they were reset
+	SpiMemStats snapshotStats();
+
+	/// Return the SPI RAM to single-bit SPI if it was left in SDI (dual) or
+	/// SQI (quad) mode. The TGA Pro only connects the single-bit SPI signals
+	/// so the library always talks single-bit SPI.
+	void resetIo();
+
 	/// write a single 8-bit word to the specified address
 	/// @param address the address in the SPI RAM to write to
 	/// @param data the value to write
@@ -107,6 +261,11 @@ public:
 	/// @param numWords the number of 16-bit words to transfer
 	virtual void read16(size_t address, uint16_t *dest, size_t numWords);
 
+	/// Read several non-contiguous blocks of 8-bit data
+	/// @param entries array of address, destination and size for each part
+	/// @param numEntries number of entries in the array
+	virtual void readGather(const SpiGatherEntry *entries, size_t numEntries);
+
 	/// Check if the class has been configured by a previous begin() call
 	/// @returns true if initialized, false if not yet initialized
     bool isStarted() const { return m_started; }
@@ -116,29 +275,86 @@ protected:
 	SpiDeviceId m_memDeviceId; // the MEM device being control with this instance
 	uint8_t m_csPin; // the IO pin number for the CS on the controlled SPI device
 	SPISettings m_settings; // the Wire settings for this SPI port
+	uint32_t m_clockHz = DEFAULT_CLOCK_HZ; // the SPI clock in m_settings
+	size_t m_tcemBurstBytes = 0; // the most data bytes in one PSRAM transaction at m_clockHz
 	bool m_started = false;
+	SpiMemDevice m_device = SpiMemDevice::SRAM_23LC1024; // the type of memory detected
+	size_t m_size = SPI_MAX_ADDR+1; // the size of the memory in bytes
+	SpiMemStats m_stats; // traffic counters, elapsedCycles is filled in by getStats()
+	uint32_t m_statsStartCycles = 0; // cycle count when the counters were reset
+	uint32_t m_commandStartCycles = 0; // cycle count when the current blocking transaction started
+
+	void m_configureDevice();
+	bool m_isPsram();
+	size_t m_probeSize();
+	void m_beginCommand(int command, size_t address);
+	void m_endCommand();
+	size_t m_commandSize(int command) const;
+	size_t m_burstBytes(size_t address, size_t numBytes) const;
+	void m_updateBurstLimit();
+	bool m_patternTest(size_t address, size_t numBytes);
+	void m_countTransfer(bool isRead, size_t numBytes);
+	void m_resetStats();
+	virtual void m_waitIdle() {}
 
 };
 
 
+/**************************************************************************//**
+ *  BASpiMemoryDMA uses the DmaSpi library to queue transfers to the SPI RAM.
+ *  @details Transfers are placed in a queue of pre-allocated descriptors so
+ *  read(), write() and zero() return immediately while several transfers are
+ *  in flight. The caller only waits when the queue is full. Source and
+ *  destination buffers must remain valid until the transfer completes.<br>
+ *  Every queued transfer is identified by a DmaToken and may have a completion
+ *  callback. The DmaSpi library has no per-transfer completion hook, so callbacks
+ *  are dispatched by service(), which is called whenever a transfer is queued or
+ *  a token is checked with isDone() or waitFor().<br>
+ *  The queue is also the scheduler for the SPI bus. Every transfer has an
+ *  SpiPriority, and at most a window of transfers is handed to the DMA at a
+ *  time, DEFAULT_SCHEDULE_WINDOW unless changed with setScheduleWindow(). Each
+ *  time service() runs, the highest priority waiting transfers fill the window,
+ *  so output reads are not stuck behind writes or background work. The DmaSpi
+ *  library can't tell us when a transfer completes, so waiting transfers only
+ *  move when the memory is used. The audio update does this every block, and
+ *  service() should be called from loop() so background transfers keep moving
+ *  in between. Transfers
+ *  of the same priority keep their order. A transfer never passes an earlier one
+ *  that touches the same addresses unless both are reads. All users of a memory
+ *  should share one BASpiMemoryDMA, as the ExternalSramManager does.
+ *****************************************************************************/
 class BASpiMemoryDMA : public BASpiMemory {
 public:
+	/// Default number of DMA transactions that can be queued at once
+	static constexpr size_t DEFAULT_QUEUE_DEPTH = 16;
+
+	/// Default number of DMA transactions handed to the DMA at once. One in
+	/// progress and one ready behind it keeps the bus busy while service() runs,
+	/// everything else waits in the queue in priority order.
+	static constexpr size_t DEFAULT_SCHEDULE_WINDOW = 2;
+
 	BASpiMemoryDMA() = delete;
 
 	/// Create an object to control either MEM0 (via SPI1) or MEM1 (via SPI2).
-	/// @details default is 20 Mhz
+	/// @details default is DEFAULT_CLOCK_HZ, 20 Mhz
 	/// @param memDeviceId specify which MEM to control with SpiDeviceId.
 	BASpiMemoryDMA(SpiDeviceId memDeviceId);
 
 	/// Create an object to control either MEM0 (via SPI1) or MEM1 (via SPI2)
 	/// @param memDeviceId specify which MEM to control with SpiDeviceId.
 	/// @param speedHz specify the desired speed in Hz.
-	BASpiMemoryDMA(SpiDeviceId memDeviceId, uint32_t speedHz);
+	/// @param queueDepth the number of DMA transactions that can be in flight at once.
+	/// Each transaction is at most MAX_DMA_XFER_SIZE bytes.
+	BASpiMemoryDMA(SpiDeviceId memDeviceId, uint32_t speedHz, size_t queueDepth = DEFAULT_QUEUE_DEPTH);
 	virtual ~BASpiMemoryDMA();
 
 	/// initialize and configure the SPI peripheral
 	void begin() override;
 
+	/// Change the SPI clock, after completing any transfers in progress
+	/// @param speedHz the new clock in Hz
+	void setClock(uint32_t speedHz) override;
+
 	/// Write a block of 8-bit data to the specified address
 	/// @param address the address in the SPI RAM to write to
 	/// @param src pointer to the source data block
@@ -173,13 +389,102 @@ public:
 	/// @param numWords the number of 16-bit words to transfer
 	void read16(size_t address, uint16_t *dest, size_t numWords) override;
 
-	/// Check if a DMA write is in progress
+	/// Read several non-contiguous blocks of 8-bit data
+	/// @param entries array of address, destination and size for each part
+	/// @param numEntries number of entries in the array
+	void readGather(const SpiGatherEntry *entries, size_t numEntries) override;
+
+	/// Queue a read of a block of 8-bit data from the specified address
+	/// @param address the address in the SPI RAM to read from
+	/// @param dest pointer to the destination, must remain valid until the transfer completes
+	/// @param numBytes size of the data block in bytes
+	/// @param callback optional function to call once the data has arrived in dest
+	/// @param context user pointer passed to the callback
+	/// @param priority scheduling priority of the transfer
+	/// @returns a token that identifies the transfer
+	DmaToken readAsync(size_t address, uint8_t *dest, size_t numBytes, DmaCallback callback = nullptr, void *context = nullptr,
+			SpiPriority priority = SpiPriority::OUTPUT_READ);
+
+	/// Queue several non-contiguous reads as a single request
+	/// @details all parts share one token and one completion callback, which is
+	/// called once every part has arrived. The entries array itself may be discarded
+	/// once the function returns, but each destination must remain valid.
+	/// @param entries array of address, destination and size for each part
+	/// @param numEntries number of entries in the array
+	/// @param callback optional function to call once all the data has arrived
+	/// @param context user pointer passed to the callback
+	/// @param priority scheduling priority of the transfer
+	/// @returns a token that identifies the whole request
+	DmaToken readGatherAsync(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback = nullptr, void *context = nullptr,
+			SpiPriority priority = SpiPriority::OUTPUT_READ);
+
+	/// Queue a write of a block of 8-bit data to the specified address
+	/// @param address the address in the SPI RAM to write to
+	/// @param src pointer to the source data, must remain valid until the transfer completes
+	/// @param numBytes size of the data block in bytes
+	/// @param callback optional function to call once the data has been written
+	/// @param context user pointer passed to the callback
+	/// @param priority scheduling priority of the transfer
+	/// @returns a token that identifies the transfer
+	DmaToken writeAsync(size_t address, uint8_t *src, size_t numBytes, DmaCallback callback = nullptr, void *context = nullptr,
+			SpiPriority priority = SpiPriority::AUDIO_WRITE);
+
+	/// Queue a write of a block of zeros to the specified address
+	/// @param address the address in the SPI RAM to write to
+	/// @param numBytes size of the data block in bytes
+	/// @param callback optional function to call once the zeros have been written
+	/// @param context user pointer passed to the callback
+	/// @param priority scheduling priority of the transfer
+	/// @returns a token that identifies the transfer
+	DmaToken zeroAsync(size_t address, size_t numBytes, DmaCallback callback = nullptr, void *context = nullptr,
+			SpiPriority priority = SpiPriority::AUDIO_WRITE);
+
+	/// Check if a queued transfer has completed
+	/// @param token the token returned when the transfer was queued
+	/// @returns true if the transfer, and every transfer of the same priority queued
+	/// before it, has completed
+	bool isDone(DmaToken token);
+
+	/// Wait until a queued transfer has completed
+	/// @param token the token returned when the transfer was queued
+	void waitFor(DmaToken token);
+
+	/// Get the token of the most recently queued transfer
+	/// @returns the last issued token, or DMA_TOKEN_NONE if nothing has been queued
+	DmaToken getLastToken() const { return m_lastToken; }
+
+	/// Retire completed transfers, dispatch their completion callbacks and hand the
+	/// next waiting transfers to the DMA.
+	/// @details callbacks are called in the order the transfers were sent. Calling
+	/// this regularly, e.g. from loop(), keeps background transfers moving when
+	/// nothing else is using the memory. It may be called from loop() while the
+	/// audio interrupt uses the same memory, the callbacks are then called from
+	/// whichever of them retires the transfer.
+	void service();
+
+	/// Check if a DMA write is queued or in progress
 	/// @returns true if a write DMA is in progress, else false
-	bool isWriteBusy() const;
+	bool isWriteBusy();
 
-	/// Check if a DMA read is in progress
+	/// Check if a DMA read is queued or in progress
 	/// @returns true if a read DMA is in progress, else false
-	bool isReadBusy() const;
+	bool isReadBusy();
+
+	/// Get the number of DMA transactions that can be queued at once
+	/// @returns the depth of the transaction queue
+	size_t getQueueDepth() const { return m_queueDepth; }
+
+	/// Set how many transactions are handed to the DMA at once.
+	/// @details The default is DEFAULT_SCHEDULE_WINDOW. A small window lets urgent
+	/// transfers pass waiting ones, but waiting transfers are only handed to the DMA
+	/// when service() runs, so the bus is idle in between unless it's called often.
+	/// The queue depth sends every transfer as soon as it's queued, in FIFO order.
+	/// @param numEntries the window size, from 1 to the queue depth
+	void setScheduleWindow(size_t numEntries);
+
+	/// Get how many transactions are handed to the DMA at once
+	/// @returns the window size
+	size_t getScheduleWindow() const { return m_window; }
 
 	/// Readout the 8-bit contents of the DMA storage buffer to the specified destination
 	/// @param dest pointer to the destination
@@ -195,18 +500,56 @@ public:
 
 private:
 
+	/// Each queued SPI transaction consists of a command/address phase followed
+	/// by a data phase, sharing the same chip select.
+	struct DmaQueueEntry {
+		/// Where the entry is in its life cycle
+		enum class State : uint8_t {
+			FREE,    ///< available for a new transaction
+			CLAIMED, ///< being filled in for a new transaction
+			PENDING, ///< waiting to be handed to the DMA
+			ACTIVE,  ///< registered with the DMA
+		};
+		uint8_t *commandBuffer = nullptr; ///< storage for the SPI command and address bytes
+		DmaSpi::Transfer commandTransfer; ///< DMA transfer for the command/address phase
+		DmaSpi::Transfer dataTransfer;    ///< DMA transfer for the data phase
+		volatile State state = State::FREE;
+		bool isRead = false;              ///< true when the data phase is a read
+		SpiPriority priority = SpiPriority::OUTPUT_READ; ///< scheduling priority
+		uint32_t sequence = 0;            ///< order the entry was queued in, for keeping same-priority order
+		size_t address = 0;               ///< first memory address, for ordering conflicting transfers
+		size_t numBytes = 0;              ///< number of bytes transferred
+		DmaToken token = DMA_TOKEN_NONE;  ///< token of the request this entry belongs to
+		DmaCallback callback = nullptr;   ///< called when the entry is retired, only set on a request's last entry
+		void *context = nullptr;          ///< user pointer for the callback
+	};
+
 	DmaSpiGeneric *m_spiDma = nullptr;
 	AbstractChipSelect *m_cs = nullptr;
 
-	uint8_t *m_txCommandBuffer = nullptr;
-	DmaSpi::Transfer *m_txTransfer;
-	uint8_t *m_rxCommandBuffer = nullptr;
-	DmaSpi::Transfer *m_rxTransfer;
-
-	uint16_t m_txXferCount;
-	uint16_t m_rxXferCount;
-
-	void m_setSpiCmdAddr(int command, size_t address, uint8_t *dest);
+	DmaQueueEntry *m_queue = nullptr;    ///< pool of transaction descriptors
+	uint8_t *m_commandBuffers = nullptr; ///< command/address storage for all queue entries
+	size_t *m_active = nullptr;          ///< circular list of ACTIVE entries, in the order they were registered
+	size_t m_queueDepth = 0;             ///< number of entries in the queue
+	size_t m_window = 0;                 ///< maximum number of ACTIVE entries
+	size_t m_activeHead = 0;             ///< where the next ACTIVE entry is added
+	size_t m_activeTail = 0;             ///< the oldest ACTIVE entry
+	volatile size_t m_activeCount = 0;   ///< number of ACTIVE entries in the active list
+	volatile size_t m_issuingCount = 0;  ///< number of ACTIVE entries still being registered
+	uint32_t m_sequence = 0;             ///< sequence number for the next entry
+	DmaToken m_lastToken = DMA_TOKEN_NONE; ///< token issued to the most recent request
+
+	void m_initialize(size_t queueDepth);
+	void m_createChipSelect();
+	void m_waitIdle() override;
+	DmaQueueEntry *m_nextQueueEntry();
+	DmaToken m_nextToken();
+	void m_queueTransfer(DmaToken token, SpiPriority priority, int command, size_t address, uint8_t *src, uint8_t *dest,
+			size_t numBytes, DmaCallback callback, void *context);
+	bool m_retireOne();
+	bool m_issueOne();
+	bool m_isBlocked(const DmaQueueEntry &entry) const;
+	size_t m_setSpiCmdAddr(int command, size_t address, uint8_t *dest);
 };
 
 
@@ -95,6 +95,24 @@ void alphaBlend(audio_block_t *out, audio_block_t *dry, audio_block_t* wet, floa
 /// @param coeffShift number of bits to shiftt the coefficient
 void gainAdjust(audio_block_t *out, audio_block_t *in, float vol, int coeffShift = 0);
 
+/// Perform an alpha blend between two buffers of 24-bit samples held in 32-bit words.
+/// @details uses the same gains as the audio block version, but keeps the extra bits.
+/// @param out pointer to the destination samples
+/// @param dry pointer to the dry samples
+/// @param wet pointer to the wet samples
+/// @param mix float between 0.0 and 1.0.
+/// @param numSamples number of samples in each buffer
+void alphaBlend(int32_t *out, int32_t *dry, int32_t *wet, float mix, size_t numSamples = AUDIO_BLOCK_SAMPLES);
+
+/// Applies a gain to 24-bit samples held in 32-bit words according to <br>
+/// out = in * (vol * 2^coeffShift)
+/// @param out pointer to the output samples
+/// @param in  pointer to the input samples
+/// @param vol volume cofficient between -1.0 and +1.0
+/// @param coeffShift number of bits to shift the coefficient
+/// @param numSamples number of samples in each buffer
+void gainAdjust(int32_t *out, int32_t *in, float vol, int coeffShift = 0, size_t numSamples = AUDIO_BLOCK_SAMPLES);
+
 
 template <class T>
 class RingBuffer; // forward declare so AudioDelay can use it.
@@ -137,8 +155,8 @@ public:
     /// Add a new audio block into the buffer. When the buffer is filled,
     /// adding a new block will push out the oldest once which is returned.
     /// @param blockIn pointer to the most recent block of audio
-    /// @returns the buffer to be discarded, or nullptr if not filled (INTERNAL), or
-    /// not applicable (EXTERNAL).
+    /// @returns the buffer to be discarded, or nullptr if not filled (INTERNAL). With
+    /// EXTERNAL memory blockIn is returned, it is no longer needed and can be released right away.
     audio_block_t *addBlock(audio_block_t *blockIn);
 
     /// When using INTERNAL memory, returns the pointer for the specified index into buffer.
@@ -156,6 +174,32 @@ public:
     /// @returns true on success, false on error.
     bool getSamples(audio_block_t *dest, size_t offsetSamples, size_t numSamples = AUDIO_BLOCK_SAMPLES);
 
+    /// Retrieve samples from EXTERNAL memory into a buffer that isn't an audio block.
+    /// @details With DMA the read is only queued, the data has arrived once the slot's
+    /// waitForRead() returns. This lets an effect read ahead into a buffer it owns.
+    /// @param dest pointer to the target buffer, at least numSamples long.
+    /// @param offsetSamples data will start being transferred offset samples from the start of the audio buffer
+    /// @param numSamples default value is AUDIO_BLOCK_SAMPLES, so typically you don't have to specify this parameter.
+    /// @returns true on success, false on error or when using INTERNAL memory.
+    bool getSamples(int16_t *dest, size_t offsetSamples, size_t numSamples = AUDIO_BLOCK_SAMPLES);
+
+    /// Add 24-bit samples held in 32-bit words into the buffer.
+    /// @details Only EXTERNAL memory using a PACKED24 slot keeps the extra bits, see
+    /// SAMPLE24_SHIFT for the scaling. src can be reused as soon as this returns.
+    /// @param src pointer to the samples to add
+    /// @param numSamples default value is AUDIO_BLOCK_SAMPLES
+    /// @returns true on success, false on error or when the memory isn't PACKED24.
+    bool addSamples(const int32_t *src, size_t numSamples = AUDIO_BLOCK_SAMPLES);
+
+    /// Retrieve 24-bit samples into 32-bit words from a PACKED24 EXTERNAL memory.
+    /// @details With DMA the read is only queued, the data has arrived once the slot's
+    /// waitForRead() returns.
+    /// @param dest pointer to the target buffer, at least numSamples long.
+    /// @param offsetSamples data will start being transferred offset samples from the start of the audio buffer
+    /// @param numSamples default value is AUDIO_BLOCK_SAMPLES, so typically you don't have to specify this parameter.
+    /// @returns true on success, false on error or when the memory isn't PACKED24.
+    bool getSamples(int32_t *dest, size_t offsetSamples, size_t numSamples = AUDIO_BLOCK_SAMPLES);
+
     /// When using EXTERNAL memory, this function can return a pointer to the underlying ExtMemSlot object associated
     /// with the buffer.
     /// @returns pointer to the underlying ExtMemSlot.
@@ -177,6 +221,7 @@ private:
     MemType m_type;                                      ///< when 0, INTERNAL memory, when 1, external MEMORY.
     RingBuffer<audio_block_t *> *m_ringBuffer = nullptr; ///< When using INTERNAL memory, a RingBuffer will be created.
     ExtMemSlot *m_slot = nullptr;                        ///< When using EXTERNAL memory, an ExtMemSlot must be provided.
+    ExtMemReader m_reader;                               ///< When using EXTERNAL memory, reads the delayed samples from the slot.
 };
 
 /**************************************************************************//**
@@ -250,6 +295,13 @@ public:
     /// @param input pointer to where the input data will be read from
     /// @param numSampmles number of samples to process
 	bool process(int16_t *output, int16_t *input, size_t numSamples);
+
+    /// Process 24-bit samples held in 32-bit words using the configured IIR filter
+    /// @details output and input can be the same pointer if in-place modification is desired
+    /// @param output pointer to where the output results will be written
+    /// @param input pointer to where the input data will be read from
+    /// @param numSamples number of samples to process
+	bool process(int32_t *output, int32_t *input, size_t numSamples);
 private:
 	const unsigned NUM_STAGES;
 	int32_t *m_coeffs = nullptr;
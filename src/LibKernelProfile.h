@@ -0,0 +1,70 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  LibKernelProfile names the DSP kernels of the library so their cost can be
+ *  accounted for by the host budget simulator, see src/host/BAHostBudget.h.
+ *  @details Each kernel reports how much work it did with PROFILE_KERNEL(). On
+ *  the Teensy the macro is empty and costs nothing.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __BAGUITAR_LIBKERNELPROFILE_H
+#define __BAGUITAR_LIBKERNELPROFILE_H
+
+#include <cstddef>
+
+namespace BAGuitar {
+
+/// The DSP kernels, the work done by each is counted in samples
+enum class DspKernel : unsigned {
+	CLEAR = 0,        ///< clearAudioBlock()
+	GAIN,             ///< gainAdjust() on 16-bit samples
+	ALPHA_BLEND,      ///< alphaBlend() on 16-bit samples
+	GAIN_24,          ///< gainAdjust() on 24-bit samples
+	ALPHA_BLEND_24,   ///< alphaBlend() on 24-bit samples
+	BIQUAD,           ///< IirBiQuadFilter, counted per sample per stage
+	BIQUAD_HQ,        ///< IirBiQuadFilterHQ, counted per sample per stage
+	BIQUAD_FLOAT,     ///< IirBiQuadFilterFloat, counted per sample per stage
+	COPY,             ///< PCM16 samples copied by encodeSamples() and decodeSamples()
+	PACKED12_ENCODE,  ///< encodePacked12()
+	PACKED12_DECODE,  ///< decodePacked12()
+	PACKED24_ENCODE,  ///< encodePacked24()
+	PACKED24_DECODE,  ///< decodePacked24()
+	CONVERT_16_TO_24, ///< convertSamples16To24()
+	CONVERT_24_TO_16, ///< convertSamples24To16()
+	MULAW_ENCODE,     ///< encodeMulaw()
+	MULAW_DECODE,     ///< decodeMulaw()
+	ADPCM_ENCODE,     ///< encodeAdpcmFrame()
+	ADPCM_DECODE,     ///< decodeAdpcmFrame()
+	INTERLEAVE,       ///< interleaveSamples(), counted per sample of every channel
+	DEINTERLEAVE,     ///< deinterleaveSamples(), counted per sample of every channel
+	NUM_KERNELS
+};
+
+#if defined(BAGUITAR_HOST)
+/// Charge the cost of a kernel to the host budget simulator
+/// @param kernel the kernel that ran
+/// @param numSamples the number of samples it processed
+void hostProfileKernel(DspKernel kernel, size_t numSamples);
+#define PROFILE_KERNEL(kernel, numSamples) BAGuitar::hostProfileKernel(BAGuitar::DspKernel::kernel, (numSamples))
+#else
+#define PROFILE_KERNEL(kernel, numSamples)
+#endif
+
+}
+
+#endif /* __BAGUITAR_LIBKERNELPROFILE_H */
@@ -33,9 +33,21 @@
 
 #include "BAHardware.h"
 #include "BASpiMemory.h"
+#include "LibSampleCodecs.h"
 
 namespace BAGuitar {
 
+/// The maximum number of separate unallocated regions tracked for each external memory
+constexpr size_t MAX_FREE_REGIONS = 16;
+
+/**************************************************************************//**
+ * MemRegion describes a contiguous range of external memory.
+ *****************************************************************************/
+struct MemRegion {
+	size_t start; ///< the first address in the region
+	size_t size;  ///< the size of the region in bytes
+};
+
 /**************************************************************************//**
  * MemConfig contains the configuration information associated with a particular
  * SPI interface.
@@ -43,25 +55,85 @@ namespace BAGuitar {
 struct MemConfig {
 	size_t size;                  ///< the total size of the external SPI memory
 	size_t totalAvailable;        ///< the number of bytes available (remaining)
-	size_t nextAvailable;         ///< the starting point for the next available slot
+	MemRegion freeRegions[MAX_FREE_REGIONS]; ///< unallocated regions, sorted by address
+	size_t numFreeRegions = 0;    ///< the number of valid entries in freeRegions
+	bool useDma = false;          ///< when true, m_spi is a BASpiMemoryDMA
 	BASpiMemory *m_spi = nullptr; ///< handle to the SPI interface
 };
 
 class ExternalSramManager; // forward declare so ExtMemSlot can declared friendship with it
+class ExtMemReader;        // forward declare so ExtMemSlot can declared friendship with it
+
+/**************************************************************************//**
+ * ExtMemGatherEntry describes one part of a scatter-gather read from an ExtMemSlot.
+ *****************************************************************************/
+struct ExtMemGatherEntry {
+	size_t offsetWords; ///< offset in 16-bit words from the start of the slot
+	int16_t *dest;      ///< pointer to the destination for this part
+	size_t numWords;    ///< number of 16-bit words to read
+};
 
 /**************************************************************************//**
  * ExtMemSlot provides a convenient interface to a particular slot of an
  * external memory.
  * @details the memory can be access randomly, as a single word, as a block of
- * data, or as circular queue.
+ * data, or as circular queue. When the slot uses DMA, block transfers return
+ * immediately. Use isReadDone()/isWriteDone() or a completion callback to find
+ * out when the data has actually been transferred.<br>
+ * The slot owns its memory until release() is called or the slot is destroyed,
+ * at which point the memory is returned to the ExternalSramManager.<br>
+ * A slot can store its samples with a compressed SampleCodec. Offsets and sizes
+ * are always in uncompressed 16-bit samples. Reads can start anywhere, but writes
+ * must cover whole codec frames (2 samples for PACKED12, ADPCM_FRAME_SAMPLES for
+ * IMA_ADPCM), so they return false when unaligned. PACKED24 slots can also be
+ * accessed with 24-bit samples held in 32-bit words, see writeAdvance32().<br>
+ * On a slot that spans both memories, only one request with a callback can be
+ * outstanding in each direction. Another one returns false until the first
+ * callback has been called.
  *****************************************************************************/
 class ExtMemSlot {
 public:
-
-	/// clear the entire contents of the slot by writing zeros
+	ExtMemSlot() = default;
+	ExtMemSlot(const ExtMemSlot&) = delete;
+	ExtMemSlot& operator=(const ExtMemSlot&) = delete;
+
+	/// The destructor returns the memory to the manager
+	~ExtMemSlot();
+
+	/// Return the memory used by this slot to the ExternalSramManager. The slot
+	/// is no longer valid afterwards, until memory is requested for it again.
+	/// @details waits for any transfers issued by this slot to complete first.
+	/// @returns true on success, false if the slot did not own any memory
+	bool release();
+
+	/// Checks whether memory has been allocated to the slot
+	/// @returns true if the slot is valid
+	bool isValid() const { return m_valid; }
+
+	/// clear the entire contents of the slot
+	/// @details Clearing is lazy. The slot tracks a high water mark, anything past it
+	/// reads as zero without any SPI traffic. Writes move the mark forward, and the
+	/// memory past the mark is zeroed a chunk at a time by serviceClear(). When using
+	/// DMA, serviceClear() is called automatically with each transfer.
 	/// @returns true on success
 	bool clear();
 
+	/// Zero the next part of the slot past the high water mark
+	/// @param maxBytes the maximum number of bytes to zero in this call
+	/// @returns true once the whole slot has been written or zeroed
+	bool serviceClear(size_t maxBytes = CLEAR_CHUNK_BYTES);
+
+	/// Get the high water mark
+	/// @returns the number of bytes of memory from the start of the slot that have been written
+	/// or zeroed. For slots using a codec, this is the encoded size.
+	size_t getHighWaterMark() const { return m_validEnd - m_storageStart; }
+
+	/// Write out any words buffered by writeAdvance16(int16_t)
+	/// @details The buffer is flushed automatically when it fills, when the write
+	/// position is changed, and before any block transfer or cursor read.
+	/// @returns true on success, false if the slot is not valid
+	bool flush();
+
 	/// set a new write position (in bytes) for circular operation
 	/// @param offsetBytes moves the write pointer to the specified offset from the slot start
 	/// @returns true on success, else false if offset is beyond slot boundaries.
@@ -100,25 +172,110 @@ public:
 	/// @returns true on success, else false on error
 	bool read16(size_t offsetWords, int16_t *dest, size_t numWords);
 
+	/// Read several non-contiguous blocks of 16-bit data as a single request
+	/// @details Each part may wrap around the end of the slot. When using DMA
+	/// all parts are queued at once and share one completion.
+	/// @param entries array of offset, destination and size for each part
+	/// @param numEntries number of entries in the array, at most MAX_GATHER_ENTRIES
+	/// @param callback optional function called once all the data has arrived
+	/// @param context user pointer passed to the callback
+	/// @returns true on success, else false on error
+	bool readGather16(const ExtMemGatherEntry *entries, size_t numEntries, DmaCallback callback = nullptr, void *context = nullptr);
+
 	/// Read the next in memory during circular operation
+	/// @details words are read ahead in blocks into an internal buffer, but never
+	/// past the write position, so words written with writeAdvance16() are always seen.
 	/// @returns the next 16-bit data word in memory
 	uint16_t readAdvance16();
 
 
 	/// Read the next block of numWords during circular operation
-	/// @details, dest is ignored when using DMA
+	/// @details when using DMA, dest is not filled in until the read completes.
 	/// @param dest pointer to the destination of the read.
 	/// @param numWords number of 16-bit words to transfer
+	/// @param callback optional function called once the data has arrived in dest
+	/// @param context user pointer passed to the callback
 	/// @returns true on success, else false on error
-	bool readAdvance16(int16_t *dest, size_t numWords);
+	bool readAdvance16(int16_t *dest, size_t numWords, DmaCallback callback = nullptr, void *context = nullptr);
 
 	/// Write a block of 16-bit data from the specified location in circular operation
+	/// @details when using DMA, src must remain valid until the write completes.
 	/// @param src pointer to the start of the block of data to write to memory
 	/// @param numWords number of 16-bit words to transfer
+	/// @param callback optional function called once the data has been written
+	/// @param context user pointer passed to the callback
+	/// @returns true on success, else false on error
+	bool writeAdvance16(int16_t *src, size_t numWords, DmaCallback callback = nullptr, void *context = nullptr);
+
+	/// Write a block of 16-bit data in circular operation, without holding on to src
+	/// @details With DMA, the data is first copied into one of the slot's staging buffers,
+	/// so src, e.g. the data of an audio block, can be released or reused as soon as this
+	/// returns. The staging buffers are used in turn, this only waits when the write from
+	/// the next one hasn't finished yet. Blocking and codec slots have finished with src
+	/// when writeAdvance16() returns, so they write directly.
+	/// @param src pointer to the source data
+	/// @param numWords number of 16-bit words to transfer
+	/// @returns true on success, else false on error
+	bool writeAdvance16Copy(const int16_t *src, size_t numWords);
+
+	/// Write a block of 24-bit samples held in 32-bit words in circular operation
+	/// @details Only PACKED24 slots keep the extra bits. Positions still count 16-bit
+	/// words, i.e. each sample advances them by 2 bytes. The samples are packed into the
+	/// slot's codec buffer first, so src can be reused as soon as this returns.
+	/// @param src pointer to the samples, scaled as described for SAMPLE24_SHIFT
+	/// @param numSamples number of samples to transfer
+	/// @param callback optional function called once the data has been written
+	/// @param context user pointer passed to the callback
+	/// @returns true on success, false on error or when the slot isn't PACKED24
+	bool writeAdvance32(const int32_t *src, size_t numSamples, DmaCallback callback = nullptr, void *context = nullptr);
+
+	/// Read the next block of 24-bit samples into 32-bit words in circular operation
+	/// @details when using DMA, dest is not filled in until the read completes.
+	/// @param dest pointer to the destination of the read.
+	/// @param numSamples number of samples to transfer
+	/// @param callback optional function called once the data has arrived in dest
+	/// @param context user pointer passed to the callback
+	/// @returns true on success, false on error or when the slot isn't PACKED24
+	bool readAdvance32(int32_t *dest, size_t numSamples, DmaCallback callback = nullptr, void *context = nullptr);
+
+	/// Store interleaved frames of several channels in the slot
+	/// @details Each frame holds one sample from each channel side by side, so all the
+	/// channels of a block are moved in a single transaction. The slot size must be a
+	/// whole number of frames, and only PCM16 slots can be interleaved. The read and
+	/// write positions are reset to the start of the slot. They stay on frame boundaries
+	/// as long as the frame functions are used, and are still given in bytes.
+	/// @param numChannels the number of channels in each frame, 1 returns to plain samples
+	/// @returns true on success, else false on error
+	bool setNumChannels(unsigned numChannels);
+
+	/// Get the number of channels in each frame
+	/// @returns the number of interleaved channels, 1 for a plain slot
+	unsigned getNumChannels() const { return m_numChannels; }
+
+	/// Write frames to the next location in circular operation
+	/// @details the channels are interleaved into one of the slot's frame buffers, so
+	/// they can be released or reused as soon as this returns.
+	/// @param channels array of getNumChannels() pointers to the samples for each channel.
+	/// A nullptr channel is stored as zeros.
+	/// @param numFrames number of frames, i.e. samples in each channel
 	/// @returns true on success, else false on error
-	bool writeAdvance16(int16_t *src, size_t numWords);
+	bool writeAdvanceFrames(const int16_t * const *channels, size_t numFrames);
+
+	/// Read frames from the next location in circular operation
+	/// @details when using DMA, the channels are not filled in until the read completes
+	/// and the frames have been split up, see waitForRead(). Reads of more than
+	/// FRAME_BUFFER_FRAMES are done in pieces, waiting for all but the last.
+	/// @param channels array of getNumChannels() pointers to the destination for each
+	/// channel. A nullptr channel is skipped, except on a plain slot.
+	/// @param numFrames number of frames, i.e. samples in each channel
+	/// @param callback optional function called once the channels have been filled in
+	/// @param context user pointer passed to the callback
+	/// @returns true on success, else false on error
+	bool readAdvanceFrames(int16_t * const *channels, size_t numFrames, DmaCallback callback = nullptr, void *context = nullptr);
 
 	/// Write a single 16-bit data to the next location in circular operation
+	/// @details words are collected in an internal buffer and written out as a block
+	/// once WORD_BUFFER_WORDS have been collected, or when flush() is called.
 	/// @param data the 16-bit word to transfer
 	/// @returns true on success, else false on error
 	bool writeAdvance16(int16_t data); // write just one data
@@ -142,67 +299,549 @@ public:
 
 	bool isUseDma() const { return m_useDma; }
 
+	/// Checks if any write is in progress on the underlying SPI memory, including
+	/// writes from other slots.
 	bool isWriteBusy() const;
 
+	/// Checks if any read is in progress on the underlying SPI memory, including
+	/// reads from other slots.
 	bool isReadBusy() const;
 
+	/// Checks if the most recent read issued by this slot has completed
+	/// @returns true if the read data is available
+	bool isReadDone() const;
+
+	/// Checks if the most recent write issued by this slot has completed
+	/// @returns true if the write data has been transferred
+	bool isWriteDone() const;
+
+	/// Wait until the most recent read issued by this slot has completed. Returns
+	/// immediately if it already has.
+	void waitForRead() const;
+
+	/// Wait until the most recent write issued by this slot has completed. Returns
+	/// immediately if it already has.
+	void waitForWrite() const;
+
+	/// The number of words buffered by the single word cursor functions
+	static constexpr size_t WORD_BUFFER_WORDS = 32;
+
+	/// The most entries a single readGather16() request can have
+	static constexpr size_t MAX_GATHER_ENTRIES = 8;
+
+	/// The number of staging buffers used by writeAdvance16Copy()
+	static constexpr size_t STAGING_BUFFERS = 2;
+
+	/// The size of each staging buffer in 16-bit words, one audio block
+	static constexpr size_t STAGING_BUFFER_WORDS = 128;
+
+	/// The most channels an interleaved slot can store
+	static constexpr unsigned MAX_CHANNELS = 8;
+
+	/// The number of frames each interleave buffer holds, one audio block
+	static constexpr size_t FRAME_BUFFER_FRAMES = 128;
+
+	/// The number of bytes serviceClear() zeros by default
+	static constexpr size_t CLEAR_CHUNK_BYTES = 512;
+
+	/// The number of bytes of encoded samples each codec slot can stage at once
+	static constexpr size_t CODEC_BUFFER_BYTES = 256;
+
+	/// Get the codec the slot stores its samples with
+	/// @returns the sample codec
+	SampleCodec getCodec() const { return m_codec; }
+
+	/// Checks whether the slot is striped across both external memories
+	/// @returns true if the slot is striped
+	bool isStriped() const { return m_layout == Layout::STRIPED; }
+
+	/// Checks whether the slot continues from MEM0 into MEM1
+	/// @returns true if the slot is concatenated
+	bool isConcatenated() const { return m_layout == Layout::CONCATENATED; }
+
+	/// Get the traffic this slot has caused on its memories
+	/// @details The counters cover the slot's transfers, including background clearing,
+	/// and the time spent waiting for them. Busy cycles from a full DMA queue count
+	/// against the slot that found it full. Reset by configuring the slot.
+	/// @returns a copy of the counters
+	SpiMemStats getStats() const;
+
+	/// Get the traffic counters for this slot and reset them
+	/// @returns a copy of the counters before they were reset
+	SpiMemStats snapshotStats();
+
 	/// DEBUG USE: prints out the slot member variables
 	void printStatus(void) const;
 
 private:
 	friend ExternalSramManager;     ///< gives the manager access to the private variables
+	friend ExtMemReader;            ///< readers share the slot's transfer functions
 	bool   m_valid = false;         ///< After a slot is successfully configured by the manager it becomes valid
 	size_t m_start = 0;             ///< the external memory address in bytes where this slot starts
 	size_t m_end = 0;               ///< the external memory address in bytes where this slot ends (inclusive)
 	size_t m_currentWrPosition = 0; ///< current write pointer for circular operation
 	size_t m_currentRdPosition = 0; ///< current read pointer for circular operation
 	size_t m_size = 0;              ///< size of this slot in bytes
+	size_t m_storageStart = 0;      ///< the first storage address, passed to m_transfer(). Same as m_start unless a codec is used.
+	size_t m_storageEnd = 0;        ///< the last storage address (inclusive)
+	size_t m_validEnd = 0;          ///< high water mark, the storage address after the last byte that was written or zeroed
 	bool   m_useDma = false;        ///< when TRUE, BASpiMemoryDMA will be used.
+	bool   m_backgroundPriority = false; ///< when TRUE, transfers are queued at SpiPriority::BACKGROUND, used by the copy engine
 	SpiDeviceId m_spiId;            ///< the SPI Device ID
 	BASpiMemory *m_spi = nullptr;   ///< pointer to an instance of the BASpiMemory interface class
+	BASpiMemory *m_spiSecondary = nullptr; ///< the second memory used by a multi-region slot
+	ExternalSramManager *m_manager = nullptr; ///< the manager the memory was allocated from
+	ExtMemSlot *m_nextOwned = nullptr; ///< the next slot in the manager's list of configured slots
+
+	/// Describes how the slot address space is mapped onto the external memories
+	enum class Layout : unsigned {
+		SINGLE,  ///< the slot is a single region in one memory
+		STRIPED, ///< the slot alternates between MEM0 and MEM1 every STRIPE_SIZE_BYTES
+		CONCATENATED, ///< the slot starts in MEM0 and continues in MEM1
+	};
+	/// Striped slots switch memories every half audio block, so a block transfer keeps both SPI ports busy
+	static constexpr size_t STRIPE_SIZE_BYTES = 128;
+	/// Parts are queued on each memory in batches of at most this many
+	static constexpr size_t MAX_TRANSFER_PARTS = 8;
+	/// The most entries one m_transfer() call takes, a gather request with every entry wrapped
+	static constexpr size_t MAX_TRANSFER_ENTRIES = 2*MAX_GATHER_ENTRIES;
+
+	Layout m_layout = Layout::SINGLE;              ///< how slot addresses map to the memories
+	unsigned m_numRegions = 1;                     ///< number of memory regions that make up the slot
+	MemRegion m_regions[NUM_MEM_SLOTS];            ///< the memory regions owned by the slot
+	MemSelect m_regionMem[NUM_MEM_SLOTS];          ///< the memory each region was allocated from
+	DmaToken m_readTokens[NUM_MEM_SLOTS]  = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< token for the most recent read on each memory
+	DmaToken m_writeTokens[NUM_MEM_SLOTS] = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< token for the most recent write on each memory
+	DmaToken m_clearTokens[NUM_MEM_SLOTS] = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< token for the most recent background clear on each memory
+
+	/// Tracks a request with a callback that was split across both memories
+	struct SplitCompletion {
+		DmaCallback callback = nullptr;
+		void *context = nullptr;
+		volatile unsigned remaining = 0;
+	};
+	SplitCompletion m_readCompletion;
+	SplitCompletion m_writeCompletion;
+
+	enum class TransferOp : unsigned { READ, WRITE, ZERO, CLEAR }; ///< CLEAR zeros at background priority
+
+	/// Internal buffer used by the single word cursor functions
+	struct WordBuffer {
+		int16_t data[WORD_BUFFER_WORDS];
+		size_t position = 0; ///< slot address of data[0]
+		size_t count = 0;    ///< number of valid words
+		DmaToken tokens[NUM_MEM_SLOTS] = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< the last transfer using the buffer on each memory
+	};
+	WordBuffer m_wordWrite[2];       ///< write-combining buffers, one fills while the other is sent
+	unsigned m_wordWriteActive = 0;  ///< the write buffer currently collecting words
+	WordBuffer m_wordRead[2];        ///< read-ahead buffers, one is consumed while the other is fetched
+	unsigned m_wordReadActive = 0;   ///< the read buffer currently being consumed
+	size_t m_wordReadIndex = 0;      ///< the next word to return from the active read buffer
+	bool m_wordPrefetchPending = false; ///< the inactive read buffer holds the words that follow
+
+	/// Driver-owned copy of data written by writeAdvance16Copy()
+	struct StagingBuffer {
+		int16_t data[STAGING_BUFFER_WORDS];
+		DmaToken tokens[NUM_MEM_SLOTS] = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< the last transfer using the buffer on each memory
+	};
+	StagingBuffer *m_staging = nullptr; ///< STAGING_BUFFERS staging buffers, only allocated for DMA slots
+	unsigned m_stagingNext = 0;         ///< the staging buffer to use next
+
+	/// Interleaved frames, see setNumChannels()
+	static constexpr unsigned NUM_FRAME_BUFFERS = 3;
+	unsigned m_numChannels = 1;           ///< the number of channels in each frame
+	int16_t *m_frameBuffers = nullptr;    ///< two write buffers then a read buffer, FRAME_BUFFER_FRAMES frames each
+	unsigned m_frameWriteNext = 0;        ///< the write buffer to use next
+	DmaToken m_frameWriteTokens[2][NUM_MEM_SLOTS] = {{DMA_TOKEN_NONE, DMA_TOKEN_NONE}, {DMA_TOKEN_NONE, DMA_TOKEN_NONE}};
+	int16_t *m_frameReadDest[MAX_CHANNELS];
+	size_t m_frameReadFrames = 0;
+	DmaCallback m_frameReadCallback = nullptr;
+	void *m_frameReadContext = nullptr;
+	volatile bool m_frameReadPending = false; ///< the read buffer holds frames waiting to be split up
+	static void m_frameReadComplete(void *context, DmaToken token);
+
+	/// Decoding that has to happen once a codec read arrives
+	struct CodecReadPart {
+		void *dest;           ///< where the decoded samples go
+		bool wide;            ///< dest holds 32-bit samples
+		size_t bufferOffset;  ///< offset of the first encoded frame in the codec buffer
+		size_t skipSamples;   ///< samples to skip at the start of the first frame
+		size_t numSamples;    ///< number of samples to decode
+		size_t numFrames;     ///< number of frames that were read
+	};
+	/// A codec read can have at most this many separate parts
+	static constexpr size_t MAX_CODEC_READ_PARTS = 4;
+
+	SampleCodec m_codec = SampleCodec::PCM16; ///< how samples are stored in the memory
+	AdpcmState m_adpcmState;                   ///< encoder state carried between ADPCM frames
+	uint8_t *m_codecBuffer = nullptr;          ///< read then write buffers for encoded samples, CODEC_BUFFER_BYTES each
+	CodecReadPart m_codecReadParts[MAX_CODEC_READ_PARTS];
+	size_t m_codecNumReadParts = 0;
+	DmaCallback m_codecReadCallback = nullptr;
+	void *m_codecReadContext = nullptr;
+	volatile bool m_codecReadPending = false;  ///< the read buffer holds data waiting to be decoded
+	DmaToken m_codecWriteTokens[NUM_MEM_SLOTS] = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< the last transfer using the write buffer
+	bool m_wideSamples = false;                ///< the transfer being issued uses 32-bit sample buffers
+
+	mutable SpiMemStats m_stats;               ///< traffic counters for this slot, updated by const waits too
+	uint32_t m_statsStartCycles = 0;           ///< cycle count when the counters were reset
+
+	BASpiMemory *m_device(unsigned index) const { return (index == 0) ? m_spi : m_spiSecondary; }
+	void m_mapAddress(size_t address, size_t numBytes, unsigned &device, size_t &physAddress, size_t &contiguousBytes) const;
+	void m_transfer(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context);
+	void m_transferParts(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context);
+	bool m_isSplitBusy(TransferOp op, DmaCallback callback) const;
+	void m_extendHighWater(size_t address, size_t numBytes);
+	void m_issueParts(TransferOp op, unsigned dev, const SpiGatherEntry *parts, size_t numParts, DmaCallback callback, void *context);
+	static void m_splitCompletion(void *context, DmaToken token);
+
+	size_t m_advancePosition(size_t position, size_t numWords) const;
+	size_t m_circularTransfer(TransferOp op, size_t position, int16_t *buffer, size_t numWords, DmaCallback callback, void *context);
+	size_t m_circularTransfer32(TransferOp op, size_t position, int32_t *buffer, size_t numSamples, DmaCallback callback, void *context);
+	size_t m_bufferBytes(size_t numBytes) const { return m_wideSamples ? 2*numBytes : numBytes; }
+	void m_recordTokens(DmaToken *dest, const DmaToken *tokens);
+	void m_waitForTokens(const DmaToken *tokens) const;
+	bool m_isDone(const DmaToken *tokens) const;
+	void m_chargeStats(unsigned dev, const SpiMemStats &before) const;
+	void m_flushWordWrites();
+	size_t m_readAheadLimit(size_t position) const;
+	void m_refillWordReads();
+	void m_invalidateReadAhead();
+	void m_dropWordBuffers();
+
+	bool m_isCodecAligned(size_t address, size_t numWords) const;
+	void m_transferSamples(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context);
+	void m_codecRead(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context);
+	void m_codecIssueRead(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context);
+	void m_codecWrite(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context);
+	static void m_codecReadComplete(void *context, DmaToken token);
+
+	void m_spiRead16(size_t address, int16_t *dest, size_t numWords, DmaCallback callback = nullptr, void *context = nullptr);
+	void m_spiReadGather(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback = nullptr, void *context = nullptr);
+	void m_spiWrite16(size_t address, int16_t *src, size_t numWords, DmaCallback callback = nullptr, void *context = nullptr);
+	void m_spiZero16(size_t address, size_t numWords, DmaCallback callback = nullptr, void *context = nullptr);
+};
+
+
+/**************************************************************************//**
+ * ExtMemReader is an independent read cursor on an ExtMemSlot.
+ * @details Each reader tracks its own position and wraps around the end of the
+ * slot, so several taps can stream from one slot without moving the slot's own
+ * read cursor. The slot's circular writes are shared by all of its readers.
+ * Readers are lightweight and hold no memory, but must not outlive their slot.<br>
+ * When the slot uses DMA, reads return immediately. Each reader remembers its
+ * own most recent read, so waitForRead() only waits for that reader's data.
+ *****************************************************************************/
+class ExtMemReader {
+public:
+	/// Construct a reader for the slot
+	/// @param slot the slot to read from, or nullptr to attach later
+	ExtMemReader(ExtMemSlot *slot = nullptr) : m_slot(slot) {}
+
+	/// Point the reader at a different slot, the position starts at 0
+	/// @details waits for any read still in flight from the previous slot
+	/// @param slot the slot to read from
+	void attach(ExtMemSlot *slot);
+
+	/// Get the slot the reader is attached to
+	/// @returns pointer to the slot
+	ExtMemSlot *getSlot() const { return m_slot; }
+
+	/// Checks whether the reader is attached to a valid slot
+	/// @returns true if reads can be issued
+	bool isValid() const { return m_slot && m_slot->isValid(); }
+
+	/// set a new read position (in bytes) from the start of the slot
+	/// @param offsetBytes moves the read pointer to the specified offset from the slot start
+	/// @returns true on success, else false if offset is beyond slot boundaries.
+	bool setPosition(size_t offsetBytes);
+
+	/// returns the current read position
+	/// @returns the offset in bytes from the start of the slot
+	size_t getPosition() const { return m_position; }
+
+	/// Set the read position a number of samples behind the slot's write position
+	/// @details the next read returns the samples written delaySamples ago, this is
+	/// how a delay tap is positioned.
+	/// @param delaySamples number of 16-bit samples behind the write position, must
+	/// not be more than the slot size.
+	/// @returns true on success, false if the delay is larger than the slot
+	bool setDelay(size_t delaySamples);
+
+	/// Read the next block of numWords and advance the reader
+	/// @details when using DMA, dest is not filled in until the read completes.
+	/// Callback reads count against the slot's limit of one outstanding request
+	/// with a callback in each direction when the slot spans both memories.
+	/// @param dest pointer to the destination of the read.
+	/// @param numWords number of 16-bit words to transfer
+	/// @param callback optional function called once the data has arrived in dest
+	/// @param context user pointer passed to the callback
+	/// @returns true on success, else false on error
+	bool readAdvance16(int16_t *dest, size_t numWords, DmaCallback callback = nullptr, void *context = nullptr);
+
+	/// Read the next block of 24-bit samples into 32-bit words and advance the reader
+	/// @details Only for PACKED24 slots, see ExtMemSlot::readAdvance32().
+	/// @param dest pointer to the destination of the read.
+	/// @param numSamples number of samples to transfer
+	/// @param callback optional function called once the data has arrived in dest
+	/// @param context user pointer passed to the callback
+	/// @returns true on success, false on error or when the slot isn't PACKED24
+	bool readAdvance32(int32_t *dest, size_t numSamples, DmaCallback callback = nullptr, void *context = nullptr);
+
+	/// Checks if the most recent read issued by this reader has completed
+	/// @returns true if the read data is available
+	bool isReadDone() const;
+
+	/// Wait until the most recent read issued by this reader has completed. Returns
+	/// immediately if it already has.
+	void waitForRead() const;
+
+private:
+	ExtMemSlot *m_slot = nullptr; ///< the slot being read
+	size_t m_position = 0;        ///< read position in bytes from the start of the slot
+	DmaToken m_readTokens[NUM_MEM_SLOTS] = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< token for this reader's most recent read on each memory
 };
 
 
 /**************************************************************************//**
  * ExternalSramManager provides a class to handle dividing an external SPI RAM
  * into independent slots for general use.
- * @details the class does not support deallocated memory because this would cause
- * fragmentation.
+ * @details Slots can be released and the memory reused, so patches can be
+ * reconfigured at runtime. Free memory is kept in an address-ordered list, which
+ * is merged with its neighbours on release to limit fragmentation. Requesting
+ * block alignment makes the slot size a multiple of AUDIO_BLOCK_SIZE so circular
+ * block transfers never have to be split at the end of the slot.<br>
+ * The memory configuration and SPI interfaces are shared by all managers. The
+ * interfaces are deleted when the last manager is destroyed.<br>
+ * Destroying a manager releases the slots it configured. They become invalid
+ * and can be configured again by another manager.
  *****************************************************************************/
 class ExternalSramManager final {
 public:
 	ExternalSramManager();
+	ExternalSramManager(const ExternalSramManager&) = delete;
+	ExternalSramManager& operator=(const ExternalSramManager&) = delete;
 
 	/// The manager is constructed by specifying how many external memories to handle allocations for
 	/// @param numMemories the number of external memories
 	ExternalSramManager(unsigned numMemories);
 	virtual ~ExternalSramManager();
 
+	/// Start the SPI interface for a memory and detect its size
+	/// @details Until a memory is started, its size is assumed to be MEM_MAX_ADDR+1.
+	/// Requesting memory starts it automatically, call this first to query the real
+	/// size of a larger part with availableMemory() or largestAvailable().
+	/// @param mem specifies which memory to start
+	/// @param useDma when true, DMA is used for SPI port, else transfers block until complete
+	/// @returns the size of the memory in bytes, 0 if no memory was detected
+	size_t detectMemory(BAGuitar::MemSelect mem, bool useDma = false);
+
 	/// Query the amount of available (unallocated) memory
-	/// @details note that currently, memory cannot be allocated.
+	/// @details the memory may be split into several regions, see largestAvailable().
 	/// @param mem specifies which memory to query, default is memory 0
 	/// @returns the available memory in bytes
 	size_t availableMemory(BAGuitar::MemSelect mem = BAGuitar::MemSelect::MEM0);
 
+	/// Query the largest slot that can currently be allocated
+	/// @param mem specifies which memory to query, default is memory 0
+	/// @returns the size of the largest unallocated region in bytes
+	size_t largestAvailable(BAGuitar::MemSelect mem = BAGuitar::MemSelect::MEM0);
+
 	/// Request memory be allocated for the provided slot
+	/// @details if the slot already owns memory, it is released first.
 	/// @param slot a pointer to the global slot object to which memory will be allocated
 	/// @param delayMilliseconds request the amount of memory based on required time for audio samples, rather than number of bytes.
 	/// @param mem specify which external memory to allocate from
 	/// @param useDma when true, DMA is used for SPI port, else transfers block until complete
+	/// @param blockAlign when true, the slot size is rounded up to a multiple of AUDIO_BLOCK_SIZE
+	/// @param codec how the samples are stored, compressed codecs give a longer delay for the same memory,
+	/// PACKED24 a shorter one
 	/// @returns true on success, otherwise false on error
-	bool requestMemory(ExtMemSlot *slot, float delayMilliseconds, BAGuitar::MemSelect mem = BAGuitar::MemSelect::MEM0, bool useDma = false);
+	bool requestMemory(ExtMemSlot *slot, float delayMilliseconds, BAGuitar::MemSelect mem = BAGuitar::MemSelect::MEM0, bool useDma = false,
+			bool blockAlign = false, SampleCodec codec = SampleCodec::PCM16);
 
 	/// Request memory be allocated for the provided slot
+	/// @details if the slot already owns memory, it is released first.
 	/// @param slot a pointer to the global slot object to which memory will be allocated
 	/// @param sizeBytes request the amount of memory in bytes to request
 	/// @param mem specify which external memory to allocate from
     /// @param useDma when true, DMA is used for SPI port, else transfers block until complete
+	/// @param blockAlign when true, the slot size is rounded up to a multiple of AUDIO_BLOCK_SIZE
+	/// @param codec how the samples are stored. sizeBytes is the size of the uncompressed
+	/// 16-bit samples, the memory used is smaller when a compressed codec is selected and 1.5
+	/// times larger for PACKED24.
+	/// @returns true on success, otherwise false on error
+	bool requestMemory(ExtMemSlot *slot, size_t sizeBytes, BAGuitar::MemSelect mem = BAGuitar::MemSelect::MEM0, bool useDma = false,
+			bool blockAlign = false, SampleCodec codec = SampleCodec::PCM16);
+
+	/// Request memory striped across both external memories
+	/// @details Half of the slot comes from MEM0 and half from MEM1, alternating every
+	/// half audio block. Block transfers are split across both SPI ports so they run
+	/// in parallel. The size is rounded up to a multiple of AUDIO_BLOCK_SIZE. Both
+	/// memories must use the same transfer mode, DMA or blocking.
+	/// @param slot a pointer to the global slot object to which memory will be allocated
+	/// @param sizeBytes request the amount of memory in bytes to request
+	/// @param useDma when true, DMA is used for both SPI ports, else transfers block until complete
+	/// @param codec how the samples are stored
+	/// @returns true on success, otherwise false on error
+	bool requestStripedMemory(ExtMemSlot *slot, size_t sizeBytes, bool useDma = false, SampleCodec codec = SampleCodec::PCM16);
+
+	/// Request memory striped across both external memories
+	/// @param slot a pointer to the global slot object to which memory will be allocated
+	/// @param delayMilliseconds request the amount of memory based on required time for audio samples, rather than number of bytes.
+	/// @param useDma when true, DMA is used for both SPI ports, else transfers block until complete
+	/// @param codec how the samples are stored
+	/// @returns true on success, otherwise false on error
+	bool requestStripedMemory(ExtMemSlot *slot, float delayMilliseconds, bool useDma = false, SampleCodec codec = SampleCodec::PCM16);
+
+	/// Request memory that may span both external memories
+	/// @details The slot takes as much as it can from the largest free region in MEM0 and
+	/// continues in MEM1 for the rest, so a single slot can use all the external memory.
+	/// Crossing from one memory to the other is handled inside the slot. When the whole
+	/// request fits in MEM0 a regular slot is created instead. Both memories must use
+	/// the same transfer mode, DMA or blocking.
+	/// @param slot a pointer to the global slot object to which memory will be allocated
+	/// @param sizeBytes request the amount of memory in bytes to request
+	/// @param useDma when true, DMA is used for both SPI ports, else transfers block until complete
+	/// @param codec how the samples are stored
+	/// @returns true on success, otherwise false on error
+	bool requestConcatenatedMemory(ExtMemSlot *slot, size_t sizeBytes, bool useDma = false, SampleCodec codec = SampleCodec::PCM16);
+
+	/// Request memory that may span both external memories
+	/// @param slot a pointer to the global slot object to which memory will be allocated
+	/// @param delayMilliseconds request the amount of memory based on required time for audio samples, rather than number of bytes.
+	/// @param useDma when true, DMA is used for both SPI ports, else transfers block until complete
+	/// @param codec how the samples are stored
 	/// @returns true on success, otherwise false on error
-	bool requestMemory(ExtMemSlot *slot, size_t sizeBytes, BAGuitar::MemSelect mem = BAGuitar::MemSelect::MEM0, bool useDma = false);
+	bool requestConcatenatedMemory(ExtMemSlot *slot, float delayMilliseconds, bool useDma = false, SampleCodec codec = SampleCodec::PCM16);
+
+	/// Return the memory owned by a slot so it can be reused
+	/// @details copies and fills queued for the slot are cancelled, without calling their callbacks.
+	/// @param slot a pointer to the slot to release
+	/// @returns true on success, false if the slot did not own memory from this manager
+	bool releaseMemory(ExtMemSlot *slot);
+
+	// ** COPY ENGINE **
+
+	/// The size of each of the copy engine's two bounce buffers
+	static constexpr size_t COPY_BUFFER_BYTES = 512;
+
+	/// Default number of bytes the copy engine moves on each call to serviceCopies()
+	static constexpr size_t DEFAULT_COPY_BYTES_PER_SERVICE = 1024;
+
+	/// The number of copies and fills that can be queued at once
+	static constexpr size_t MAX_COPY_JOBS = 4;
+
+	/// Queue a copy of samples from one slot to another, or within a slot
+	/// @details The data is streamed through a small bounce buffer by serviceCopies(), a
+	/// piece at a time, at SpiPriority::BACKGROUND so audio transfers go first. The slots
+	/// may be on different memories. Overlapping ranges in the same slot are copied in the
+	/// right direction, so this also moves data. Requests are carried out in order.<br>
+	/// Both slots must come from this manager and store PCM16 samples, since codec slots
+	/// share their encode and decode buffers with the audio path. Ranges do not wrap.
+	/// @param dest the slot to copy to
+	/// @param destOffsetWords offset in 16-bit words from the start of dest
+	/// @param src the slot to copy from
+	/// @param srcOffsetWords offset in 16-bit words from the start of src
+	/// @param numWords number of 16-bit words to copy
+	/// @param callback optional function called from serviceCopies() once all the data has been written
+	/// @param context user pointer passed to the callback
+	/// @returns true if the copy was queued, false on error or when the queue is full
+	bool requestCopy(ExtMemSlot *dest, size_t destOffsetWords, ExtMemSlot *src, size_t srcOffsetWords, size_t numWords,
+			DmaCallback callback = nullptr, void *context = nullptr);
+
+	/// Queue a fill of part of a slot with a constant value
+	/// @details carried out by serviceCopies() like requestCopy(), but without reading
+	/// @param dest the slot to fill
+	/// @param destOffsetWords offset in 16-bit words from the start of dest
+	/// @param numWords number of 16-bit words to fill
+	/// @param value the value to store in each word
+	/// @param callback optional function called from serviceCopies() once all the data has been written
+	/// @param context user pointer passed to the callback
+	/// @returns true if the fill was queued, false on error or when the queue is full
+	bool requestFill(ExtMemSlot *dest, size_t destOffsetWords, size_t numWords, int16_t value = 0,
+			DmaCallback callback = nullptr, void *context = nullptr);
+
+	/// Move queued copies and fills forward, without waiting on the memories
+	/// @details Call this once per audio block from the same context as the audio transfers,
+	/// e.g. an effect's update(). Pieces whose reads have landed are written, finished writes
+	/// free their buffers, and new reads are started up to the bandwidth budget.
+	void serviceCopies();
+
+	/// Set how much data the copy engine moves on each call to serviceCopies()
+	/// @param bytesPerService the number of bytes read and written per call, rounded down to whole words
+	void setCopyBandwidth(size_t bytesPerService);
+
+	/// Get how much data the copy engine moves on each call to serviceCopies()
+	/// @returns the number of bytes per call
+	size_t getCopyBandwidth() const { return m_copyBytesPerService; }
+
+	/// Checks whether any copies or fills are still queued or in progress
+	/// @returns true if the copy engine is busy
+	bool isCopyBusy() const { return m_numCopyJobs > 0; }
 
 private:
+	friend ExtMemSlot; ///< a slot being destroyed detaches itself
 	static bool m_configured; ///< there should only be one instance of ExternalSramManager in the whole project
 	static MemConfig m_memConfig[BAGuitar::NUM_MEM_SLOTS]; ///< store the configuration information for each external memory
+	static unsigned m_numManagers; ///< the number of managers sharing m_memConfig
+	ExtMemSlot *m_ownedSlots = nullptr; ///< the slots configured by this manager, linked through m_nextOwned
+
+	BASpiMemory *m_getSpi(BAGuitar::MemSelect mem, bool useDma);
+	void m_setSize(BAGuitar::MemSelect mem, size_t sizeBytes);
+	bool m_configureDualSlot(ExtMemSlot *slot, ExtMemSlot::Layout layout, SampleCodec codec, size_t start0, size_t size0,
+			size_t start1, size_t size1, bool useDma);
+	size_t m_storageBytes(SampleCodec codec, size_t sizeBytes);
+	bool m_configureStaging(ExtMemSlot *slot);
+	bool m_configureStorage(ExtMemSlot *slot, SampleCodec codec, size_t storageStart, size_t storageBytes);
+	bool m_allocate(BAGuitar::MemSelect mem, size_t sizeBytes, size_t alignment, size_t &start);
+	bool m_free(BAGuitar::MemSelect mem, size_t start, size_t sizeBytes);
+	static size_t m_findFreeIndex(const MemConfig &config, size_t start, size_t sizeBytes, bool &mergePrev, bool &mergeNext);
+	bool m_insertFreeRegion(MemConfig &config, size_t index, MemRegion region);
+	void m_removeFreeRegion(MemConfig &config, size_t index);
+	void m_detachSlot(ExtMemSlot *slot);
+
+	/// A queued copy or fill, src is nullptr for a fill
+	struct CopyJob {
+		ExtMemSlot *src = nullptr;
+		ExtMemSlot *dest = nullptr;
+		size_t srcOffsetWords = 0;
+		size_t destOffsetWords = 0;
+		size_t numWords = 0;
+		size_t doneWords = 0;   ///< words handed to a bounce buffer so far
+		int16_t value = 0;      ///< the fill value
+		bool backward = false;  ///< copy from the end, for overlapping ranges with dest after src
+		DmaCallback callback = nullptr;
+		void *context = nullptr;
+	};
+	enum class CopyState : unsigned { IDLE, READING, WRITING };
+	/// One of the bounce buffers and the transfer it is waiting on
+	struct CopyBuffer {
+		int16_t *data = nullptr;
+		CopyState state = CopyState::IDLE;
+		bool discard = false;         ///< the copy was cancelled, don't write the data once it arrives
+		ExtMemSlot *slot = nullptr;   ///< the slot the pending transfer was issued on
+		ExtMemSlot *dest = nullptr;
+		size_t destOffsetWords = 0;
+		size_t numWords = 0;
+		bool isFill = false;
+		int16_t value = 0;
+		DmaToken tokens[NUM_MEM_SLOTS] = {DMA_TOKEN_NONE, DMA_TOKEN_NONE}; ///< the pending transfer on each memory
+	};
+	static constexpr unsigned NUM_COPY_BUFFERS = 2;
+
+	CopyJob m_copyJobs[MAX_COPY_JOBS];      ///< queue of copies and fills, the first one is in progress
+	size_t m_copyJobHead = 0;
+	volatile size_t m_numCopyJobs = 0;
+	CopyBuffer m_copyBuffers[NUM_COPY_BUFFERS];
+	int16_t *m_copyMemory = nullptr;        ///< the bounce buffers, allocated by the first request
+	size_t m_copyBytesPerService = DEFAULT_COPY_BYTES_PER_SERVICE;
+
+	bool m_queueCopy(const CopyJob &job);
+	void m_copyStart(CopyJob &job, CopyBuffer &buffer, size_t numWords);
+	void m_copyWrite(CopyBuffer &buffer);
+	void m_cancelCopies(ExtMemSlot *slot);
+	void m_retireCopyBuffers(ExtMemSlot *slot);
 
 };
 
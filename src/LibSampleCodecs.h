@@ -0,0 +1,182 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  LibSampleCodecs contains encoders and decoders for storing audio samples in
+ *  external memory with fewer than 16 bits per sample, or with 24 bits when
+ *  extra precision is worth the memory.
+ *  @details Each codec works on frames, a fixed number of samples that are
+ *  encoded together into a fixed number of bytes. Frames can be decoded
+ *  independently of each other, so any frame in memory can be read randomly.
+ *  All codecs decode a frame of zero bytes as silence, so memory that has been
+ *  cleared with zeros does not need to be encoded first.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+
+#ifndef __BAGUITAR_LIBSAMPLECODECS_H
+#define __BAGUITAR_LIBSAMPLECODECS_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace BAGuitar {
+
+/// Selects how samples are stored in external memory
+enum class SampleCodec : unsigned {
+	PCM16 = 0, ///< uncompressed 16-bit samples, 2 bytes per sample
+	PACKED12,  ///< upper 12 bits of each sample, two samples packed into 3 bytes
+	MULAW,     ///< 8-bit mu-law, 1 byte per sample
+	IMA_ADPCM, ///< 4-bit IMA ADPCM, frames of ADPCM_FRAME_SAMPLES with a small header
+	PACKED24,  ///< 24-bit samples, 3 bytes per sample. Can also be accessed as 32-bit samples.
+};
+
+/// 32-bit samples hold 24-bit audio, the 16-bit sample scaled up by this many bits. The
+/// extra bits are fraction below the 16-bit LSB, and the top 8 bits are headroom.
+constexpr int SAMPLE24_SHIFT = 8;
+constexpr int32_t SAMPLE24_MAX = 8388607;  ///< the largest 24-bit sample
+constexpr int32_t SAMPLE24_MIN = -8388608; ///< the smallest 24-bit sample
+
+constexpr size_t ADPCM_FRAME_SAMPLES = 128; ///< samples in each ADPCM frame, one audio block
+constexpr size_t ADPCM_HEADER_BYTES  = 4;   ///< predictor (2 bytes), step index (1 byte), reserved (1 byte)
+constexpr size_t ADPCM_FRAME_BYTES   = ADPCM_HEADER_BYTES + ADPCM_FRAME_SAMPLES/2; ///< total bytes for each ADPCM frame
+constexpr size_t MAX_CODEC_FRAME_SAMPLES = ADPCM_FRAME_SAMPLES; ///< the most samples in a frame of any codec
+
+/**************************************************************************//**
+ * AdpcmState holds the encoder state carried from one ADPCM frame to the next.
+ * @details Each frame header stores the state it was encoded with, so the decoder
+ * does not need it. Carrying it between frames avoids the step size having to
+ * adapt again at the start of every frame.
+ *****************************************************************************/
+struct AdpcmState {
+	int32_t predictor = 0; ///< the last predicted sample
+	int32_t index = 0;     ///< index into the step size table
+};
+
+/// Get the number of samples encoded together
+/// @param codec the codec to query
+/// @returns the number of samples in each frame
+size_t codecFrameSamples(SampleCodec codec);
+
+/// Get the number of bytes each frame is stored in
+/// @param codec the codec to query
+/// @returns the number of bytes for each frame
+size_t codecFrameBytes(SampleCodec codec);
+
+/// Get the number of bytes of memory needed to store samples
+/// @param codec the codec the samples are stored with
+/// @param numSamples the number of samples, rounded up to a whole number of frames
+/// @returns the storage size in bytes
+size_t codecStorageBytes(SampleCodec codec, size_t numSamples);
+
+/// Encode whole frames of samples
+/// @param codec the codec to encode with
+/// @param src pointer to the samples to encode
+/// @param dest pointer to the destination, must hold numFrames*codecFrameBytes(codec)
+/// @param numFrames the number of frames to encode
+/// @param state the ADPCM encoder state, updated on return. Unused by other codecs.
+void encodeSamples(SampleCodec codec, const int16_t *src, uint8_t *dest, size_t numFrames, AdpcmState &state);
+
+/// Decode whole frames of samples
+/// @param codec the codec the frames were encoded with
+/// @param src pointer to the encoded frames
+/// @param dest pointer to the destination, must hold numFrames*codecFrameSamples(codec)
+/// @param numFrames the number of frames to decode
+void decodeSamples(SampleCodec codec, const uint8_t *src, int16_t *dest, size_t numFrames);
+
+/// Pack samples into 12 bits, rounding to the nearest value
+/// @param src pointer to the samples to encode
+/// @param dest pointer to the destination, 3 bytes for each pair of samples
+/// @param numPairs the number of sample pairs to encode
+void encodePacked12(const int16_t *src, uint8_t *dest, size_t numPairs);
+
+/// Unpack 12-bit samples back to 16 bits
+/// @param src pointer to the packed samples
+/// @param dest pointer to the destination for the samples
+/// @param numPairs the number of sample pairs to decode
+void decodePacked12(const uint8_t *src, int16_t *dest, size_t numPairs);
+
+/// Pack 24-bit samples into 3 bytes each, saturating samples that are out of range
+/// @details Groups of four samples are built into three 32-bit words, stored in the
+/// little-endian byte order of the Cortex-M4.
+/// @param src pointer to the 24-bit samples to encode
+/// @param dest pointer to the destination, 3 bytes for each sample
+/// @param numSamples the number of samples to encode
+void encodePacked24(const int32_t *src, uint8_t *dest, size_t numSamples);
+
+/// Unpack 3-byte samples back to sign extended 24-bit samples
+/// @param src pointer to the packed samples
+/// @param dest pointer to the destination for the samples
+/// @param numSamples the number of samples to decode
+void decodePacked24(const uint8_t *src, int32_t *dest, size_t numSamples);
+
+/// Scale 16-bit samples up to 24-bit samples
+/// @param src pointer to the 16-bit samples
+/// @param dest pointer to the destination for the 24-bit samples
+/// @param numSamples the number of samples to convert
+void convertSamples16To24(const int16_t *src, int32_t *dest, size_t numSamples);
+
+/// Round 24-bit samples to the nearest 16-bit sample, saturating samples that are out of range
+/// @param src pointer to the 24-bit samples
+/// @param dest pointer to the destination for the 16-bit samples
+/// @param numSamples the number of samples to convert
+void convertSamples24To16(const int32_t *src, int16_t *dest, size_t numSamples);
+
+/// Encode samples to 8-bit mu-law.
+/// @details The stored byte is the complement of the G.711 code word, so a zero byte
+/// decodes as silence.
+/// @param src pointer to the samples to encode
+/// @param dest pointer to the destination, 1 byte for each sample
+/// @param numSamples the number of samples to encode
+void encodeMulaw(const int16_t *src, uint8_t *dest, size_t numSamples);
+
+/// Decode 8-bit mu-law samples to 16 bits
+/// @param src pointer to the encoded samples
+/// @param dest pointer to the destination for the samples
+/// @param numSamples the number of samples to decode
+void decodeMulaw(const uint8_t *src, int16_t *dest, size_t numSamples);
+
+/// Encode one frame of ADPCM_FRAME_SAMPLES samples to IMA ADPCM
+/// @param src pointer to the samples to encode
+/// @param dest pointer to the destination, ADPCM_FRAME_BYTES long
+/// @param state the encoder state, updated on return
+void encodeAdpcmFrame(const int16_t *src, uint8_t *dest, AdpcmState &state);
+
+/// Decode one frame of IMA ADPCM
+/// @param src pointer to the encoded frame
+/// @param dest pointer to the destination, ADPCM_FRAME_SAMPLES long
+void decodeAdpcmFrame(const uint8_t *src, int16_t *dest);
+
+/// Interleave separate channels into frames, one sample from each channel per frame
+/// @details Stereo with 32-bit aligned buffers uses the Cortex-M4 SIMD instructions to
+/// handle two frames at a time.
+/// @param channels array of numChannels pointers to the channel samples. A nullptr
+/// channel is stored as zeros.
+/// @param numChannels the number of channels in each frame
+/// @param dest pointer to the destination, must hold numFrames*numChannels samples
+/// @param numFrames the number of frames to build
+void interleaveSamples(const int16_t * const *channels, unsigned numChannels, int16_t *dest, size_t numFrames);
+
+/// Split frames of interleaved samples back into separate channels
+/// @param src pointer to the frames
+/// @param channels array of numChannels pointers to the destinations. A nullptr
+/// channel is skipped.
+/// @param numChannels the number of channels in each frame
+/// @param numFrames the number of frames to split
+void deinterleaveSamples(const int16_t *src, int16_t * const *channels, unsigned numChannels, size_t numFrames);
+
+}
+
+#endif /* __BAGUITAR_LIBSAMPLECODECS_H */
@@ -46,6 +46,7 @@ AudioDelay::AudioDelay(ExtMemSlot *slot)
 {
 	m_type = (MemType::MEM_EXTERNAL);
 	m_slot = slot;
+	m_reader.attach(slot);
 }
 
 AudioDelay::~AudioDelay()
@@ -76,8 +77,9 @@ audio_block_t* AudioDelay::addBlock(audio_block_t *block)
 		if (!m_slot) { Serial.println("addBlock(): m_slot is not valid"); }
 
 		if (block) {
-			// this causes pops
-		    m_slot->writeAdvance16(block->data, AUDIO_BLOCK_SAMPLES);
+			// The slot keeps its own copy of the samples until they are written, so the
+			// block can be released as soon as this returns.
+		    m_slot->writeAdvance16Copy(block->data, AUDIO_BLOCK_SAMPLES);
 		}
 		blockToRelease =  block;
 	}
@@ -142,30 +144,59 @@ bool AudioDelay::getSamples(audio_block_t *dest, size_t offsetSamples, size_t nu
 
 	} else {
 		// EXTERNAL Memory
-		if (numSamples*sizeof(int16_t) <= m_slot->size() ) {
-			int currentPositionBytes = (int)m_slot->getWritePosition() - (int)(AUDIO_BLOCK_SAMPLES*sizeof(int16_t));
-			size_t offsetBytes = offsetSamples * sizeof(int16_t);
+		return getSamples(dest->data, offsetSamples, numSamples);
+	}
 
-			if ((int)offsetBytes <= currentPositionBytes) {
-				m_slot->setReadPosition(currentPositionBytes - offsetBytes);
-			} else {
-				// It's going to wrap around to the end of the slot
-				int readPosition = (int)m_slot->size() + currentPositionBytes - offsetBytes;
-				m_slot->setReadPosition((size_t)readPosition);
-			}
+}
 
-			// This causes pops
-			m_slot->readAdvance16(dest->data, AUDIO_BLOCK_SAMPLES);
+bool AudioDelay::getSamples(int16_t *dest, size_t offsetSamples, size_t numSamples)
+{
+	if (!dest) {
+		Serial.println("getSamples(): dest is invalid");
+		return false;
+	}
 
+	if (m_type == (MemType::MEM_EXTERNAL)) {
+		// The offset counts from the most recent block added, which is the one just
+		// behind the write position. The reader handles wrapping around the slot.
+		if ((numSamples*sizeof(int16_t) <= m_slot->size()) && m_reader.setDelay(offsetSamples + AUDIO_BLOCK_SAMPLES)) {
+			m_reader.readAdvance16(dest, numSamples);
 			return true;
 		} else {
 			// numSampmles is > than total slot size
-			Serial.println("getSamples(): ERROR numSamples > total slot size");
+			Serial.println("getSamples(): ERROR numSamples or offset > total slot size");
 			return false;
 		}
 	}
+	return false;
+}
+
+bool AudioDelay::addSamples(const int32_t *src, size_t numSamples)
+{
+	if (!src) {
+		Serial.println("addSamples(): src is invalid");
+		return false;
+	}
+	if ((m_type != MemType::MEM_EXTERNAL) || (m_slot->getCodec() != SampleCodec::PACKED24)) { return false; }
 
+	// PACKED24 slots pack the samples into their codec buffer before returning
+	return m_slot->writeAdvance32(src, numSamples);
 }
 
+bool AudioDelay::getSamples(int32_t *dest, size_t offsetSamples, size_t numSamples)
+{
+	if (!dest) {
+		Serial.println("getSamples(): dest is invalid");
+		return false;
+	}
+	if ((m_type != MemType::MEM_EXTERNAL) || (m_slot->getCodec() != SampleCodec::PACKED24)) { return false; }
+
+	if ((numSamples*sizeof(int16_t) <= m_slot->size()) && m_reader.setDelay(offsetSamples + AUDIO_BLOCK_SAMPLES)) {
+		return m_reader.readAdvance32(dest, numSamples);
+	} else {
+		Serial.println("getSamples(): ERROR numSamples or offset > total slot size");
+		return false;
+	}
 }
 
+}
@@ -20,6 +20,7 @@
 
 #include "Audio.h"
 #include "LibBasicFunctions.h"
+#include "LibKernelProfile.h"
 
 namespace BAGuitar {
 
@@ -58,6 +59,7 @@ void alphaBlend(audio_block_t *out, audio_block_t *dry, audio_block_t* wet, floa
 	int16_t scaleFractWet = (int16_t)(mix * 32767.0f);
 	int16_t scaleFractDry = 32767-scaleFractWet;
 
+	PROFILE_KERNEL(ALPHA_BLEND, AUDIO_BLOCK_SAMPLES);
 	arm_scale_q15(dry->data, scaleFractDry, 0, dryBuffer, AUDIO_BLOCK_SAMPLES);
 	arm_scale_q15(wet->data, scaleFractWet, 0, wetBuffer, AUDIO_BLOCK_SAMPLES);
 	arm_add_q15(wetBuffer, dryBuffer, out->data, AUDIO_BLOCK_SAMPLES);
@@ -66,11 +68,38 @@ void alphaBlend(audio_block_t *out, audio_block_t *dry, audio_block_t* wet, floa
 void gainAdjust(audio_block_t *out, audio_block_t *in, float vol, int coeffShift)
 {
 	int16_t scale = (int16_t)(vol * 32767.0f);
+	PROFILE_KERNEL(GAIN, AUDIO_BLOCK_SAMPLES);
 	arm_scale_q15(in->data, scale, coeffShift, out->data, AUDIO_BLOCK_SAMPLES);
 }
 
+// The gains are the Q15 ones of the audio block versions moved up to Q31. The
+// samples are blended an audio block at a time so the buffers have a fixed size.
+void alphaBlend(int32_t *out, int32_t *dry, int32_t *wet, float mix, size_t numSamples)
+{
+	int32_t wetBuffer[AUDIO_BLOCK_SAMPLES];
+	int32_t dryBuffer[AUDIO_BLOCK_SAMPLES];
+	int32_t scaleFractWet = (int32_t)(mix * 32767.0f);
+	int32_t scaleFractDry = 32767-scaleFractWet;
+
+	PROFILE_KERNEL(ALPHA_BLEND_24, numSamples);
+	for (size_t offset=0; offset < numSamples; offset += AUDIO_BLOCK_SAMPLES) {
+		size_t blockSamples = min(numSamples - offset, static_cast<size_t>(AUDIO_BLOCK_SAMPLES));
+		arm_scale_q31(dry + offset, scaleFractDry << 16, 0, dryBuffer, blockSamples);
+		arm_scale_q31(wet + offset, scaleFractWet << 16, 0, wetBuffer, blockSamples);
+		arm_add_q31(wetBuffer, dryBuffer, out + offset, blockSamples);
+	}
+}
+
+void gainAdjust(int32_t *out, int32_t *in, float vol, int coeffShift, size_t numSamples)
+{
+	int32_t scale = (int32_t)(vol * 32767.0f);
+	PROFILE_KERNEL(GAIN_24, numSamples);
+	arm_scale_q31(in, scale << 16, coeffShift, out, numSamples);
+}
+
 void clearAudioBlock(audio_block_t *block)
 {
+	PROFILE_KERNEL(CLEAR, AUDIO_BLOCK_SAMPLES);
 	memset(block->data, 0, sizeof(int16_t)*AUDIO_BLOCK_SAMPLES);
 }
 
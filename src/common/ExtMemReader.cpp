@@ -0,0 +1,90 @@
+/*
+ * ExtMemReader.cpp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "LibMemoryManagement.h"
+
+namespace BAGuitar {
+
+/////////////////////////////////////////////////////////////////////////////
+// MEM READER
+/////////////////////////////////////////////////////////////////////////////
+void ExtMemReader::attach(ExtMemSlot *slot)
+{
+	// a read from the old slot could still be landing in the caller's buffer
+	waitForRead();
+	m_slot = slot;
+	m_position = 0;
+	for (unsigned dev=0; dev < NUM_MEM_SLOTS; dev++) { m_readTokens[dev] = DMA_TOKEN_NONE; }
+}
+
+bool ExtMemReader::setPosition(size_t offsetBytes)
+{
+	if (!isValid() || (offsetBytes >= m_slot->size())) { return false; }
+	m_position = offsetBytes;
+	return true;
+}
+
+bool ExtMemReader::setDelay(size_t delaySamples)
+{
+	if (!isValid()) { return false; }
+	size_t delayBytes = sizeof(int16_t)*delaySamples;
+	size_t slotSize = m_slot->size();
+	if (delayBytes > slotSize) { return false; }
+	m_position = (m_slot->getWritePosition() + slotSize - delayBytes) % slotSize;
+	return true;
+}
+
+// The read is issued through the slot, so it sees words buffered by the slot's
+// single word writes, obeys the high water mark and is counted in the slot stats.
+// It doesn't touch the slot's own read cursor or its read-ahead buffers.
+bool ExtMemReader::readAdvance16(int16_t *dest, size_t numWords, DmaCallback callback, void *context)
+{
+	if (!isValid() || !dest || (sizeof(int16_t)*numWords > m_slot->size())) { return false; }
+	if (m_slot->m_isSplitBusy(ExtMemSlot::TransferOp::READ, callback)) { return false; }
+	m_slot->m_flushWordWrites();
+	size_t position = m_slot->m_circularTransfer(ExtMemSlot::TransferOp::READ, m_slot->m_start + m_position,
+			dest, numWords, callback, context);
+	m_position = position - m_slot->m_start;
+	m_slot->m_recordTokens(m_readTokens, m_slot->m_readTokens);
+	return true;
+}
+
+bool ExtMemReader::readAdvance32(int32_t *dest, size_t numSamples, DmaCallback callback, void *context)
+{
+	if (!isValid() || !dest || (m_slot->m_codec != SampleCodec::PACKED24) || (sizeof(int16_t)*numSamples > m_slot->size())) { return false; }
+	m_slot->m_flushWordWrites();
+	size_t position = m_slot->m_circularTransfer32(ExtMemSlot::TransferOp::READ, m_slot->m_start + m_position,
+			dest, numSamples, callback, context);
+	m_position = position - m_slot->m_start;
+	m_slot->m_recordTokens(m_readTokens, m_slot->m_readTokens);
+	return true;
+}
+
+// Releasing the slot waits for all of its transfers, including the readers' ones
+bool ExtMemReader::isReadDone() const
+{
+	if (!isValid()) { return true; }
+	return m_slot->m_isDone(m_readTokens);
+}
+
+void ExtMemReader::waitForRead() const
+{
+	if (!isValid()) { return; }
+	m_slot->m_waitForTokens(m_readTokens);
+}
+
+} // namespace BAGuitar
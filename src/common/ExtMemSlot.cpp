@@ -28,16 +28,64 @@ namespace BAGuitar {
 /////////////////////////////////////////////////////////////////////////////
 // MEM SLOT
 /////////////////////////////////////////////////////////////////////////////
+constexpr size_t ExtMemSlot::STRIPE_SIZE_BYTES;
+constexpr size_t ExtMemSlot::MAX_TRANSFER_PARTS;
+constexpr size_t ExtMemSlot::MAX_TRANSFER_ENTRIES;
+constexpr size_t ExtMemSlot::WORD_BUFFER_WORDS;
+constexpr size_t ExtMemSlot::MAX_GATHER_ENTRIES;
+constexpr size_t ExtMemSlot::CLEAR_CHUNK_BYTES;
+constexpr size_t ExtMemSlot::CODEC_BUFFER_BYTES;
+constexpr size_t ExtMemSlot::MAX_CODEC_READ_PARTS;
+constexpr size_t ExtMemSlot::STAGING_BUFFERS;
+constexpr size_t ExtMemSlot::STAGING_BUFFER_WORDS;
+constexpr unsigned ExtMemSlot::MAX_CHANNELS;
+constexpr size_t ExtMemSlot::FRAME_BUFFER_FRAMES;
+constexpr unsigned ExtMemSlot::NUM_FRAME_BUFFERS;
+
+ExtMemSlot::~ExtMemSlot()
+{
+	// the manager must not keep the slot in its list, even if the memory couldn't be freed
+	if (!release() && m_manager) { m_manager->m_detachSlot(this); }
+}
+
+bool ExtMemSlot::release()
+{
+	if (!m_valid || !m_manager) { return false; }
+	return m_manager->releaseMemory(this);
+}
+
 bool ExtMemSlot::clear()
 {
 	if (!m_valid) { return false; }
-	m_spi->zero16(m_start, m_size);
+	m_dropWordBuffers();
+	// nothing is written now, the slot reads as zero until serviceClear() or later
+	// writes move the high water mark forward
+	m_validEnd = m_storageStart;
+	return true;
+}
+
+bool ExtMemSlot::serviceClear(size_t maxBytes)
+{
+	if (!m_valid) { return false; }
+	if (m_validEnd > m_storageEnd) { return true; }
+
+	SpiGatherEntry entry = {m_validEnd, nullptr, min(maxBytes, m_storageEnd - m_validEnd + 1)};
+	m_transfer(TransferOp::CLEAR, &entry, 1, nullptr, nullptr);
+	return m_validEnd > m_storageEnd;
+}
+
+bool ExtMemSlot::flush()
+{
+	if (!m_valid) { return false; }
+	m_flushWordWrites();
 	return true;
 }
 
 bool ExtMemSlot::setWritePosition(size_t offsetBytes)
 {
 	if (m_start + offsetBytes <= m_end) {
+		m_flushWordWrites();
+		m_invalidateReadAhead();
 		m_currentWrPosition = m_start + offsetBytes;
 		return true;
 	} else { return false; }
@@ -48,8 +96,10 @@ bool ExtMemSlot::write16(size_t offsetWords, int16_t *src, size_t numWords)
 	if (!m_valid) { return false; }
 	size_t writeStart = m_start + sizeof(int16_t)*offsetWords; // 2x because int16 is two bytes per data
 	size_t numBytes = sizeof(int16_t)*numWords;
-	if ((writeStart + numBytes-1) <= m_end) {
-		m_spi->write16(writeStart, reinterpret_cast<uint16_t*>(src), numWords); // cast audio data to uint
+	if (((writeStart + numBytes-1) <= m_end) && m_isCodecAligned(writeStart, numWords)) {
+		m_flushWordWrites();
+		m_invalidateReadAhead();
+		m_spiWrite16(writeStart, src, numWords);
 		return true;
 	} else {
 		// this would go past the end of the memory slot, do not perform the write
@@ -60,6 +110,7 @@ bool ExtMemSlot::write16(size_t offsetWords, int16_t *src, size_t numWords)
 bool ExtMemSlot::setReadPosition(size_t offsetBytes)
 {
 	if (m_start + offsetBytes <= m_end) {
+		m_invalidateReadAhead();
 		m_currentRdPosition = m_start + offsetBytes;
 		return true;
 	} else {
@@ -72,8 +123,10 @@ bool ExtMemSlot::zero16(size_t offsetWords, size_t numWords)
 	if (!m_valid) { return false; }
 	size_t writeStart = m_start + sizeof(int16_t)*offsetWords;
 	size_t numBytes = sizeof(int16_t)*numWords;
-	if ((writeStart + numBytes-1) <= m_end) {
-		m_spi->zero16(writeStart, numWords); // cast audio data to uint
+	if (((writeStart + numBytes-1) <= m_end) && m_isCodecAligned(writeStart, numWords)) {
+		m_flushWordWrites();
+		m_invalidateReadAhead();
+		m_spiZero16(writeStart, numWords);
 		return true;
 	} else {
 		// this would go past the end of the memory slot, do not perform the write
@@ -83,12 +136,13 @@ bool ExtMemSlot::zero16(size_t offsetWords, size_t numWords)
 
 bool ExtMemSlot::read16(size_t offsetWords, int16_t *dest, size_t numWords)
 {
-	if (!dest) return false; // invalid destination
+	if (!m_valid || !dest) return false; // invalid slot or destination
 	size_t readOffset = m_start + sizeof(int16_t)*offsetWords;
 	size_t numBytes = sizeof(int16_t)*numWords;
 
 	if ((readOffset + numBytes-1) <= m_end) {
-		m_spi->read16(readOffset, reinterpret_cast<uint16_t*>(dest), numWords);
+		m_flushWordWrites();
+		m_spiRead16(readOffset, dest, numWords);
 		return true;
 	} else {
 		// this would go past the end of the memory slot, do not perform the read
@@ -96,95 +150,233 @@ bool ExtMemSlot::read16(size_t offsetWords, int16_t *dest, size_t numWords)
 	}
 }
 
-uint16_t ExtMemSlot::readAdvance16()
+bool ExtMemSlot::readGather16(const ExtMemGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
 {
-	uint16_t val = m_spi->read16(m_currentRdPosition);
-	if (m_currentRdPosition < m_end-1) {
-		m_currentRdPosition +=2; // position is in bytes and we read two
-	} else {
-		m_currentRdPosition = m_start;
+	if (!m_valid || !entries || (numEntries > MAX_GATHER_ENTRIES)) { return false; }
+	if (m_isSplitBusy(TransferOp::READ, callback)) { return false; }
+
+	// each part can wrap around the end of the slot, so it may need two SPI reads
+	SpiGatherEntry parts[2*MAX_GATHER_ENTRIES];
+	size_t numParts = 0;
+	for (size_t i=0; i < numEntries; i++) {
+		size_t readStart = m_start + sizeof(int16_t)*entries[i].offsetWords;
+		size_t numBytes = sizeof(int16_t)*entries[i].numWords;
+		if (!entries[i].dest || (readStart > m_end) || (numBytes > m_size)) { return false; }
+
+		uint8_t *dest = reinterpret_cast<uint8_t*>(entries[i].dest);
+		if (readStart + numBytes-1 <= m_end) {
+			parts[numParts++] = {readStart, dest, numBytes};
+		} else {
+			size_t rdBytes = m_end - readStart + 1;
+			parts[numParts++] = {readStart, dest, rdBytes};
+			parts[numParts++] = {m_start, dest + rdBytes, numBytes - rdBytes};
+		}
 	}
+	m_flushWordWrites();
+	m_spiReadGather(parts, numParts, callback, context);
+	return true;
+}
+
+uint16_t ExtMemSlot::readAdvance16()
+{
+	if (!m_valid) { return 0; }
+	if (m_wordReadIndex >= m_wordRead[m_wordReadActive].count) { m_refillWordReads(); }
+
+	uint16_t val = static_cast<uint16_t>(m_wordRead[m_wordReadActive].data[m_wordReadIndex++]);
+	m_currentRdPosition = m_advancePosition(m_currentRdPosition, 1);
 	return val;
 }
 
-bool ExtMemSlot::readAdvance16(int16_t *dest, size_t numWords)
+bool ExtMemSlot::readAdvance16(int16_t *dest, size_t numWords, DmaCallback callback, void *context)
 {
-    if (!m_valid) { return false; }
-    size_t numBytes = sizeof(int16_t)*numWords;
+	if (!m_valid || m_isSplitBusy(TransferOp::READ, callback)) { return false; }
+	m_flushWordWrites();
+	m_invalidateReadAhead();
+	m_currentRdPosition = m_circularTransfer(TransferOp::READ, m_currentRdPosition, dest, numWords, callback, context);
+	return true;
+}
 
-    if (m_currentRdPosition + numBytes-1 <= m_end) {
-        // entire block fits in memory slot without wrapping
-        m_spi->read16(m_currentRdPosition, reinterpret_cast<uint16_t*>(dest), numWords); // cast audio data to uint.
-        m_currentRdPosition += numBytes;
 
-    } else {
-        // this read will wrap the memory slot
-        size_t rdBytes = m_end - m_currentRdPosition + 1;
-        size_t rdDataNum = rdBytes >> 1; // divide by two to get the number of data
-        m_spi->read16(m_currentRdPosition, reinterpret_cast<uint16_t*>(dest), rdDataNum);
-        size_t remainingData = numWords - rdDataNum;
-        m_spi->read16(m_start, reinterpret_cast<uint16_t*>(dest + rdDataNum), remainingData); // write remaining bytes are start
-        m_currentRdPosition = m_start + (remainingData*sizeof(int16_t));
-    }
-    return true;
+bool ExtMemSlot::writeAdvance16(int16_t *src, size_t numWords, DmaCallback callback, void *context)
+{
+	if (!m_valid || !m_isCodecAligned(m_currentWrPosition, numWords)) { return false; }
+	if (m_isSplitBusy(TransferOp::WRITE, callback)) { return false; }
+	m_flushWordWrites();
+	m_invalidateReadAhead();
+	m_currentWrPosition = m_circularTransfer(TransferOp::WRITE, m_currentWrPosition, src, numWords, callback, context);
+	return true;
 }
 
 
-bool ExtMemSlot::writeAdvance16(int16_t *src, size_t numWords)
+// The data is copied in pieces of up to one staging buffer. Each piece is written as
+// soon as it is copied, so the pieces keep their order on the memory.
+bool ExtMemSlot::writeAdvance16Copy(const int16_t *src, size_t numWords)
 {
-	if (!m_valid) { return false; }
-	size_t numBytes = sizeof(int16_t)*numWords;
+	if (!m_staging) { return writeAdvance16(const_cast<int16_t*>(src), numWords); }
 
-	if (m_currentWrPosition + numBytes-1 <= m_end) {
-		// entire block fits in memory slot without wrapping
-		m_spi->write16(m_currentWrPosition, reinterpret_cast<uint16_t*>(src), numWords); // cast audio data to uint.
-		m_currentWrPosition += numBytes;
+	while (numWords > 0) {
+		StagingBuffer &buffer = m_staging[m_stagingNext];
+		m_waitForTokens(buffer.tokens);
 
-	} else {
-		// this write will wrap the memory slot
-		size_t wrBytes = m_end - m_currentWrPosition + 1;
-		size_t wrDataNum = wrBytes >> 1; // divide by two to get the number of data
-		m_spi->write16(m_currentWrPosition, reinterpret_cast<uint16_t*>(src), wrDataNum);
-		size_t remainingData = numWords - wrDataNum;
-		m_spi->write16(m_start, reinterpret_cast<uint16_t*>(src + wrDataNum), remainingData); // write remaining bytes are start
-		m_currentWrPosition = m_start + (remainingData*sizeof(int16_t));
+		size_t chunkWords = min(numWords, STAGING_BUFFER_WORDS);
+		memcpy(buffer.data, src, chunkWords*sizeof(int16_t));
+		if (!writeAdvance16(buffer.data, chunkWords)) { return false; }
+		m_recordTokens(buffer.tokens, m_writeTokens);
+
+		m_stagingNext = (m_stagingNext + 1) % STAGING_BUFFERS;
+		src += chunkWords;
+		numWords -= chunkWords;
 	}
 	return true;
 }
 
 
-bool ExtMemSlot::zeroAdvance16(size_t numWords)
+// The 32-bit samples are packed and unpacked by the codec path, so they follow the same
+// ordering and buffering rules as 16-bit samples on a codec slot.
+bool ExtMemSlot::writeAdvance32(const int32_t *src, size_t numSamples, DmaCallback callback, void *context)
 {
-	if (!m_valid) { return false; }
-	size_t numBytes = 2*numWords;
-	if (m_currentWrPosition + numBytes-1 <= m_end) {
-		// entire block fits in memory slot without wrapping
-		m_spi->zero16(m_currentWrPosition, numWords); // cast audio data to uint.
-		m_currentWrPosition += numBytes;
+	if (!m_valid || (m_codec != SampleCodec::PACKED24)) { return false; }
+	if (m_isSplitBusy(TransferOp::WRITE, callback)) { return false; }
+	m_flushWordWrites();
+	m_invalidateReadAhead();
+	m_currentWrPosition = m_circularTransfer32(TransferOp::WRITE, m_currentWrPosition, const_cast<int32_t*>(src), numSamples, callback, context);
+	return true;
+}
 
-	} else {
-		// this write will wrap the memory slot
-		size_t wrBytes = m_end - m_currentWrPosition + 1;
-		size_t wrDataNum = wrBytes >> 1;
-		m_spi->zero16(m_currentWrPosition, wrDataNum);
-		size_t remainingWords = numWords - wrDataNum; // calculate the remaining bytes
-		m_spi->zero16(m_start, remainingWords); // write remaining bytes are start
-		m_currentWrPosition = m_start + remainingWords*sizeof(int16_t);
+bool ExtMemSlot::readAdvance32(int32_t *dest, size_t numSamples, DmaCallback callback, void *context)
+{
+	if (!m_valid || (m_codec != SampleCodec::PACKED24)) { return false; }
+	m_flushWordWrites();
+	m_invalidateReadAhead();
+	m_currentRdPosition = m_circularTransfer32(TransferOp::READ, m_currentRdPosition, dest, numSamples, callback, context);
+	return true;
+}
+
+
+bool ExtMemSlot::setNumChannels(unsigned numChannels)
+{
+	if (!m_valid || (m_codec != SampleCodec::PCM16) || (numChannels == 0) || (numChannels > MAX_CHANNELS)) { return false; }
+	if ((m_size % (numChannels*sizeof(int16_t))) != 0) { return false; } // a frame can't wrap around the end
+
+	// the old buffers may still be in use by a transfer
+	waitForRead();
+	waitForWrite();
+	if (m_frameBuffers) {
+		delete [] m_frameBuffers;
+		m_frameBuffers = nullptr;
+	}
+	m_numChannels = 1;
+	if (numChannels > 1) {
+		m_frameBuffers = new int16_t[NUM_FRAME_BUFFERS*FRAME_BUFFER_FRAMES*numChannels];
+		if (!m_frameBuffers) { return false; }
+	}
+	m_numChannels = numChannels;
+	m_frameWriteNext = 0;
+	for (unsigned i=0; i < 2; i++) { m_recordTokens(m_frameWriteTokens[i], m_writeTokens); }
+
+	flush();
+	setWritePosition(0);
+	setReadPosition(0);
+	return true;
+}
+
+// The frames are built in the two write buffers in turn, like writeAdvance16Copy()
+bool ExtMemSlot::writeAdvanceFrames(const int16_t * const *channels, size_t numFrames)
+{
+	if (!m_valid || !channels) { return false; }
+	if (m_numChannels == 1) {
+		return channels[0] ? writeAdvance16Copy(channels[0], numFrames) : zeroAdvance16(numFrames);
+	}
+
+	const int16_t *src[MAX_CHANNELS];
+	for (unsigned channel=0; channel < m_numChannels; channel++) { src[channel] = channels[channel]; }
+	size_t bufferWords = FRAME_BUFFER_FRAMES*m_numChannels;
+
+	while (numFrames > 0) {
+		unsigned index = m_frameWriteNext;
+		int16_t *buffer = m_frameBuffers + index*bufferWords;
+		m_waitForTokens(m_frameWriteTokens[index]);
+
+		size_t chunkFrames = min(numFrames, FRAME_BUFFER_FRAMES);
+		interleaveSamples(src, m_numChannels, buffer, chunkFrames);
+		if (!writeAdvance16(buffer, chunkFrames*m_numChannels)) { return false; }
+		m_recordTokens(m_frameWriteTokens[index], m_writeTokens);
+
+		m_frameWriteNext ^= 0x1;
+		for (unsigned channel=0; channel < m_numChannels; channel++) {
+			if (src[channel]) { src[channel] += chunkFrames; }
+		}
+		numFrames -= chunkFrames;
+	}
+	return true;
+}
+
+// The frames are read into the read buffer in one request and split up into the
+// channels when it arrives, the same way codec reads are decoded.
+bool ExtMemSlot::readAdvanceFrames(int16_t * const *channels, size_t numFrames, DmaCallback callback, void *context)
+{
+	if (!m_valid || !channels) { return false; }
+	if (m_numChannels == 1) {
+		return channels[0] ? readAdvance16(channels[0], numFrames, callback, context) : false;
+	}
+
+	// the read buffer is shared, so the previous read must be split up first
+	if (m_frameReadPending) { waitForRead(); }
+	m_flushWordWrites();
+	m_invalidateReadAhead();
+
+	int16_t *dest[MAX_CHANNELS];
+	for (unsigned channel=0; channel < m_numChannels; channel++) { dest[channel] = channels[channel]; }
+	int16_t *readBuffer = m_frameBuffers + 2*FRAME_BUFFER_FRAMES*m_numChannels;
+
+	while (numFrames > 0) {
+		size_t chunkFrames = min(numFrames, FRAME_BUFFER_FRAMES);
+		bool last = (chunkFrames == numFrames);
+
+		for (unsigned channel=0; channel < m_numChannels; channel++) { m_frameReadDest[channel] = dest[channel]; }
+		m_frameReadFrames = chunkFrames;
+		m_frameReadCallback = last ? callback : nullptr;
+		m_frameReadContext = context;
+		m_frameReadPending = true;
+		m_currentRdPosition = m_circularTransfer(TransferOp::READ, m_currentRdPosition, readBuffer, chunkFrames*m_numChannels,
+				m_frameReadComplete, this);
+
+		numFrames -= chunkFrames;
+		if (!last) {
+			waitForRead();
+			for (unsigned channel=0; channel < m_numChannels; channel++) {
+				if (dest[channel]) { dest[channel] += chunkFrames; }
+			}
+		}
 	}
 	return true;
 }
 
+bool ExtMemSlot::zeroAdvance16(size_t numWords)
+{
+	if (!m_valid || !m_isCodecAligned(m_currentWrPosition, numWords)) { return false; }
+	m_flushWordWrites();
+	m_invalidateReadAhead();
+	m_currentWrPosition = m_circularTransfer(TransferOp::ZERO, m_currentWrPosition, nullptr, numWords, nullptr, nullptr);
+	return true;
+}
+
 
 bool ExtMemSlot::writeAdvance16(int16_t data)
 {
-	if (!m_valid) { return false; }
+	// buffered words are written in arbitrary groups, so only codecs that encode single samples can be used
+	if (!m_valid || (codecFrameSamples(m_codec) > 1)) { return false; }
 
-	m_spi->write16(m_currentWrPosition, static_cast<uint16_t>(data));
-	if (m_currentWrPosition < m_end-1) {
-		m_currentWrPosition+=2; // wrote two bytes
-	} else {
-		m_currentWrPosition = m_start;
+	WordBuffer &buffer = m_wordWrite[m_wordWriteActive];
+	if (buffer.count == 0) {
+		// starting to fill the buffer, make sure its last flush has finished with it
+		m_waitForTokens(buffer.tokens);
+		buffer.position = m_currentWrPosition;
 	}
+	buffer.data[buffer.count++] = data;
+	m_currentWrPosition = m_advancePosition(m_currentWrPosition, 1);
+
+	if (buffer.count == WORD_BUFFER_WORDS) { m_flushWordWrites(); }
 	return true;
 }
 
@@ -194,6 +386,7 @@ bool ExtMemSlot::enable() const
 	if (m_spi) {
 		Serial.println("ExtMemSlot::enable()");
 		m_spi->begin();
+		if (m_spiSecondary && !m_spiSecondary->isStarted()) { m_spiSecondary->begin(); }
 		return true;
 	}
 	else {
@@ -204,22 +397,86 @@ bool ExtMemSlot::enable() const
 
 bool ExtMemSlot::isEnabled() const
 {
-	if (m_spi) { return m_spi->isStarted(); }
-	else return false;
+	if (!m_spi) { return false; }
+	if (m_spiSecondary && !m_spiSecondary->isStarted()) { return false; }
+	return m_spi->isStarted();
 }
 
 bool ExtMemSlot::isWriteBusy() const
 {
-	if (m_useDma) {
-		return (static_cast<BASpiMemoryDMA*>(m_spi))->isWriteBusy();
-	} else { return false; }
+	if (!m_useDma || !m_spi) { return false; }
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		if ((static_cast<BASpiMemoryDMA*>(m_device(dev)))->isWriteBusy()) { return true; }
+	}
+	return false;
 }
 
 bool ExtMemSlot::isReadBusy() const
 {
-	if (m_useDma) {
-		return (static_cast<BASpiMemoryDMA*>(m_spi))->isReadBusy();
-	} else { return false; }
+	if (!m_useDma || !m_spi) { return false; }
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		if ((static_cast<BASpiMemoryDMA*>(m_device(dev)))->isReadBusy()) { return true; }
+	}
+	return false;
+}
+
+bool ExtMemSlot::isReadDone() const
+{
+	return m_isDone(m_readTokens);
+}
+
+bool ExtMemSlot::isWriteDone() const
+{
+	if (!m_useDma || !m_spi) { return true; }
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		BASpiMemoryDMA *spiDma = static_cast<BASpiMemoryDMA*>(m_device(dev));
+		if (!spiDma->isDone(m_writeTokens[dev]) || !spiDma->isDone(m_clearTokens[dev])) { return false; }
+	}
+	return true;
+}
+
+void ExtMemSlot::waitForRead() const
+{
+	m_waitForTokens(m_readTokens);
+}
+
+void ExtMemSlot::waitForWrite() const
+{
+	if (!m_useDma || !m_spi) { return; }
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		BASpiMemoryDMA *spiDma = static_cast<BASpiMemoryDMA*>(m_device(dev));
+		SpiMemStats before = spiDma->getStats();
+		spiDma->waitFor(m_writeTokens[dev]);
+		spiDma->waitFor(m_clearTokens[dev]);
+		m_chargeStats(dev, before);
+	}
+}
+
+SpiMemStats ExtMemSlot::getStats() const
+{
+	SpiMemStats stats = m_stats;
+	stats.elapsedCycles = ARM_DWT_CYCCNT - m_statsStartCycles;
+	return stats;
+}
+
+SpiMemStats ExtMemSlot::snapshotStats()
+{
+	SpiMemStats stats = getStats();
+	m_stats = SpiMemStats();
+	m_statsStartCycles = ARM_DWT_CYCCNT;
+	return stats;
+}
+
+// A slot's share of the traffic is the change in its memory's counters across each
+// of its own transfers and waits.
+void ExtMemSlot::m_chargeStats(unsigned dev, const SpiMemStats &before) const
+{
+	SpiMemStats after = m_device(dev)->getStats();
+	m_stats.bytesRead    += after.bytesRead - before.bytesRead;
+	m_stats.bytesWritten += after.bytesWritten - before.bytesWritten;
+	m_stats.transactions += after.transactions - before.transactions;
+	m_stats.dmaChunks    += after.dmaChunks - before.dmaChunks;
+	m_stats.busyCycles   += after.busyCycles - before.busyCycles;
 }
 
 
@@ -228,8 +485,542 @@ void ExtMemSlot::printStatus(void) const
 	Serial.println(String("valid:") + m_valid + String(" m_start:") + m_start + \
 			       String(" m_end:") + m_end + String(" m_currentWrPosition: ") + m_currentWrPosition + \
 				   String(" m_currentRdPosition: ") + m_currentRdPosition + \
-				   String(" m_size:") + m_size);
+				   String(" m_size:") + m_size + String(" m_numRegions:") + m_numRegions);
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PRIVATE METHODS
+/////////////////////////////////////////////////////////////////////////////
+// Map a slot address onto the memory device that holds it. For a slot in a single
+// memory the address is already the physical address. Multi-region slots use addresses
+// relative to the slot start. Striped slots alternate between the two memories every
+// STRIPE_SIZE_BYTES, concatenated slots fill the MEM0 region before moving on to MEM1.
+void ExtMemSlot::m_mapAddress(size_t address, size_t numBytes, unsigned &device, size_t &physAddress, size_t &contiguousBytes) const
+{
+	if (m_layout == Layout::STRIPED) {
+		size_t stripe = address / STRIPE_SIZE_BYTES;
+		size_t stripeOffset = address % STRIPE_SIZE_BYTES;
+		device = stripe & 0x1;
+		physAddress = m_regions[device].start + (stripe >> 1)*STRIPE_SIZE_BYTES + stripeOffset;
+		contiguousBytes = min(numBytes, STRIPE_SIZE_BYTES - stripeOffset);
+	} else if (m_layout == Layout::CONCATENATED) {
+		if (address < m_regions[0].size) {
+			device = 0;
+			physAddress = m_regions[0].start + address;
+			contiguousBytes = min(numBytes, m_regions[0].size - address);
+		} else {
+			device = 1;
+			physAddress = m_regions[1].start + (address - m_regions[0].size);
+			contiguousBytes = numBytes;
+		}
+	} else {
+		device = 0;
+		physAddress = address;
+		contiguousBytes = numBytes;
+	}
+}
+
+// Completion for a request spread across both memories. The user callback is
+// called once the last memory has finished its part.
+void ExtMemSlot::m_splitCompletion(void *context, DmaToken token)
+{
+	SplitCompletion *completion = static_cast<SplitCompletion*>(context);
+	if (completion->remaining > 0) { completion->remaining--; }
+	if ((completion->remaining == 0) && completion->callback) {
+		DmaCallback callback = completion->callback;
+		completion->callback = nullptr;
+		callback(completion->context, token);
+	}
+}
+
+// Queue a batch of parts that all belong to one memory. The callback, if any, goes
+// with the last part.
+void ExtMemSlot::m_issueParts(TransferOp op, unsigned dev, const SpiGatherEntry *parts, size_t numParts, DmaCallback callback, void *context)
+{
+	if (numParts == 0) { return; }
+	BASpiMemory *spi = m_device(dev);
+	SpiMemStats before = spi->getStats();
+
+	if (m_useDma) {
+		BASpiMemoryDMA *spiDma = static_cast<BASpiMemoryDMA*>(spi);
+		if (op == TransferOp::READ) {
+			SpiPriority readPriority = m_backgroundPriority ? SpiPriority::BACKGROUND : SpiPriority::OUTPUT_READ;
+			m_readTokens[dev] = spiDma->readGatherAsync(parts, numParts, callback, context, readPriority);
+			m_chargeStats(dev, before);
+			return;
+		}
+		SpiPriority writePriority = m_backgroundPriority ? SpiPriority::BACKGROUND : SpiPriority::AUDIO_WRITE;
+		for (size_t i=0; i < numParts; i++) {
+			DmaCallback partCallback = (i == numParts-1) ? callback : nullptr;
+			if (op == TransferOp::WRITE) {
+				m_writeTokens[dev] = spiDma->writeAsync(parts[i].address, parts[i].dest, parts[i].numBytes, partCallback, context,
+						writePriority);
+			} else if (op == TransferOp::CLEAR) {
+				m_clearTokens[dev] = spiDma->zeroAsync(parts[i].address, parts[i].numBytes, partCallback, context,
+						SpiPriority::BACKGROUND);
+			} else {
+				m_writeTokens[dev] = spiDma->zeroAsync(parts[i].address, parts[i].numBytes, partCallback, context,
+						writePriority);
+			}
+		}
+		m_chargeStats(dev, before);
+	} else {
+		for (size_t i=0; i < numParts; i++) {
+			if (op == TransferOp::READ) {
+				spi->read(parts[i].address, parts[i].dest, parts[i].numBytes);
+			} else if (op == TransferOp::WRITE) {
+				spi->write(parts[i].address, parts[i].dest, parts[i].numBytes);
+			} else {
+				spi->zero(parts[i].address, parts[i].numBytes);
+			}
+		}
+		m_chargeStats(dev, before);
+		if (callback) { callback(context, DMA_TOKEN_NONE); }
+	}
+}
+
+// Move the high water mark forward to cover a write. A write that starts beyond the
+// mark would leave stale contents in between, so the gap is zeroed first.
+void ExtMemSlot::m_extendHighWater(size_t address, size_t numBytes)
+{
+	if (address > m_validEnd) {
+		SpiGatherEntry gap = {m_validEnd, nullptr, address - m_validEnd};
+		m_transferParts(TransferOp::ZERO, &gap, 1, nullptr, nullptr);
+	}
+	m_validEnd = max(m_validEnd, address + numBytes);
+}
+
+// All slot transfers go through here. Reads beyond the high water mark are filled with
+// zeros without touching the memory, writes move the mark forward. With DMA, each request
+// also zeros the next part of the slot past the mark at background priority, so it only
+// uses the bus when no audio transfers are waiting.
+void ExtMemSlot::m_transfer(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
+{
+	if (op == TransferOp::READ) {
+		if (numEntries > MAX_TRANSFER_ENTRIES) { return; } // the callers never send more
+		SpiGatherEntry validEntries[MAX_TRANSFER_ENTRIES];
+		size_t numValid = 0;
+		for (size_t i=0; i < numEntries; i++) {
+			const SpiGatherEntry &entry = entries[i];
+			size_t validBytes = (entry.address < m_validEnd) ? min(entry.numBytes, m_validEnd - entry.address) : 0;
+			if (validBytes < entry.numBytes) { memset(entry.dest + validBytes, 0, entry.numBytes - validBytes); }
+			if (validBytes > 0) { validEntries[numValid++] = {entry.address, entry.dest, validBytes}; }
+		}
+		m_transferParts(op, validEntries, numValid, callback, context);
+	} else {
+		for (size_t i=0; i < numEntries; i++) {
+			if (entries[i].numBytes > 0) { m_extendHighWater(entries[i].address, entries[i].numBytes); }
+		}
+		m_transferParts(op, entries, numEntries, callback, context);
+	}
+
+	if (m_useDma && ((op == TransferOp::READ) || (op == TransferOp::WRITE))) { serviceClear(CLEAR_CHUNK_BYTES); }
+}
+
+// The entries are split on the memory boundaries of the slot layout and queued on each
+// memory in batches. When using DMA the tokens are recorded for isReadDone()/isWriteDone(),
+// otherwise the transfer is complete when the function returns.
+void ExtMemSlot::m_transferParts(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
+{
+	// Find which memories this request touches so the callback can be routed
+	bool deviceUsed[NUM_MEM_SLOTS] = {false, false};
+	for (size_t i=0; i < numEntries; i++) {
+		if (entries[i].numBytes == 0) { continue; }
+		unsigned dev;
+		size_t physAddress, numBytes;
+		m_mapAddress(entries[i].address, entries[i].numBytes, dev, physAddress, numBytes);
+		deviceUsed[dev] = true;
+		if (numBytes < entries[i].numBytes) { deviceUsed[dev ^ 0x1] = true; } // the entry crosses to the other memory
+	}
+	unsigned devicesUsed = 0;
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		if (deviceUsed[dev]) { devicesUsed++; }
+	}
+
+	if (devicesUsed == 0) {
+		if (callback) { callback(context, DMA_TOKEN_NONE); }
+		return;
+	}
+
+	// When both memories are involved, the user callback has to wait for both of them.
+	// The completion is free, requests that would need it again are refused by m_isSplitBusy().
+	if (callback && (devicesUsed > 1)) {
+		SplitCompletion *completion = (op == TransferOp::READ) ? &m_readCompletion : &m_writeCompletion;
+		completion->callback = callback;
+		completion->context = context;
+		completion->remaining = devicesUsed;
+		callback = m_splitCompletion;
+		context = completion;
+	}
+
+	SpiGatherEntry parts[NUM_MEM_SLOTS][MAX_TRANSFER_PARTS];
+	size_t numParts[NUM_MEM_SLOTS] = {0, 0};
+	for (size_t i=0; i < numEntries; i++) {
+		size_t address = entries[i].address;
+		uint8_t *buffer = entries[i].dest;
+		size_t bytesRemaining = entries[i].numBytes;
+		while (bytesRemaining > 0) {
+			unsigned dev;
+			size_t physAddress, numBytes;
+			m_mapAddress(address, bytesRemaining, dev, physAddress, numBytes);
+			if (numParts[dev] == MAX_TRANSFER_PARTS) {
+				// batch is full, send it on and keep going
+				m_issueParts(op, dev, parts[dev], numParts[dev], nullptr, nullptr);
+				numParts[dev] = 0;
+			}
+			parts[dev][numParts[dev]++] = {physAddress, buffer, numBytes};
+			address += numBytes;
+			if (buffer) { buffer += numBytes; }
+			bytesRemaining -= numBytes;
+		}
+	}
+
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		if (deviceUsed[dev]) { m_issueParts(op, dev, parts[dev], numParts[dev], callback, context); }
+	}
+}
+
+// A request with a callback that could span both memories needs the direction's split
+// completion, so it can't be queued while the last one is outstanding. Waiting here could
+// be in an ISR, so the caller gets false instead. Codec reads already wait for the
+// previous read to be decoded, which is after its split completion.
+bool ExtMemSlot::m_isSplitBusy(TransferOp op, DmaCallback callback) const
+{
+	if (!callback || (m_numRegions < 2)) { return false; }
+	if (op == TransferOp::READ) {
+		return (m_codec == SampleCodec::PCM16) && (m_readCompletion.remaining > 0);
+	}
+	return m_writeCompletion.remaining > 0;
+}
+
+// Move a circular position forward by numWords, wrapping at the end of the slot
+size_t ExtMemSlot::m_advancePosition(size_t position, size_t numWords) const
+{
+	size_t offset = (position - m_start + sizeof(int16_t)*numWords) % m_size;
+	return m_start + offset;
+}
+
+// Transfer numWords starting at a circular position, wrapping around the end of the
+// slot when needed. Both halves of a wrapped transfer are one request so the callback
+// is only called once.
+size_t ExtMemSlot::m_circularTransfer(TransferOp op, size_t position, int16_t *buffer, size_t numWords,
+		DmaCallback callback, void *context)
+{
+	size_t numBytes = sizeof(int16_t)*numWords;
+	uint8_t *bytes = reinterpret_cast<uint8_t*>(buffer);
+
+	if (position + numBytes-1 <= m_end) {
+		// entire block fits in memory slot without wrapping
+		SpiGatherEntry entry = {position, bytes, numBytes};
+		m_transferSamples(op, &entry, 1, callback, context);
+	} else {
+		// the remaining bytes are at the start of the slot
+		size_t firstBytes = m_end - position + 1;
+		SpiGatherEntry parts[2] = {
+			{position, bytes, firstBytes},
+			{m_start, bytes ? bytes + m_bufferBytes(firstBytes) : nullptr, numBytes - firstBytes}
+		};
+		m_transferSamples(op, parts, 2, callback, context);
+	}
+	return m_advancePosition(position, numWords);
+}
+
+// Entry sizes stay in slot bytes, two for each sample, while the buffer holds four
+// bytes for each sample. Only the codec path reads the buffer, so m_wideSamples is
+// only needed while the transfer is issued.
+size_t ExtMemSlot::m_circularTransfer32(TransferOp op, size_t position, int32_t *buffer, size_t numSamples,
+		DmaCallback callback, void *context)
+{
+	m_wideSamples = true;
+	size_t nextPosition = m_circularTransfer(op, position, reinterpret_cast<int16_t*>(buffer), numSamples, callback, context);
+	m_wideSamples = false;
+	return nextPosition;
+}
+
+void ExtMemSlot::m_recordTokens(DmaToken *dest, const DmaToken *tokens)
+{
+	for (unsigned dev=0; dev < NUM_MEM_SLOTS; dev++) { dest[dev] = tokens[dev]; }
+}
+
+void ExtMemSlot::m_waitForTokens(const DmaToken *tokens) const
+{
+	if (!m_useDma || !m_spi) { return; }
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		BASpiMemoryDMA *spiDma = static_cast<BASpiMemoryDMA*>(m_device(dev));
+		SpiMemStats before = spiDma->getStats();
+		spiDma->waitFor(tokens[dev]);
+		m_chargeStats(dev, before);
+	}
+}
+
+bool ExtMemSlot::m_isDone(const DmaToken *tokens) const
+{
+	if (!m_useDma || !m_spi) { return true; }
+	for (unsigned dev=0; dev < m_numRegions; dev++) {
+		if (!(static_cast<BASpiMemoryDMA*>(m_device(dev)))->isDone(tokens[dev])) { return false; }
+	}
+	return true;
+}
+
+// Send the words collected by writeAdvance16(int16_t) to the memory. With DMA the
+// other buffer collects new words while this one is being sent.
+void ExtMemSlot::m_flushWordWrites()
+{
+	WordBuffer &buffer = m_wordWrite[m_wordWriteActive];
+	if (buffer.count == 0) { return; }
+
+	m_circularTransfer(TransferOp::WRITE, buffer.position, buffer.data, buffer.count, nullptr, nullptr);
+	m_recordTokens(buffer.tokens, m_writeTokens);
+	buffer.count = 0;
+	m_wordWriteActive ^= 0x1;
+}
+
+// Read-ahead never goes past the write cursor, since those words have not been
+// written yet. When the cursors are equal only one word is read at a time.
+size_t ExtMemSlot::m_readAheadLimit(size_t position) const
+{
+	size_t distanceBytes = (m_currentWrPosition + m_size - position) % m_size;
+	return (distanceBytes > 0) ? distanceBytes / sizeof(int16_t) : 1;
+}
+
+// Refill the read-ahead buffer for readAdvance16(). The next buffer is fetched in the
+// background while the current one is being consumed.
+void ExtMemSlot::m_refillWordReads()
+{
+	m_flushWordWrites(); // the cursor must see everything written through the cursor
+	size_t available = m_readAheadLimit(m_currentRdPosition);
+
+	WordBuffer &next = m_wordRead[m_wordReadActive ^ 0x1];
+	if (m_wordPrefetchPending && (next.count > 0) && (next.position == m_currentRdPosition)) {
+		m_waitForTokens(next.tokens);
+		m_wordReadActive ^= 0x1;
+	} else {
+		WordBuffer &buffer = m_wordRead[m_wordReadActive];
+		m_waitForTokens(buffer.tokens);
+		buffer.position = m_currentRdPosition;
+		buffer.count = min(WORD_BUFFER_WORDS, available);
+		m_circularTransfer(TransferOp::READ, buffer.position, buffer.data, buffer.count, nullptr, nullptr);
+		m_recordTokens(buffer.tokens, m_readTokens);
+		m_waitForTokens(buffer.tokens);
+	}
+	m_wordPrefetchPending = false;
+	m_wordReadIndex = 0;
+
+	WordBuffer &current = m_wordRead[m_wordReadActive];
+	if (m_useDma && (current.count < available)) {
+		WordBuffer &prefetch = m_wordRead[m_wordReadActive ^ 0x1];
+		m_waitForTokens(prefetch.tokens); // a dropped prefetch may still be arriving
+		prefetch.position = m_advancePosition(current.position, current.count);
+		prefetch.count = min(WORD_BUFFER_WORDS, available - current.count);
+		m_circularTransfer(TransferOp::READ, prefetch.position, prefetch.data, prefetch.count, nullptr, nullptr);
+		m_recordTokens(prefetch.tokens, m_readTokens);
+		m_wordPrefetchPending = true;
+	}
+}
+
+void ExtMemSlot::m_invalidateReadAhead()
+{
+	m_wordRead[m_wordReadActive].count = 0;
+	m_wordReadIndex = 0;
+	m_wordPrefetchPending = false;
+}
+
+// Forget any buffered words without writing them, used when the slot contents are replaced
+void ExtMemSlot::m_dropWordBuffers()
+{
+	m_wordWrite[m_wordWriteActive].count = 0;
+	m_invalidateReadAhead();
+}
+
+// Sample transfers use slot addresses. Slots without a codec store the samples
+// directly, otherwise the samples are encoded or decoded on the way.
+void ExtMemSlot::m_transferSamples(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
+{
+	if (m_codec == SampleCodec::PCM16) {
+		m_transfer(op, entries, numEntries, callback, context);
+	} else if (op == TransferOp::READ) {
+		m_codecRead(entries, numEntries, callback, context);
+	} else {
+		m_codecWrite(op, entries, numEntries, callback, context);
+	}
+}
+
+// Codecs encode whole frames, so writes must start and end on a frame boundary
+bool ExtMemSlot::m_isCodecAligned(size_t address, size_t numWords) const
+{
+	size_t frameSamples = codecFrameSamples(m_codec);
+	size_t firstSample = (address - m_start) / sizeof(int16_t);
+	return ((firstSample % frameSamples) == 0) && ((numWords % frameSamples) == 0);
+}
+
+// Reads the frames that cover each entry into the codec buffer. When everything fits in
+// the buffer the read is queued and decoded on completion, otherwise it is done in pieces,
+// waiting for each one.
+void ExtMemSlot::m_codecRead(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
+{
+	// the read buffer is shared, so the previous read must be decoded first
+	if (m_codecReadPending) { waitForRead(); }
+
+	size_t frameSamples = codecFrameSamples(m_codec);
+	size_t frameBytes = codecFrameBytes(m_codec);
+	SpiGatherEntry storage[MAX_CODEC_READ_PARTS];
+	size_t numParts = 0;
+	size_t bufferBytes = 0;
+
+	for (size_t i=0; i < numEntries; i++) {
+		size_t firstSample = (entries[i].address - m_start) / sizeof(int16_t);
+		size_t samplesRemaining = entries[i].numBytes / sizeof(int16_t);
+		uint8_t *dest = entries[i].dest;
+
+		while (samplesRemaining > 0) {
+			size_t maxFrames = (CODEC_BUFFER_BYTES - bufferBytes) / frameBytes;
+			if ((numParts == MAX_CODEC_READ_PARTS) || (maxFrames == 0)) {
+				// the buffer is full, decode what we have so far before continuing
+				m_codecIssueRead(storage, numParts, nullptr, nullptr);
+				waitForRead();
+				numParts = 0;
+				bufferBytes = 0;
+				continue;
+			}
+			size_t skipSamples = firstSample % frameSamples;
+			size_t numFrames = min(maxFrames, (skipSamples + samplesRemaining + frameSamples - 1) / frameSamples);
+			size_t numSamples = min(samplesRemaining, numFrames*frameSamples - skipSamples);
+
+			storage[numParts] = {m_storageStart + (firstSample / frameSamples)*frameBytes, m_codecBuffer + bufferBytes, numFrames*frameBytes};
+			m_codecReadParts[numParts] = {dest, m_wideSamples, bufferBytes, skipSamples, numSamples, numFrames};
+			numParts++;
+			bufferBytes += numFrames*frameBytes;
+
+			dest += m_bufferBytes(numSamples*sizeof(int16_t));
+			firstSample += numSamples;
+			samplesRemaining -= numSamples;
+		}
+	}
+	m_codecIssueRead(storage, numParts, callback, context);
 }
 
+void ExtMemSlot::m_codecIssueRead(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
+{
+	m_codecNumReadParts = numEntries;
+	m_codecReadCallback = callback;
+	m_codecReadContext = context;
+	m_codecReadPending = true;
+	m_transfer(TransferOp::READ, entries, numEntries, m_codecReadComplete, this);
 }
 
+// Split the frames in the read buffer into the channels, then pass the completion on
+void ExtMemSlot::m_frameReadComplete(void *context, DmaToken token)
+{
+	ExtMemSlot *slot = static_cast<ExtMemSlot*>(context);
+	const int16_t *readBuffer = slot->m_frameBuffers + 2*FRAME_BUFFER_FRAMES*slot->m_numChannels;
+	deinterleaveSamples(readBuffer, slot->m_frameReadDest, slot->m_numChannels, slot->m_frameReadFrames);
+
+	slot->m_frameReadPending = false;
+	if (slot->m_frameReadCallback) { slot->m_frameReadCallback(slot->m_frameReadContext, token); }
+}
+
+// Decode the frames in the read buffer into the destinations, then pass the completion on
+void ExtMemSlot::m_codecReadComplete(void *context, DmaToken token)
+{
+	ExtMemSlot *slot = static_cast<ExtMemSlot*>(context);
+	size_t frameSamples = codecFrameSamples(slot->m_codec);
+	size_t frameBytes = codecFrameBytes(slot->m_codec);
+
+	for (size_t i=0; i < slot->m_codecNumReadParts; i++) {
+		const CodecReadPart &part = slot->m_codecReadParts[i];
+		const uint8_t *src = slot->m_codecBuffer + part.bufferOffset;
+		if (part.wide) {
+			// only PACKED24 is read wide, its frames are single samples
+			decodePacked24(src, static_cast<int32_t*>(part.dest), part.numSamples);
+			continue;
+		}
+		int16_t *dest = static_cast<int16_t*>(part.dest);
+		size_t skipSamples = part.skipSamples;
+		size_t samplesRemaining = part.numSamples;
+
+		for (size_t frame=0; (frame < part.numFrames) && (samplesRemaining > 0); frame++) {
+			size_t numSamples = min(samplesRemaining, frameSamples - skipSamples);
+			if (numSamples == frameSamples) {
+				decodeSamples(slot->m_codec, src, dest, 1);
+			} else {
+				// only part of this frame is wanted
+				int16_t frameBuffer[MAX_CODEC_FRAME_SAMPLES];
+				decodeSamples(slot->m_codec, src, frameBuffer, 1);
+				memcpy(dest, frameBuffer + skipSamples, numSamples*sizeof(int16_t));
+			}
+			src += frameBytes;
+			dest += numSamples;
+			samplesRemaining -= numSamples;
+			skipSamples = 0;
+		}
+	}
+
+	slot->m_codecReadPending = false;
+	if (slot->m_codecReadCallback) { slot->m_codecReadCallback(slot->m_codecReadContext, token); }
+}
+
+// Encode each entry into the write buffer and send it to the memory. Zeros don't need
+// encoding since a zeroed frame decodes as silence.
+void ExtMemSlot::m_codecWrite(TransferOp op, const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
+{
+	size_t frameSamples = codecFrameSamples(m_codec);
+	size_t frameBytes = codecFrameBytes(m_codec);
+	uint8_t *writeBuffer = m_codecBuffer + CODEC_BUFFER_BYTES;
+	bool callbackIssued = false;
+
+	for (size_t i=0; i < numEntries; i++) {
+		size_t firstFrame = ((entries[i].address - m_start) / sizeof(int16_t)) / frameSamples;
+		size_t framesRemaining = (entries[i].numBytes / sizeof(int16_t)) / frameSamples;
+		const uint8_t *src = entries[i].dest;
+
+		while (framesRemaining > 0) {
+			size_t numFrames = (op == TransferOp::ZERO) ? framesRemaining : min(framesRemaining, CODEC_BUFFER_BYTES / frameBytes);
+			bool last = (i == numEntries-1) && (numFrames == framesRemaining);
+			SpiGatherEntry storage = {m_storageStart + firstFrame*frameBytes, nullptr, numFrames*frameBytes};
+
+			if (op == TransferOp::WRITE) {
+				// wait until the last write from the buffer has finished with it
+				m_waitForTokens(m_codecWriteTokens);
+				if (m_wideSamples) {
+					encodePacked24(reinterpret_cast<const int32_t*>(src), writeBuffer, numFrames);
+				} else {
+					encodeSamples(m_codec, reinterpret_cast<const int16_t*>(src), writeBuffer, numFrames, m_adpcmState);
+				}
+				storage.dest = writeBuffer;
+				src += m_bufferBytes(numFrames*frameSamples*sizeof(int16_t));
+			}
+			m_transfer(op, &storage, 1, last ? callback : nullptr, context);
+			if (op == TransferOp::WRITE) { m_recordTokens(m_codecWriteTokens, m_writeTokens); }
+			callbackIssued |= last;
+
+			firstFrame += numFrames;
+			framesRemaining -= numFrames;
+		}
+	}
+	if (!callbackIssued && callback) { callback(context, DMA_TOKEN_NONE); }
+}
+
+void ExtMemSlot::m_spiRead16(size_t address, int16_t *dest, size_t numWords, DmaCallback callback, void *context)
+{
+	SpiGatherEntry entry = {address, reinterpret_cast<uint8_t*>(dest), sizeof(int16_t)*numWords};
+	m_transferSamples(TransferOp::READ, &entry, 1, callback, context);
+}
+
+void ExtMemSlot::m_spiReadGather(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context)
+{
+	m_transferSamples(TransferOp::READ, entries, numEntries, callback, context);
+}
+
+void ExtMemSlot::m_spiWrite16(size_t address, int16_t *src, size_t numWords, DmaCallback callback, void *context)
+{
+	SpiGatherEntry entry = {address, reinterpret_cast<uint8_t*>(src), sizeof(int16_t)*numWords};
+	m_transferSamples(TransferOp::WRITE, &entry, 1, callback, context);
+}
+
+void ExtMemSlot::m_spiZero16(size_t address, size_t numWords, DmaCallback callback, void *context)
+{
+	SpiGatherEntry entry = {address, nullptr, sizeof(int16_t)*numWords};
+	m_transferSamples(TransferOp::ZERO, &entry, 1, callback, context);
+}
+
+}
@@ -30,21 +30,30 @@ namespace BAGuitar {
 /////////////////////////////////////////////////////////////////////////////
 bool ExternalSramManager::m_configured = false;
 MemConfig ExternalSramManager::m_memConfig[BAGuitar::NUM_MEM_SLOTS];
+unsigned ExternalSramManager::m_numManagers = 0;
+constexpr size_t ExternalSramManager::COPY_BUFFER_BYTES;
+constexpr size_t ExternalSramManager::DEFAULT_COPY_BYTES_PER_SERVICE;
+constexpr size_t ExternalSramManager::MAX_COPY_JOBS;
+constexpr unsigned ExternalSramManager::NUM_COPY_BUFFERS;
 
+// slots that request alignment are sized and placed in multiples of an audio block
+constexpr size_t SLOT_BLOCK_ALIGNMENT = sizeof(int16_t)*AUDIO_BLOCK_SAMPLES;
 
 ExternalSramManager::ExternalSramManager(unsigned numMemories)
 {
 	// Initialize the static memory configuration structs
 	if (!m_configured) {
 		for (unsigned i=0; i < NUM_MEM_SLOTS; i++) {
-			m_memConfig[i].size           = MEM_MAX_ADDR[i];
-			m_memConfig[i].totalAvailable = MEM_MAX_ADDR[i];
-			m_memConfig[i].nextAvailable  = 0;
+			m_memConfig[i].size           = MEM_MAX_ADDR[i]+1; // MEM_MAX_ADDR is the last valid address
+			m_memConfig[i].totalAvailable = m_memConfig[i].size;
+			m_memConfig[i].freeRegions[0] = {0, m_memConfig[i].size};
+			m_memConfig[i].numFreeRegions = 1;
 
 			m_memConfig[i].m_spi = nullptr;
 		}
 		m_configured = true;
 	}
+	m_numManagers++;
 }
 
 ExternalSramManager::ExternalSramManager()
@@ -55,55 +64,96 @@ ExternalSramManager::ExternalSramManager()
 
 ExternalSramManager::~ExternalSramManager()
 {
+	// Slots can outlive the manager. Take back their memory, or at least detach them
+	// if the free list is full, so they don't keep a pointer to this manager.
+	while (m_ownedSlots) {
+		ExtMemSlot *slot = m_ownedSlots;
+		if (!releaseMemory(slot)) { m_detachSlot(slot); }
+	}
+	if (m_copyMemory) delete [] m_copyMemory;
+
+	// the interfaces are shared by all managers, the last one deletes them
+	if (--m_numManagers > 0) { return; }
 	for (unsigned i=0; i < NUM_MEM_SLOTS; i++) {
 		if (m_memConfig[i].m_spi) { delete m_memConfig[i].m_spi; }
+		m_memConfig[i].m_spi = nullptr;
 	}
 }
 
+size_t ExternalSramManager::detectMemory(BAGuitar::MemSelect mem, bool useDma)
+{
+	if (!m_getSpi(mem, useDma)) { return 0; }
+	return m_memConfig[mem].size;
+}
+
 size_t ExternalSramManager::availableMemory(BAGuitar::MemSelect mem)
 {
 	return m_memConfig[mem].totalAvailable;
 }
 
-bool ExternalSramManager::requestMemory(ExtMemSlot *slot, float delayMilliseconds, BAGuitar::MemSelect mem, bool useDma)
+size_t ExternalSramManager::largestAvailable(BAGuitar::MemSelect mem)
+{
+	size_t largest = 0;
+	for (size_t i=0; i < m_memConfig[mem].numFreeRegions; i++) {
+		if (m_memConfig[mem].freeRegions[i].size > largest) { largest = m_memConfig[mem].freeRegions[i].size; }
+	}
+	return largest;
+}
+
+bool ExternalSramManager::requestMemory(ExtMemSlot *slot, float delayMilliseconds, BAGuitar::MemSelect mem, bool useDma, bool blockAlign,
+		SampleCodec codec)
 {
 	// convert the time to numer of samples
 	size_t delayLengthInt = (size_t)((delayMilliseconds*(AUDIO_SAMPLE_RATE_EXACT/1000.0f))+0.5f);
-	return requestMemory(slot, delayLengthInt * sizeof(int16_t), mem, useDma);
+	return requestMemory(slot, delayLengthInt * sizeof(int16_t), mem, useDma, blockAlign, codec);
 }
 
-bool ExternalSramManager::requestMemory(ExtMemSlot *slot, size_t sizeBytes, BAGuitar::MemSelect mem, bool useDma)
+bool ExternalSramManager::requestMemory(ExtMemSlot *slot, size_t sizeBytes, BAGuitar::MemSelect mem, bool useDma, bool blockAlign,
+		SampleCodec codec)
 {
+	if (!slot || (sizeBytes == 0)) { return false; }
+
+	// a slot being reconfigured gives back its old memory first
+	if (slot->m_valid) { slot->release(); }
+
+	// the memory size is known once the interface has started
+	if (!m_getSpi(mem, useDma)) { return false; }
+
+	size_t alignment = 1;
+	if (blockAlign) {
+		sizeBytes = ((sizeBytes + SLOT_BLOCK_ALIGNMENT - 1) / SLOT_BLOCK_ALIGNMENT) * SLOT_BLOCK_ALIGNMENT;
+		// encoded blocks aren't a power of two in size, so only uncompressed slots are placed on block boundaries
+		if (codec == SampleCodec::PCM16) { alignment = SLOT_BLOCK_ALIGNMENT; }
+	}
+	size_t storageBytes = m_storageBytes(codec, sizeBytes);
 
-	if (m_memConfig[mem].totalAvailable >= sizeBytes) {
+	size_t start;
+	if (m_allocate(mem, storageBytes, alignment, start)) {
 		Serial.println(String("Configuring a slot for mem ") + mem);
 		// there is enough available memory for this request
-		slot->m_start = m_memConfig[mem].nextAvailable;
-		slot->m_end   = slot->m_start + sizeBytes -1;
-		slot->m_currentWrPosition = slot->m_start; // init to start of slot
-		slot->m_currentRdPosition = slot->m_start; // init to start of slot
-		slot->m_size = sizeBytes;
-
-		if (!m_memConfig[mem].m_spi) {
-		    if (useDma) {
-		        m_memConfig[mem].m_spi = new BAGuitar::BASpiMemoryDMA(static_cast<BAGuitar::SpiDeviceId>(mem));
-		        slot->m_useDma = true;
-		    } else {
-		        m_memConfig[mem].m_spi = new BAGuitar::BASpiMemory(static_cast<BAGuitar::SpiDeviceId>(mem));
-		        slot->m_useDma = false;
-		    }
-			if (!m_memConfig[mem].m_spi) {
-			} else {
-				Serial.println("Calling spi begin()");
-				m_memConfig[mem].m_spi->begin();
-			}
+		if (!m_configureStorage(slot, codec, start, storageBytes)) {
+			m_free(mem, start, storageBytes);
+			return false;
 		}
-		slot->m_spi = m_memConfig[mem].m_spi;
+		slot->m_spiId = static_cast<BAGuitar::SpiDeviceId>(mem);
+		slot->m_manager = this;
+		slot->m_layout = ExtMemSlot::Layout::SINGLE;
+		slot->m_numRegions = 1;
+		slot->m_regions[0] = {start, storageBytes};
+		slot->m_regionMem[0] = mem;
+
+		slot->m_spi = m_getSpi(mem, useDma);
+		slot->m_spiSecondary = nullptr;
+		slot->m_useDma = m_memConfig[mem].useDma; // slots share the interface, so use whatever it was created as
 
-		// Update the mem config
-		m_memConfig[mem].nextAvailable   = slot->m_end+1;
-		m_memConfig[mem].totalAvailable -= sizeBytes;
 		slot->m_valid = true;
+		slot->m_nextOwned = m_ownedSlots;
+		m_ownedSlots = slot;
+		slot->snapshotStats(); // start the slot's traffic counters from zero
+		if (!m_configureStaging(slot)) {
+			releaseMemory(slot);
+			return false;
+		}
 		if (!slot->isEnabled()) { slot->enable(); }
 		Serial.println("Clear the memory\n"); Serial.flush();
 		slot->clear();
@@ -116,5 +166,557 @@ bool ExternalSramManager::requestMemory(ExtMemSlot *slot, size_t sizeBytes, BAGu
 	}
 }
 
+bool ExternalSramManager::requestStripedMemory(ExtMemSlot *slot, float delayMilliseconds, bool useDma, SampleCodec codec)
+{
+	// convert the time to numer of samples
+	size_t delayLengthInt = (size_t)((delayMilliseconds*(AUDIO_SAMPLE_RATE_EXACT/1000.0f))+0.5f);
+	return requestStripedMemory(slot, delayLengthInt * sizeof(int16_t), useDma, codec);
+}
+
+bool ExternalSramManager::requestStripedMemory(ExtMemSlot *slot, size_t sizeBytes, bool useDma, SampleCodec codec)
+{
+	if (!slot || (sizeBytes == 0)) { return false; }
+
+	// a slot being reconfigured gives back its old memory first
+	if (slot->m_valid) { slot->release(); }
+
+	if (!m_getSpi(MemSelect::MEM0, useDma) || !m_getSpi(MemSelect::MEM1, useDma)) { return false; }
+
+	// a whole number of audio blocks keeps the stripes evenly split between the memories
+	size_t storageBytes = m_storageBytes(codec, sizeBytes);
+	storageBytes = ((storageBytes + SLOT_BLOCK_ALIGNMENT - 1) / SLOT_BLOCK_ALIGNMENT) * SLOT_BLOCK_ALIGNMENT;
+	size_t regionSize = storageBytes / 2;
+
+	size_t start0, start1;
+	if (!m_allocate(MemSelect::MEM0, regionSize, 1, start0)) { return false; }
+	if (!m_allocate(MemSelect::MEM1, regionSize, 1, start1)) {
+		m_free(MemSelect::MEM0, start0, regionSize);
+		return false;
+	}
+
+	return m_configureDualSlot(slot, ExtMemSlot::Layout::STRIPED, codec, start0, regionSize, start1, regionSize, useDma);
+}
+
+bool ExternalSramManager::requestConcatenatedMemory(ExtMemSlot *slot, float delayMilliseconds, bool useDma, SampleCodec codec)
+{
+	// convert the time to numer of samples
+	size_t delayLengthInt = (size_t)((delayMilliseconds*(AUDIO_SAMPLE_RATE_EXACT/1000.0f))+0.5f);
+	return requestConcatenatedMemory(slot, delayLengthInt * sizeof(int16_t), useDma, codec);
+}
+
+bool ExternalSramManager::requestConcatenatedMemory(ExtMemSlot *slot, size_t sizeBytes, bool useDma, SampleCodec codec)
+{
+	if (!slot || (sizeBytes == 0)) { return false; }
+
+	// a slot being reconfigured gives back its old memory first
+	if (slot->m_valid) { slot->release(); }
+
+	if (!m_getSpi(MemSelect::MEM0, useDma) || !m_getSpi(MemSelect::MEM1, useDma)) { return false; }
+
+	size_t storageBytes = m_storageBytes(codec, sizeBytes);
+
+	// use as much of MEM0 as possible, the rest comes from MEM1. The MEM0 part is kept
+	// to whole audio blocks so block aligned transfers don't straddle the two memories.
+	size_t size0 = min(storageBytes, largestAvailable(MemSelect::MEM0));
+	if (size0 == storageBytes) {
+		return requestMemory(slot, sizeBytes, MemSelect::MEM0, useDma, false, codec);
+	}
+	size0 = (size0 / SLOT_BLOCK_ALIGNMENT) * SLOT_BLOCK_ALIGNMENT;
+	size_t size1 = storageBytes - size0;
+	if (size0 == 0) {
+		return requestMemory(slot, sizeBytes, MemSelect::MEM1, useDma, false, codec);
+	}
+
+	size_t start0, start1;
+	if (!m_allocate(MemSelect::MEM0, size0, 1, start0)) { return false; }
+	if (!m_allocate(MemSelect::MEM1, size1, 1, start1)) {
+		m_free(MemSelect::MEM0, start0, size0);
+		return false;
+	}
+
+	return m_configureDualSlot(slot, ExtMemSlot::Layout::CONCATENATED, codec, start0, size0, start1, size1, useDma);
+}
+
+bool ExternalSramManager::releaseMemory(ExtMemSlot *slot)
+{
+	if (!slot || !slot->m_valid || (slot->m_manager != this)) { return false; }
+
+	// Regions that don't touch a free neighbour need a free list entry. Check there is room
+	// for all of them first, so a failure leaves the slot holding all of its memory.
+	size_t entriesNeeded[NUM_MEM_SLOTS] = {0, 0};
+	for (unsigned i=0; i < slot->m_numRegions; i++) {
+		bool mergePrev, mergeNext;
+		m_findFreeIndex(m_memConfig[slot->m_regionMem[i]], slot->m_regions[i].start, slot->m_regions[i].size, mergePrev, mergeNext);
+		if (!mergePrev && !mergeNext) { entriesNeeded[slot->m_regionMem[i]]++; }
+	}
+	for (unsigned mem=0; mem < NUM_MEM_SLOTS; mem++) {
+		if (m_memConfig[mem].numFreeRegions + entriesNeeded[mem] > MAX_FREE_REGIONS) {
+			Serial.println("releaseMemory(): too many free regions, memory not released");
+			return false;
+		}
+	}
+
+	for (unsigned i=0; i < slot->m_numRegions; i++) {
+		m_free(slot->m_regionMem[i], slot->m_regions[i].start, slot->m_regions[i].size);
+	}
+	m_detachSlot(slot);
+	return true;
+}
+
+// Stops the slot's transfers and returns it to the unconfigured state, without freeing its memory
+void ExternalSramManager::m_detachSlot(ExtMemSlot *slot)
+{
+	// make sure nothing is still transferring to or from the memory we're giving back
+	m_cancelCopies(slot);
+	slot->m_dropWordBuffers();
+	slot->waitForRead();
+	slot->waitForWrite();
+	m_retireCopyBuffers(slot);
+
+	if (slot->m_codecBuffer) {
+		delete [] slot->m_codecBuffer;
+		slot->m_codecBuffer = nullptr;
+	}
+	if (slot->m_staging) {
+		delete [] slot->m_staging;
+		slot->m_staging = nullptr;
+	}
+	if (slot->m_frameBuffers) {
+		delete [] slot->m_frameBuffers;
+		slot->m_frameBuffers = nullptr;
+	}
+	slot->m_numChannels = 1;
+	slot->m_valid = false;
+	slot->m_spi = nullptr; // the interfaces are deleted with the last manager
+	slot->m_spiSecondary = nullptr;
+	slot->m_manager = nullptr;
+
+	for (ExtMemSlot **link = &m_ownedSlots; *link; link = &(*link)->m_nextOwned) {
+		if (*link == slot) {
+			*link = slot->m_nextOwned;
+			break;
+		}
+	}
+	slot->m_nextOwned = nullptr;
+}
+
+bool ExternalSramManager::requestCopy(ExtMemSlot *dest, size_t destOffsetWords, ExtMemSlot *src, size_t srcOffsetWords,
+		size_t numWords, DmaCallback callback, void *context)
+{
+	if (!src || !src->m_valid || (src->m_manager != this) || (src->m_codec != SampleCodec::PCM16)) { return false; }
+	if (sizeof(int16_t)*(srcOffsetWords + numWords) > src->m_size) { return false; }
+
+	CopyJob job;
+	job.src = src;
+	job.srcOffsetWords = srcOffsetWords;
+	job.dest = dest;
+	job.destOffsetWords = destOffsetWords;
+	job.numWords = numWords;
+	// when the destination overlaps the end of the source, the end has to be copied first
+	job.backward = (src == dest) && (destOffsetWords > srcOffsetWords);
+	job.callback = callback;
+	job.context = context;
+	return m_queueCopy(job);
+}
+
+bool ExternalSramManager::requestFill(ExtMemSlot *dest, size_t destOffsetWords, size_t numWords, int16_t value,
+		DmaCallback callback, void *context)
+{
+	CopyJob job;
+	job.dest = dest;
+	job.destOffsetWords = destOffsetWords;
+	job.numWords = numWords;
+	job.value = value;
+	job.callback = callback;
+	job.context = context;
+	return m_queueCopy(job);
+}
+
+// Each pass retires the buffers whose transfers have finished, writes out the ones whose
+// reads have landed, and starts a new piece in a free buffer while the budget lasts. A
+// request is finished once all of it has been written, then the next one starts. With
+// blocking slots every transfer is done on return, so this keeps going until the budget
+// is used up.
+void ExternalSramManager::serviceCopies()
+{
+	if (!m_copyMemory) { return; }
+	size_t budgetWords = m_copyBytesPerService / sizeof(int16_t);
+
+	bool progress = true;
+	while (progress) {
+		progress = false;
+		bool buffersIdle = true;
+		for (unsigned i=0; i < NUM_COPY_BUFFERS; i++) {
+			CopyBuffer &buffer = m_copyBuffers[i];
+			if (buffer.state == CopyState::IDLE) { continue; }
+			if (!buffer.slot->m_isDone(buffer.tokens)) {
+				buffersIdle = false;
+				continue;
+			}
+			if ((buffer.state == CopyState::READING) && !buffer.discard) {
+				m_copyWrite(buffer);
+				buffersIdle = false;
+			} else {
+				buffer.state = CopyState::IDLE;
+			}
+			progress = true;
+		}
+
+		if (m_numCopyJobs == 0) { break; }
+		CopyJob &job = m_copyJobs[m_copyJobHead];
+		if (job.doneWords < job.numWords) {
+			if (budgetWords == 0) { continue; }
+			for (unsigned i=0; i < NUM_COPY_BUFFERS; i++) {
+				if (m_copyBuffers[i].state != CopyState::IDLE) { continue; }
+				size_t numWords = min(min(COPY_BUFFER_BYTES / sizeof(int16_t), job.numWords - job.doneWords), budgetWords);
+				m_copyStart(job, m_copyBuffers[i], numWords);
+				budgetWords -= numWords;
+				progress = true;
+				break;
+			}
+		} else if (buffersIdle) {
+			// everything has been written
+			DmaCallback callback = job.callback;
+			void *context = job.context;
+			__disable_irq();
+			m_copyJobHead = (m_copyJobHead + 1) % MAX_COPY_JOBS;
+			m_numCopyJobs--;
+			__enable_irq();
+			if (callback) { callback(context, DMA_TOKEN_NONE); }
+			progress = true;
+		}
+	}
+}
+
+void ExternalSramManager::setCopyBandwidth(size_t bytesPerService)
+{
+	m_copyBytesPerService = max(bytesPerService & ~static_cast<size_t>(0x1), sizeof(int16_t));
+}
+
+/////////////////////////////////////////////////////////////////////////////
+// PRIVATE METHODS
+/////////////////////////////////////////////////////////////////////////////
+// Get the SPI interface for a memory, creating it the first time it is used. Once
+// created the interface keeps its transfer mode, later requests share it.
+BASpiMemory *ExternalSramManager::m_getSpi(BAGuitar::MemSelect mem, bool useDma)
+{
+	if (!m_memConfig[mem].m_spi) {
+		if (useDma) {
+			m_memConfig[mem].m_spi = new BAGuitar::BASpiMemoryDMA(static_cast<BAGuitar::SpiDeviceId>(mem));
+			m_memConfig[mem].useDma = true;
+		} else {
+			m_memConfig[mem].m_spi = new BAGuitar::BASpiMemory(static_cast<BAGuitar::SpiDeviceId>(mem));
+			m_memConfig[mem].useDma = false;
+		}
+		if (m_memConfig[mem].m_spi) {
+			Serial.println("Calling spi begin()");
+			m_memConfig[mem].m_spi->begin();
+			m_setSize(mem, m_memConfig[mem].m_spi->getSize());
+		}
+	}
+	return m_memConfig[mem].m_spi;
+}
+
+// Replace the default size of a memory with the size detected when its interface
+// started. Nothing can have been allocated from it before then.
+void ExternalSramManager::m_setSize(BAGuitar::MemSelect mem, size_t sizeBytes)
+{
+	MemConfig &config = m_memConfig[mem];
+	if ((sizeBytes == config.size) || (config.totalAvailable != config.size)) { return; }
+
+	Serial.println(String("ExternalSramManager: mem ") + mem + String(" is ") + sizeBytes + String(" bytes"));
+	config.size = sizeBytes;
+	config.totalAvailable = sizeBytes;
+	config.freeRegions[0] = {0, sizeBytes};
+	config.numFreeRegions = (sizeBytes > 0) ? 1 : 0;
+}
+
+// Finish setting up a slot that uses a region in each memory. The regions have already
+// been allocated, they are given back if the SPI interfaces can't be used together.
+bool ExternalSramManager::m_configureDualSlot(ExtMemSlot *slot, ExtMemSlot::Layout layout, SampleCodec codec,
+		size_t start0, size_t size0, size_t start1, size_t size1, bool useDma)
+{
+	BASpiMemory *spi0 = m_getSpi(MemSelect::MEM0, useDma);
+	BASpiMemory *spi1 = m_getSpi(MemSelect::MEM1, useDma);
+	if (!spi0 || !spi1 || (m_memConfig[MemSelect::MEM0].useDma != m_memConfig[MemSelect::MEM1].useDma)) {
+		Serial.println("ExternalSramManager: MEM0 and MEM1 must both use DMA or both be blocking");
+		m_free(MemSelect::MEM0, start0, size0);
+		m_free(MemSelect::MEM1, start1, size1);
+		return false;
+	}
+
+	// multi-region slot addresses are relative to the slot, the regions hold the physical locations
+	if (!m_configureStorage(slot, codec, 0, size0 + size1)) {
+		m_free(MemSelect::MEM0, start0, size0);
+		m_free(MemSelect::MEM1, start1, size1);
+		return false;
+	}
+	slot->m_spiId = SpiDeviceId::SPI_DEVICE0;
+	slot->m_manager = this;
+	slot->m_layout = layout;
+	slot->m_numRegions = 2;
+	slot->m_regions[0] = {start0, size0};
+	slot->m_regions[1] = {start1, size1};
+	slot->m_regionMem[0] = MemSelect::MEM0;
+	slot->m_regionMem[1] = MemSelect::MEM1;
+	slot->m_spi = spi0;
+	slot->m_spiSecondary = spi1;
+	slot->m_useDma = m_memConfig[MemSelect::MEM0].useDma;
+
+	slot->m_valid = true;
+	slot->m_nextOwned = m_ownedSlots;
+	m_ownedSlots = slot;
+	slot->snapshotStats(); // start the slot's traffic counters from zero
+	if (!m_configureStaging(slot)) {
+		releaseMemory(slot);
+		return false;
+	}
+	if (!slot->isEnabled()) { slot->enable(); }
+	slot->clear();
+	return true;
+}
+
+// DMA slots storing plain samples get staging buffers for writeAdvance16Copy(). They are
+// allocated here rather than on first use, which is usually from the audio interrupt.
+bool ExternalSramManager::m_configureStaging(ExtMemSlot *slot)
+{
+	if (!slot->m_useDma || (slot->m_codec != SampleCodec::PCM16)) { return true; }
+	if (!slot->m_staging) {
+		slot->m_staging = new ExtMemSlot::StagingBuffer[ExtMemSlot::STAGING_BUFFERS];
+		if (!slot->m_staging) { return false; }
+	}
+	slot->m_stagingNext = 0;
+	return true;
+}
+
+// Check a copy or fill and add it to the queue. The queue is shared with serviceCopies(),
+// which may be running from the audio interrupt.
+bool ExternalSramManager::m_queueCopy(const CopyJob &job)
+{
+	ExtMemSlot *dest = job.dest;
+	if (!dest || !dest->m_valid || (dest->m_manager != this) || (dest->m_codec != SampleCodec::PCM16)) { return false; }
+	if ((job.numWords == 0) || (sizeof(int16_t)*(job.destOffsetWords + job.numWords) > dest->m_size)) { return false; }
+
+	if (!m_copyMemory) {
+		m_copyMemory = new int16_t[NUM_COPY_BUFFERS*COPY_BUFFER_BYTES/sizeof(int16_t)];
+		if (!m_copyMemory) { return false; }
+		for (unsigned i=0; i < NUM_COPY_BUFFERS; i++) {
+			m_copyBuffers[i].data = m_copyMemory + i*COPY_BUFFER_BYTES/sizeof(int16_t);
+		}
+	}
+
+	bool queued = false;
+	__disable_irq();
+	if (m_numCopyJobs < MAX_COPY_JOBS) {
+		m_copyJobs[(m_copyJobHead + m_numCopyJobs) % MAX_COPY_JOBS] = job;
+		m_numCopyJobs++;
+		queued = true;
+	}
+	__enable_irq();
+	return queued;
+}
+
+// Hand the next piece of a request to a bounce buffer. Copies read into it first,
+// fills go straight to writing.
+void ExternalSramManager::m_copyStart(CopyJob &job, CopyBuffer &buffer, size_t numWords)
+{
+	size_t offsetWords = job.backward ? (job.numWords - job.doneWords - numWords) : job.doneWords;
+	job.doneWords += numWords;
+
+	buffer.dest = job.dest;
+	buffer.destOffsetWords = job.destOffsetWords + offsetWords;
+	buffer.numWords = numWords;
+	buffer.isFill = !job.src;
+	buffer.value = job.value;
+	buffer.discard = false;
+
+	if (buffer.isFill) {
+		m_copyWrite(buffer);
+		return;
+	}
+	ExtMemSlot *src = job.src;
+	src->m_backgroundPriority = true;
+	src->read16(job.srcOffsetWords + offsetWords, buffer.data, numWords);
+	src->m_backgroundPriority = false;
+	src->m_recordTokens(buffer.tokens, src->m_readTokens);
+	buffer.slot = src;
+	buffer.state = CopyState::READING;
+}
+
+void ExternalSramManager::m_copyWrite(CopyBuffer &buffer)
+{
+	ExtMemSlot *dest = buffer.dest;
+	dest->m_backgroundPriority = true;
+	if (buffer.isFill && (buffer.value == 0)) {
+		dest->zero16(buffer.destOffsetWords, buffer.numWords);
+	} else {
+		if (buffer.isFill) {
+			for (size_t i=0; i < buffer.numWords; i++) { buffer.data[i] = buffer.value; }
+		}
+		dest->write16(buffer.destOffsetWords, buffer.data, buffer.numWords);
+	}
+	dest->m_backgroundPriority = false;
+	dest->m_recordTokens(buffer.tokens, dest->m_writeTokens);
+	buffer.slot = dest;
+	buffer.state = CopyState::WRITING;
+}
+
+// Remove the requests that use a slot being released. Reads already issued for the
+// request in progress are dropped when they land.
+void ExternalSramManager::m_cancelCopies(ExtMemSlot *slot)
+{
+	__disable_irq();
+	size_t numKept = 0;
+	for (size_t i=0; i < m_numCopyJobs; i++) {
+		CopyJob &job = m_copyJobs[(m_copyJobHead + i) % MAX_COPY_JOBS];
+		if ((job.src == slot) || (job.dest == slot)) {
+			if (i == 0) {
+				for (unsigned b=0; b < NUM_COPY_BUFFERS; b++) { m_copyBuffers[b].discard = true; }
+			}
+			continue;
+		}
+		m_copyJobs[(m_copyJobHead + numKept) % MAX_COPY_JOBS] = job;
+		numKept++;
+	}
+	m_numCopyJobs = numKept;
+	__enable_irq();
+}
+
+// Once the slot's transfers have finished, the buffers waiting on them are free
+void ExternalSramManager::m_retireCopyBuffers(ExtMemSlot *slot)
+{
+	__disable_irq();
+	for (unsigned i=0; i < NUM_COPY_BUFFERS; i++) {
+		if (m_copyBuffers[i].slot == slot) {
+			m_copyBuffers[i].state = CopyState::IDLE;
+			m_copyBuffers[i].slot = nullptr;
+		}
+	}
+	__enable_irq();
+}
+
+// The number of bytes of memory needed for sizeBytes of 16-bit samples
+size_t ExternalSramManager::m_storageBytes(SampleCodec codec, size_t sizeBytes)
+{
+	if (codec == SampleCodec::PCM16) { return sizeBytes; }
+	return codecStorageBytes(codec, (sizeBytes + sizeof(int16_t) - 1) / sizeof(int16_t));
+}
+
+// Set up the slot address space over its storage. Uncompressed slots in a single memory
+// use the physical addresses directly, the others start at zero and are translated when
+// transferred.
+bool ExternalSramManager::m_configureStorage(ExtMemSlot *slot, SampleCodec codec, size_t storageStart, size_t storageBytes)
+{
+	if ((codec != SampleCodec::PCM16) && !slot->m_codecBuffer) {
+		slot->m_codecBuffer = new uint8_t[2*ExtMemSlot::CODEC_BUFFER_BYTES];
+		if (!slot->m_codecBuffer) { return false; }
+	}
+
+	slot->m_codec = codec;
+	slot->m_adpcmState = AdpcmState();
+	slot->m_codecReadPending = false;
+	slot->m_storageStart = storageStart;
+	slot->m_storageEnd = storageStart + storageBytes - 1;
+
+	if (codec == SampleCodec::PCM16) {
+		slot->m_start = storageStart;
+		slot->m_size = storageBytes;
+	} else {
+		slot->m_start = 0;
+		slot->m_size = (storageBytes / codecFrameBytes(codec)) * codecFrameSamples(codec) * sizeof(int16_t);
+	}
+	slot->m_end = slot->m_start + slot->m_size - 1;
+	slot->m_currentWrPosition = slot->m_start; // init to start of slot
+	slot->m_currentRdPosition = slot->m_start; // init to start of slot
+	return true;
+}
+
+// First-fit search through the address ordered free list.
+bool ExternalSramManager::m_allocate(BAGuitar::MemSelect mem, size_t sizeBytes, size_t alignment, size_t &start)
+{
+	MemConfig &config = m_memConfig[mem];
+
+	for (size_t i=0; i < config.numFreeRegions; i++) {
+		MemRegion region = config.freeRegions[i];
+		size_t alignedStart = ((region.start + alignment - 1) / alignment) * alignment;
+		size_t padding = alignedStart - region.start;
+		if (region.size < padding + sizeBytes) { continue; }
+
+		size_t remaining = region.size - padding - sizeBytes;
+		if ((padding > 0) && (remaining > 0)) {
+			// the allocation splits the region in two, make sure there is room for both halves
+			if (!m_insertFreeRegion(config, i+1, {alignedStart + sizeBytes, remaining})) { continue; }
+			config.freeRegions[i].size = padding;
+		} else if (padding > 0) {
+			config.freeRegions[i].size = padding;
+		} else if (remaining > 0) {
+			config.freeRegions[i] = {alignedStart + sizeBytes, remaining};
+		} else {
+			m_removeFreeRegion(config, i);
+		}
+
+		config.totalAvailable -= sizeBytes;
+		start = alignedStart;
+		return true;
+	}
+	return false;
+}
+
+// Return a region to the free list, merging it with its neighbours when they touch.
+bool ExternalSramManager::m_free(BAGuitar::MemSelect mem, size_t start, size_t sizeBytes)
+{
+	MemConfig &config = m_memConfig[mem];
+	bool mergePrev, mergeNext;
+	size_t idx = m_findFreeIndex(config, start, sizeBytes, mergePrev, mergeNext);
+
+	if (mergePrev && mergeNext) {
+		config.freeRegions[idx-1].size += sizeBytes + config.freeRegions[idx].size;
+		m_removeFreeRegion(config, idx);
+	} else if (mergePrev) {
+		config.freeRegions[idx-1].size += sizeBytes;
+	} else if (mergeNext) {
+		config.freeRegions[idx].start = start;
+		config.freeRegions[idx].size += sizeBytes;
+	} else if (!m_insertFreeRegion(config, idx, {start, sizeBytes})) {
+		return false;
+	}
+
+	config.totalAvailable += sizeBytes;
+	return true;
+}
+
+// Find the first free region after the one being released, and whether the released
+// region touches the free regions either side of it.
+size_t ExternalSramManager::m_findFreeIndex(const MemConfig &config, size_t start, size_t sizeBytes, bool &mergePrev, bool &mergeNext)
+{
+	size_t idx = 0;
+	while ((idx < config.numFreeRegions) && (config.freeRegions[idx].start < start)) { idx++; }
+
+	mergePrev = (idx > 0) &&
+			(config.freeRegions[idx-1].start + config.freeRegions[idx-1].size == start);
+	mergeNext = (idx < config.numFreeRegions) &&
+			(start + sizeBytes == config.freeRegions[idx].start);
+	return idx;
+}
+
+bool ExternalSramManager::m_insertFreeRegion(MemConfig &config, size_t index, MemRegion region)
+{
+	if (config.numFreeRegions >= MAX_FREE_REGIONS) { return false; }
+	for (size_t i=config.numFreeRegions; i > index; i--) {
+		config.freeRegions[i] = config.freeRegions[i-1];
+	}
+	config.freeRegions[index] = region;
+	config.numFreeRegions++;
+	return true;
+}
+
+void ExternalSramManager::m_removeFreeRegion(MemConfig &config, size_t index)
+{
+	for (size_t i=index; i < config.numFreeRegions-1; i++) {
+		config.freeRegions[i] = config.freeRegions[i+1];
+	}
+	config.numFreeRegions--;
+}
+
 }
 
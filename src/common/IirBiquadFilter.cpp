@@ -20,6 +20,7 @@
 
 #include "Audio.h"
 #include "LibBasicFunctions.h"
+#include "LibKernelProfile.h"
 
 namespace BAGuitar {
 
@@ -70,6 +71,7 @@ bool IirBiQuadFilter::process(int16_t *output, int16_t *input, size_t numSamples
 			input32[i] = (int32_t)(input[i]);
 		}
 
+		PROFILE_KERNEL(BIQUAD, numSamples * m_iirCfg.numStages);
 		arm_biquad_cascade_df1_fast_q31(&m_iirCfg, input32, output32, numSamples);
 
 		for (size_t i=0; i<numSamples; i++) {
@@ -124,6 +126,7 @@ bool IirBiQuadFilterHQ::process(int16_t *output, int16_t *input, size_t numSampl
 			input32[i] = (int32_t)(input[i]);
 		}
 
+		PROFILE_KERNEL(BIQUAD_HQ, numSamples * m_iirCfg.numStages);
 		arm_biquad_cas_df1_32x64_q31(&m_iirCfg, input32, output32, numSamples);
 
 		for (size_t i=0; i<numSamples; i++) {
@@ -133,6 +136,20 @@ bool IirBiQuadFilterHQ::process(int16_t *output, int16_t *input, size_t numSampl
 	return true;
 }
 
+bool IirBiQuadFilterHQ::process(int32_t *output, int32_t *input, size_t numSamples)
+{
+	if (!output) return false;
+	if (!input) {
+		// send zeros
+		memset(output, 0, numSamples * sizeof(int32_t));
+	} else {
+		// the samples are already 32-bit, no conversion needed
+		PROFILE_KERNEL(BIQUAD_HQ, numSamples * m_iirCfg.numStages);
+		arm_biquad_cas_df1_32x64_q31(&m_iirCfg, input, output, numSamples);
+	}
+	return true;
+}
+
 ///////////////////////
 // FLOAT
 ///////////////////////
@@ -171,7 +188,7 @@ bool IirBiQuadFilterFloat::process(float *output, float *input, size_t numSample
 		// send zeros
 		memset(output, 0, numSamples * sizeof(float));
 	} else {
-
+		PROFILE_KERNEL(BIQUAD_FLOAT, numSamples * m_iirCfg.numStages);
 		arm_biquad_cascade_df2T_f32(&m_iirCfg, input, output, numSamples);
 
 	}
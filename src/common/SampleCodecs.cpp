@@ -0,0 +1,421 @@
+/*
+ * SampleCodecs.cpp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#include <cstring>
+
+#if defined(__ARM_FEATURE_SIMD32)
+#include <arm_math.h>
+#endif
+
+#include "LibKernelProfile.h"
+#include "LibSampleCodecs.h"
+
+namespace BAGuitar {
+
+constexpr int32_t PACKED12_MAX = 2047;
+constexpr int32_t PACKED12_MIN = -2048;
+
+// 16-bit samples are converted to and from PACKED24 in pieces of this size on the stack
+constexpr size_t CONVERT_BUFFER_SAMPLES = 32;
+
+constexpr int32_t MULAW_BIAS = 0x84;
+constexpr int32_t MULAW_CLIP = 32635;
+
+// IMA ADPCM tables
+constexpr int32_t ADPCM_MAX_INDEX = 88;
+
+static const int16_t adpcmStepTable[ADPCM_MAX_INDEX+1] = {
+	7, 8, 9, 10, 11, 12, 13, 14, 16, 17,
+	19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+	50, 55, 60, 66, 73, 80, 88, 97, 107, 118,
+	130, 143, 157, 173, 190, 209, 230, 253, 279, 307,
+	337, 371, 408, 449, 494, 544, 598, 658, 724, 796,
+	876, 963, 1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066,
+	2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428, 4871, 5358,
+	5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487, 12635, 13899,
+	15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int8_t adpcmIndexTable[16] = {
+	-1, -1, -1, -1, 2, 4, 6, 8,
+	-1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static inline int32_t clamp(int32_t value, int32_t minValue, int32_t maxValue)
+{
+	if (value > maxValue) { return maxValue; }
+	if (value < minValue) { return minValue; }
+	return value;
+}
+
+// Apply one ADPCM code to the state, shared by the encoder and the decoder so they
+// always track each other.
+static inline void adpcmUpdate(AdpcmState &state, uint8_t code)
+{
+	int32_t step = adpcmStepTable[state.index];
+	int32_t delta = step >> 3;
+	if (code & 4) { delta += step; }
+	if (code & 2) { delta += step >> 1; }
+	if (code & 1) { delta += step >> 2; }
+	state.predictor = clamp((code & 8) ? state.predictor - delta : state.predictor + delta, -32768, 32767);
+	state.index = clamp(state.index + adpcmIndexTable[code], 0, ADPCM_MAX_INDEX);
+}
+
+static inline uint8_t adpcmEncodeSample(AdpcmState &state, int32_t sample)
+{
+	int32_t step = adpcmStepTable[state.index];
+	int32_t diff = sample - state.predictor;
+	uint8_t code = 0;
+	if (diff < 0) { code = 8; diff = -diff; }
+
+	if (diff >= step) { code |= 4; diff -= step; }
+	step >>= 1;
+	if (diff >= step) { code |= 2; diff -= step; }
+	step >>= 1;
+	if (diff >= step) { code |= 1; }
+
+	adpcmUpdate(state, code);
+	return code;
+}
+
+size_t codecFrameSamples(SampleCodec codec)
+{
+	switch (codec) {
+	case SampleCodec::PACKED12  : return 2;
+	case SampleCodec::IMA_ADPCM : return ADPCM_FRAME_SAMPLES;
+	default : return 1;
+	}
+}
+
+size_t codecFrameBytes(SampleCodec codec)
+{
+	switch (codec) {
+	case SampleCodec::PACKED12  : return 3;
+	case SampleCodec::MULAW     : return 1;
+	case SampleCodec::IMA_ADPCM : return ADPCM_FRAME_BYTES;
+	case SampleCodec::PACKED24  : return 3;
+	default : return sizeof(int16_t);
+	}
+}
+
+size_t codecStorageBytes(SampleCodec codec, size_t numSamples)
+{
+	size_t frameSamples = codecFrameSamples(codec);
+	size_t numFrames = (numSamples + frameSamples - 1) / frameSamples;
+	return numFrames * codecFrameBytes(codec);
+}
+
+void encodeSamples(SampleCodec codec, const int16_t *src, uint8_t *dest, size_t numFrames, AdpcmState &state)
+{
+	switch (codec) {
+	case SampleCodec::PACKED12 :
+		encodePacked12(src, dest, numFrames);
+		break;
+	case SampleCodec::MULAW :
+		encodeMulaw(src, dest, numFrames);
+		break;
+	case SampleCodec::IMA_ADPCM :
+		for (size_t i=0; i < numFrames; i++) {
+			encodeAdpcmFrame(src + i*ADPCM_FRAME_SAMPLES, dest + i*ADPCM_FRAME_BYTES, state);
+		}
+		break;
+	case SampleCodec::PACKED24 :
+	{
+		// 16-bit samples always fit, they only need scaling up
+		int32_t buffer[CONVERT_BUFFER_SAMPLES];
+		for (size_t i=0; i < numFrames; i += CONVERT_BUFFER_SAMPLES) {
+			size_t numSamples = (numFrames - i < CONVERT_BUFFER_SAMPLES) ? numFrames - i : CONVERT_BUFFER_SAMPLES;
+			convertSamples16To24(src + i, buffer, numSamples);
+			encodePacked24(buffer, dest + 3*i, numSamples);
+		}
+		break;
+	}
+	default :
+		PROFILE_KERNEL(COPY, numFrames);
+		memcpy(dest, src, numFrames*sizeof(int16_t));
+		break;
+	}
+}
+
+void decodeSamples(SampleCodec codec, const uint8_t *src, int16_t *dest, size_t numFrames)
+{
+	switch (codec) {
+	case SampleCodec::PACKED12 :
+		decodePacked12(src, dest, numFrames);
+		break;
+	case SampleCodec::MULAW :
+		decodeMulaw(src, dest, numFrames);
+		break;
+	case SampleCodec::IMA_ADPCM :
+		for (size_t i=0; i < numFrames; i++) {
+			decodeAdpcmFrame(src + i*ADPCM_FRAME_BYTES, dest + i*ADPCM_FRAME_SAMPLES);
+		}
+		break;
+	case SampleCodec::PACKED24 :
+	{
+		int32_t buffer[CONVERT_BUFFER_SAMPLES];
+		for (size_t i=0; i < numFrames; i += CONVERT_BUFFER_SAMPLES) {
+			size_t numSamples = (numFrames - i < CONVERT_BUFFER_SAMPLES) ? numFrames - i : CONVERT_BUFFER_SAMPLES;
+			decodePacked24(src + 3*i, buffer, numSamples);
+			convertSamples24To16(buffer, dest + i, numSamples);
+		}
+		break;
+	}
+	default :
+		PROFILE_KERNEL(COPY, numFrames);
+		memcpy(dest, src, numFrames*sizeof(int16_t));
+		break;
+	}
+}
+
+// Each pair of 12-bit samples is built into one 24-bit word and stored big-endian, so
+// both samples are encoded and decoded with a handful of shifts and no per-nibble work.
+void encodePacked12(const int16_t *src, uint8_t *dest, size_t numPairs)
+{
+	PROFILE_KERNEL(PACKED12_ENCODE, 2*numPairs);
+	for (size_t i=0; i < numPairs; i++) {
+		uint32_t first  = static_cast<uint32_t>(clamp((src[0] + 8) >> 4, PACKED12_MIN, PACKED12_MAX)) & 0xFFF;
+		uint32_t second = static_cast<uint32_t>(clamp((src[1] + 8) >> 4, PACKED12_MIN, PACKED12_MAX)) & 0xFFF;
+		uint32_t word = (first << 12) | second;
+		dest[0] = static_cast<uint8_t>(word >> 16);
+		dest[1] = static_cast<uint8_t>(word >> 8);
+		dest[2] = static_cast<uint8_t>(word);
+		src += 2;
+		dest += 3;
+	}
+}
+
+void decodePacked12(const uint8_t *src, int16_t *dest, size_t numPairs)
+{
+	PROFILE_KERNEL(PACKED12_DECODE, 2*numPairs);
+	for (size_t i=0; i < numPairs; i++) {
+		uint32_t word = (static_cast<uint32_t>(src[0]) << 16) | (static_cast<uint32_t>(src[1]) << 8) | src[2];
+		dest[0] = static_cast<int16_t>((word >> 8) & 0xFFF0);
+		dest[1] = static_cast<int16_t>((word << 4) & 0xFFF0);
+		src += 3;
+		dest += 2;
+	}
+}
+
+// Unaligned 32-bit loads and stores are allowed on the Cortex-M4, memcpy() lets the
+// compiler use them without breaking aliasing rules.
+static inline void storeWord(uint8_t *dest, uint32_t word)
+{
+	memcpy(dest, &word, sizeof(word));
+}
+
+static inline uint32_t loadWord(const uint8_t *src)
+{
+	uint32_t word;
+	memcpy(&word, src, sizeof(word));
+	return word;
+}
+
+static inline uint32_t packSample24(int32_t sample)
+{
+	return static_cast<uint32_t>(clamp(sample, SAMPLE24_MIN, SAMPLE24_MAX)) & 0xFFFFFF;
+}
+
+// Samples are stored low byte first. Each group of four samples fills exactly three
+// words, so the inner loop is whole word stores with no per-byte work.
+void encodePacked24(const int32_t *src, uint8_t *dest, size_t numSamples)
+{
+	PROFILE_KERNEL(PACKED24_ENCODE, numSamples);
+	size_t i = 0;
+	for (; i+4 <= numSamples; i += 4) {
+		uint32_t a = packSample24(src[i]);
+		uint32_t b = packSample24(src[i+1]);
+		uint32_t c = packSample24(src[i+2]);
+		uint32_t d = packSample24(src[i+3]);
+		storeWord(dest,     a | (b << 24));
+		storeWord(dest + 4, (b >> 8) | (c << 16));
+		storeWord(dest + 8, (c >> 16) | (d << 8));
+		dest += 12;
+	}
+	for (; i < numSamples; i++) {
+		uint32_t sample = packSample24(src[i]);
+		dest[0] = static_cast<uint8_t>(sample);
+		dest[1] = static_cast<uint8_t>(sample >> 8);
+		dest[2] = static_cast<uint8_t>(sample >> 16);
+		dest += 3;
+	}
+}
+
+// Each sample is moved to the top of a word first, so an arithmetic shift back down
+// sign extends it.
+void decodePacked24(const uint8_t *src, int32_t *dest, size_t numSamples)
+{
+	PROFILE_KERNEL(PACKED24_DECODE, numSamples);
+	size_t i = 0;
+	for (; i+4 <= numSamples; i += 4) {
+		uint32_t w0 = loadWord(src);
+		uint32_t w1 = loadWord(src + 4);
+		uint32_t w2 = loadWord(src + 8);
+		dest[i]   = static_cast<int32_t>(w0 << 8) >> 8;
+		dest[i+1] = static_cast<int32_t>((w0 >> 16) | (w1 << 16)) >> 8;
+		dest[i+2] = static_cast<int32_t>((w1 >> 8) | (w2 << 24)) >> 8;
+		dest[i+3] = static_cast<int32_t>(w2) >> 8;
+		src += 12;
+	}
+	for (; i < numSamples; i++) {
+		uint32_t sample = (static_cast<uint32_t>(src[0]) << 8) | (static_cast<uint32_t>(src[1]) << 16) | (static_cast<uint32_t>(src[2]) << 24);
+		dest[i] = static_cast<int32_t>(sample) >> 8;
+		src += 3;
+	}
+}
+
+void convertSamples16To24(const int16_t *src, int32_t *dest, size_t numSamples)
+{
+	PROFILE_KERNEL(CONVERT_16_TO_24, numSamples);
+	for (size_t i=0; i < numSamples; i++) {
+		dest[i] = static_cast<int32_t>(src[i]) * (1 << SAMPLE24_SHIFT);
+	}
+}
+
+void convertSamples24To16(const int32_t *src, int16_t *dest, size_t numSamples)
+{
+	PROFILE_KERNEL(CONVERT_24_TO_16, numSamples);
+	constexpr int32_t ROUNDING = 1 << (SAMPLE24_SHIFT-1);
+	for (size_t i=0; i < numSamples; i++) {
+		// shift first so the rounding can't overflow
+		int32_t sample = (src[i] >> 1) + (ROUNDING >> 1);
+		dest[i] = static_cast<int16_t>(clamp(sample >> (SAMPLE24_SHIFT-1), -32768, 32767));
+	}
+}
+
+void encodeMulaw(const int16_t *src, uint8_t *dest, size_t numSamples)
+{
+	PROFILE_KERNEL(MULAW_ENCODE, numSamples);
+	for (size_t i=0; i < numSamples; i++) {
+		int32_t sample = src[i];
+		uint8_t sign = 0;
+		if (sample < 0) { sign = 0x80; sample = -sample; }
+		sample = clamp(sample, 0, MULAW_CLIP) + MULAW_BIAS;
+
+		// the exponent is the position of the highest set bit above bit 7
+		int32_t exponent = (31 - __builtin_clz(static_cast<uint32_t>(sample))) - 7;
+		int32_t mantissa = (sample >> (exponent + 3)) & 0x0F;
+		dest[i] = sign | static_cast<uint8_t>(exponent << 4) | static_cast<uint8_t>(mantissa);
+	}
+}
+
+void decodeMulaw(const uint8_t *src, int16_t *dest, size_t numSamples)
+{
+	PROFILE_KERNEL(MULAW_DECODE, numSamples);
+	for (size_t i=0; i < numSamples; i++) {
+		uint8_t code = src[i];
+		int32_t exponent = (code >> 4) & 0x07;
+		int32_t mantissa = code & 0x0F;
+		int32_t magnitude = (((mantissa << 3) + MULAW_BIAS) << exponent) - MULAW_BIAS;
+		dest[i] = static_cast<int16_t>((code & 0x80) ? -magnitude : magnitude);
+	}
+}
+
+void encodeAdpcmFrame(const int16_t *src, uint8_t *dest, AdpcmState &state)
+{
+	PROFILE_KERNEL(ADPCM_ENCODE, ADPCM_FRAME_SAMPLES);
+
+	// the header records the state the frame starts with
+	uint16_t predictor = static_cast<uint16_t>(static_cast<int16_t>(state.predictor));
+	dest[0] = static_cast<uint8_t>(predictor);
+	dest[1] = static_cast<uint8_t>(predictor >> 8);
+	dest[2] = static_cast<uint8_t>(state.index);
+	dest[3] = 0;
+
+	uint8_t *data = dest + ADPCM_HEADER_BYTES;
+	for (size_t i=0; i < ADPCM_FRAME_SAMPLES; i += 2) {
+		uint8_t low  = adpcmEncodeSample(state, src[i]);
+		uint8_t high = adpcmEncodeSample(state, src[i+1]);
+		data[i/2] = static_cast<uint8_t>((high << 4) | low);
+	}
+}
+
+void decodeAdpcmFrame(const uint8_t *src, int16_t *dest)
+{
+	PROFILE_KERNEL(ADPCM_DECODE, ADPCM_FRAME_SAMPLES);
+
+	AdpcmState state;
+	state.predictor = static_cast<int16_t>(static_cast<uint16_t>(src[0]) | (static_cast<uint16_t>(src[1]) << 8));
+	state.index = clamp(src[2], 0, ADPCM_MAX_INDEX);
+
+	const uint8_t *data = src + ADPCM_HEADER_BYTES;
+	for (size_t i=0; i < ADPCM_FRAME_SAMPLES; i += 2) {
+		adpcmUpdate(state, data[i/2] & 0x0F);
+		dest[i] = static_cast<int16_t>(state.predictor);
+		adpcmUpdate(state, data[i/2] >> 4);
+		dest[i+1] = static_cast<int16_t>(state.predictor);
+	}
+}
+
+#if defined(__ARM_FEATURE_SIMD32)
+// Pairs of 16-bit samples are moved as 32-bit words when the buffers allow it
+static bool isWordAligned(const void *ptr)
+{
+	return (reinterpret_cast<uintptr_t>(ptr) & 0x3) == 0;
+}
+#endif
+
+void interleaveSamples(const int16_t * const *channels, unsigned numChannels, int16_t *dest, size_t numFrames)
+{
+	PROFILE_KERNEL(INTERLEAVE, numChannels*numFrames);
+	size_t frame = 0;
+#if defined(__ARM_FEATURE_SIMD32)
+	if ((numChannels == 2) && channels[0] && channels[1] &&
+		isWordAligned(channels[0]) && isWordAligned(channels[1]) && isWordAligned(dest)) {
+		const uint32_t *left  = reinterpret_cast<const uint32_t*>(channels[0]);
+		const uint32_t *right = reinterpret_cast<const uint32_t*>(channels[1]);
+		uint32_t *out = reinterpret_cast<uint32_t*>(dest);
+		for (; frame+1 < numFrames; frame += 2) {
+			uint32_t l = *left++;  // L0 in the bottom half, L1 in the top
+			uint32_t r = *right++;
+			*out++ = __PKHBT(l, r, 16); // L0, R0
+			*out++ = __PKHTB(r, l, 16); // L1, R1
+		}
+	}
+#endif
+	for (; frame < numFrames; frame++) {
+		for (unsigned channel=0; channel < numChannels; channel++) {
+			dest[frame*numChannels + channel] = channels[channel] ? channels[channel][frame] : 0;
+		}
+	}
+}
+
+void deinterleaveSamples(const int16_t *src, int16_t * const *channels, unsigned numChannels, size_t numFrames)
+{
+	PROFILE_KERNEL(DEINTERLEAVE, numChannels*numFrames);
+	size_t frame = 0;
+#if defined(__ARM_FEATURE_SIMD32)
+	if ((numChannels == 2) && channels[0] && channels[1] &&
+		isWordAligned(channels[0]) && isWordAligned(channels[1]) && isWordAligned(src)) {
+		const uint32_t *in = reinterpret_cast<const uint32_t*>(src);
+		uint32_t *left  = reinterpret_cast<uint32_t*>(channels[0]);
+		uint32_t *right = reinterpret_cast<uint32_t*>(channels[1]);
+		for (; frame+1 < numFrames; frame += 2) {
+			uint32_t frame0 = *in++; // L0, R0
+			uint32_t frame1 = *in++; // L1, R1
+			*left++  = __PKHBT(frame0, frame1, 16); // L0, L1
+			*right++ = __PKHTB(frame1, frame0, 16); // R0, R1
+		}
+	}
+#endif
+	for (; frame < numFrames; frame++) {
+		for (unsigned channel=0; channel < numChannels; channel++) {
+			if (channels[channel]) { channels[channel][frame] = src[frame*numChannels + channel]; }
+		}
+	}
+}
+
+}
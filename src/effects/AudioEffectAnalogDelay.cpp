@@ -36,13 +36,22 @@ AudioEffectAnalogDelay::AudioEffectAnalogDelay(ExtMemSlot *slot)
 	m_memory = new AudioDelay(slot);
 	m_maxDelaySamples = (slot->size() / sizeof(int16_t));
 	m_externalMemory = true;
+	if (slot->getCodec() == SampleCodec::PACKED24) {
+		m_widePrefetch = new int32_t[2*AUDIO_BLOCK_SAMPLES];
+		m_widePrevious = m_widePrefetch + AUDIO_BLOCK_SAMPLES;
+		m_wideFeedback = (m_widePrefetch != nullptr);
+	}
 	m_constructFilter();
 }
 
 AudioEffectAnalogDelay::~AudioEffectAnalogDelay()
 {
+	// a prefetch may still be writing into m_prefetchBuffer
+	if (m_prefetchValid && m_memory && m_memory->getSlot()) { m_memory->getSlot()->waitForRead(); }
 	if (m_memory) delete m_memory;
+	if (m_previousBlock) release(m_previousBlock);
 	if (m_iir) delete m_iir;
+	if (m_widePrefetch) delete [] m_widePrefetch;
 }
 
 // This function just sets up the default filter and coefficients
@@ -50,25 +59,65 @@ void AudioEffectAnalogDelay::m_constructFilter(void)
 {
 	// Use DM3 coefficients by default
 	m_iir = new IirBiQuadFilterHQ(DM3_NUM_STAGES, reinterpret_cast<const int32_t *>(&DM3), DM3_COEFF_SHIFT);
+	if (m_wideFeedback) { m_loadFilter(DM3_NUM_STAGES, reinterpret_cast<const int32_t *>(&DM3), DM3_COEFF_SHIFT); }
+}
+
+// The 24-bit feedback is 2^SAMPLE24_SHIFT larger than the 16-bit one. The stage outputs
+// are only 32-bit, and the presets have a lot of gain in the early stages, so it would
+// overflow between them. Instead the first stage is scaled down by 2^SAMPLE24_SHIFT so
+// the stages run at the same level as the 16-bit path, and the last stage is scaled back
+// up. Whatever doesn't fit in the last stage's coefficients is shifted up after the filter.
+void AudioEffectAnalogDelay::m_loadFilter(unsigned numStages, const int32_t *coeffs, int coeffShift)
+{
+	m_wideFilterShift = 0;
+	if (!m_wideFeedback || (numStages < 2)) {
+		m_iir->changeFilterCoeffs(numStages, coeffs, coeffShift);
+		return;
+	}
+	if (numStages > MAX_NUM_FILTER_STAGES) { numStages = MAX_NUM_FILTER_STAGES; }
+
+	int32_t scaled[NUM_COEFFS_PER_STAGE*MAX_NUM_FILTER_STAGES];
+	memcpy(scaled, coeffs, NUM_COEFFS_PER_STAGE*numStages*sizeof(int32_t));
+
+	// scale down b0, b1 and b2 of the first stage, rounding
+	for (unsigned i=0; i < 3; i++) {
+		scaled[i] = static_cast<int32_t>((static_cast<int64_t>(scaled[i]) + (1 << (SAMPLE24_SHIFT-1))) >> SAMPLE24_SHIFT);
+	}
+
+	// scale up b0, b1 and b2 of the last stage as far as they fit
+	int32_t *last = scaled + NUM_COEFFS_PER_STAGE*(numStages-1);
+	int64_t maxCoeff = 0;
+	for (unsigned i=0; i < 3; i++) {
+		int64_t coeff = (last[i] < 0) ? -static_cast<int64_t>(last[i]) : last[i];
+		if (coeff > maxCoeff) { maxCoeff = coeff; }
+	}
+	int lastShift = 0;
+	while ((lastShift < SAMPLE24_SHIFT) && ((maxCoeff << (lastShift+1)) <= INT32_MAX)) { lastShift++; }
+	for (unsigned i=0; i < 3; i++) {
+		last[i] = last[i] * (1 << lastShift);
+	}
+	m_wideFilterShift = SAMPLE24_SHIFT - lastShift;
+
+	m_iir->changeFilterCoeffs(numStages, scaled, coeffShift);
 }
 
 void AudioEffectAnalogDelay::setFilterCoeffs(int numStages, const int32_t *coeffs, int coeffShift)
 {
-	m_iir->changeFilterCoeffs(numStages, coeffs, coeffShift);
+	m_loadFilter(numStages, coeffs, coeffShift);
 }
 
 void AudioEffectAnalogDelay::setFilter(Filter filter)
 {
 	switch(filter) {
 	case Filter::WARM :
-		m_iir->changeFilterCoeffs(WARM_NUM_STAGES, reinterpret_cast<const int32_t *>(&WARM), WARM_COEFF_SHIFT);
+		m_loadFilter(WARM_NUM_STAGES, reinterpret_cast<const int32_t *>(&WARM), WARM_COEFF_SHIFT);
 		break;
 	case Filter::DARK :
-		m_iir->changeFilterCoeffs(DARK_NUM_STAGES, reinterpret_cast<const int32_t *>(&DARK), DARK_COEFF_SHIFT);
+		m_loadFilter(DARK_NUM_STAGES, reinterpret_cast<const int32_t *>(&DARK), DARK_COEFF_SHIFT);
 		break;
 	case Filter::DM3 :
 	default:
-		m_iir->changeFilterCoeffs(DM3_NUM_STAGES, reinterpret_cast<const int32_t *>(&DM3), DM3_COEFF_SHIFT);
+		m_loadFilter(DM3_NUM_STAGES, reinterpret_cast<const int32_t *>(&DM3), DM3_COEFF_SHIFT);
 		break;
 	}
 }
@@ -86,6 +135,8 @@ void AudioEffectAnalogDelay::update(void)
 		if (m_previousBlock) {
 			release(m_previousBlock); m_previousBlock = nullptr;
 		}
+		m_prefetchValid = false;
+		m_widePreviousValid = false;
 		if (!m_externalMemory) {
 			// when using internal memory we have to release all references in the ring buffer
 			while (m_memory->getRingBuffer()->size() > 0) {
@@ -110,19 +161,31 @@ void AudioEffectAnalogDelay::update(void)
 		}
 		transmit(inputAudioBlock, 0);
 		release(inputAudioBlock);
+		m_prefetchValid = false;
+		return;
+	}
+
+	if (m_wideFeedback) {
+		m_updateWide(inputAudioBlock);
 		return;
 	}
 
 	// Otherwise perform normal processing
-	// In order to make use of the SPI DMA, we need to request the read from memory first,
-	// then do other processing while it fills in the back.
+	// In order to make use of the SPI DMA, the read for the next update is issued at the
+	// end of this one, so it has a whole block period to complete. When there is no
+	// prefetch for the current delay, e.g. right after the delay changes, we request the
+	// read from memory first, then do other processing while it fills in the back.
 	audio_block_t *blockToOutput = nullptr; // this will hold the output audio
     blockToOutput = allocate();
     if (!blockToOutput) return; // skip this update cycle due to failure
 
+	size_t delaySamples = m_delaySamples; // delay() can change it from outside the audio interrupt
+	bool useDma = m_externalMemory && m_memory->getSlot()->isUseDma();
+	bool usePrefetch = useDma && m_prefetchValid && (m_prefetchDelaySamples == delaySamples);
+
     // get the data. If using external memory with DMA, this won't be filled until
     // later.
-    m_memory->getSamples(blockToOutput, m_delaySamples);
+    if (!usePrefetch) { m_memory->getSamples(blockToOutput, delaySamples); }
 
     // If using DMA, we need something else to do while that read executes, so
     // move on to input preprocessing
@@ -135,31 +198,82 @@ void AudioEffectAnalogDelay::update(void)
 	// consider doing the BBD post processing here to use up more time while waiting
 	// for the read data to come back
 	audio_block_t *blockToRelease = m_memory->addBlock(preProcessed);
+	// external memory stages its own copy of the block, so it doesn't need to be held
+	if (blockToRelease) release(blockToRelease);
 
 
 	// BACK TO OUTPUT PROCESSING
-	// Check if external DMA, if so, we need to be sure the read is completed
-	if (m_externalMemory && m_memory->getSlot()->isUseDma()) {
+	// Check if external DMA, if so, we need to be sure the read is completed. This
+	// only waits on our own read, and returns immediately if it has already landed,
+	// which a prefetch always should have.
+	if (useDma) {
 	    // Using DMA
-		while (m_memory->getSlot()->isReadBusy()) {}
+		m_memory->getSlot()->waitForRead();
+		if (usePrefetch) {
+			memcpy(blockToOutput->data, m_prefetchBuffer, sizeof(m_prefetchBuffer));
+		}
+
+		// The block for the next update starts where this one's ends, now that the
+		// input has been added. It is queued behind the write, so it sees the new data.
+		m_prefetchValid = m_memory->getSamples(m_prefetchBuffer, delaySamples);
+		m_prefetchDelaySamples = delaySamples;
 	}
 
 	// perform the wet/dry mix mix
 	m_postProcessing(blockToOutput, inputAudioBlock, blockToOutput);
-	transmit(blockToOutput);
+	transmit(blockToOutput, 0);
 
 	release(inputAudioBlock);
 	release(m_previousBlock);
 	m_previousBlock = blockToOutput;
+}
 
-//	if (m_externalMemory && m_memory->getSlot()->isUseDma()) {
-//	    // Using DMA
-//		if (m_blockToRelease) release(m_blockToRelease);
-//		m_blockToRelease = blockToRelease;
-//	}
+// The same processing as update(), with the delay line and the feedback kept in 24-bit
+// samples. Only the input and the transmitted output are 16-bit.
+void AudioEffectAnalogDelay::m_updateWide(audio_block_t *inputAudioBlock)
+{
+	audio_block_t *blockToOutput = allocate();
+	if (!blockToOutput) {
+		release(inputAudioBlock);
+		return;
+	}
 
-	if (m_blockToRelease) release(m_blockToRelease);
-	m_blockToRelease = blockToRelease;
+	size_t delaySamples = m_delaySamples;
+	bool useDma = m_memory->getSlot()->isUseDma();
+	bool usePrefetch = useDma && m_prefetchValid && (m_prefetchDelaySamples == delaySamples);
+
+	int32_t wet[AUDIO_BLOCK_SAMPLES];
+	if (!usePrefetch) { m_memory->getSamples(wet, delaySamples); }
+
+	int32_t dry[AUDIO_BLOCK_SAMPLES];
+	if (inputAudioBlock) {
+		convertSamples16To24(inputAudioBlock->data, dry, AUDIO_BLOCK_SAMPLES);
+	} else {
+		memset(dry, 0, sizeof(dry));
+	}
+
+	// the slot packs the samples before addSamples() returns, so this can stay on the stack
+	int32_t preProcessed[AUDIO_BLOCK_SAMPLES];
+	m_preProcessing(preProcessed, dry, m_widePreviousValid ? m_widePrevious : nullptr);
+	m_memory->addSamples(preProcessed);
+
+	if (useDma) {
+		m_memory->getSlot()->waitForRead();
+		if (usePrefetch) {
+			memcpy(wet, m_widePrefetch, sizeof(wet));
+		}
+		m_prefetchValid = m_memory->getSamples(m_widePrefetch, delaySamples);
+		m_prefetchDelaySamples = delaySamples;
+	}
+
+	// the output is kept at full precision for the next feedback pass
+	m_postProcessing(m_widePrevious, dry, wet);
+	m_widePreviousValid = true;
+	convertSamples24To16(m_widePrevious, blockToOutput->data, AUDIO_BLOCK_SAMPLES);
+	transmit(blockToOutput, 0);
+
+	release(inputAudioBlock);
+	release(blockToOutput);
 }
 
 void AudioEffectAnalogDelay::delay(float milliseconds)
@@ -233,6 +347,26 @@ void AudioEffectAnalogDelay::m_postProcessing(audio_block_t *out, audio_block_t
 }
 
 
+void AudioEffectAnalogDelay::m_preProcessing(int32_t *out, int32_t *dry, int32_t *wet)
+{
+	if (wet) {
+		alphaBlend(out, dry, wet, m_feedback);
+		m_iir->process(out, out, AUDIO_BLOCK_SAMPLES);
+		if (m_wideFilterShift) {
+			for (size_t i=0; i < AUDIO_BLOCK_SAMPLES; i++) { out[i] = out[i] * (1 << m_wideFilterShift); }
+		}
+	} else {
+		memcpy(out, dry, sizeof(int32_t) * AUDIO_BLOCK_SAMPLES);
+	}
+}
+
+void AudioEffectAnalogDelay::m_postProcessing(int32_t *out, int32_t *dry, int32_t *wet)
+{
+	alphaBlend(out, dry, wet, m_mix);
+	// Set the output volume
+	gainAdjust(out, out, m_volume, 1);
+}
+
 void AudioEffectAnalogDelay::processMidi(int channel, int control, int value)
 {
 
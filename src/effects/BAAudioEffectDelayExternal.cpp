@@ -18,24 +18,15 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstring>
+
 #include "BAAudioEffectDelayExternal.h"
 
 namespace BAGuitar {
 
-#define SPISETTING SPISettings(20000000, MSBFIRST, SPI_MODE0)
-
-struct MemSpiConfig {
-	unsigned mosiPin;
-	unsigned misoPin;
-	unsigned sckPin;
-	unsigned csPin;
-	unsigned memSize;
-};
-
-constexpr MemSpiConfig Mem0Config = {7,  8, 14, 15, 65536 };
-constexpr MemSpiConfig Mem1Config = {21, 5, 20, 31, 65536 };
-
-unsigned BAAudioEffectDelayExternal::m_usingSPICount[2] = {0,0};
+constexpr unsigned BAAudioEffectDelayExternal::NUM_TAPS;
+static_assert(BAAudioEffectDelayExternal::NUM_TAPS <= ExtMemSlot::MAX_GATHER_ENTRIES, "all the taps are read in one gather request");
+ExternalSramManager BAAudioEffectDelayExternal::m_memoryManager;
 
 BAAudioEffectDelayExternal::BAAudioEffectDelayExternal()
 : AudioStream(1, m_inputQueueArray)
@@ -58,235 +49,130 @@ BAAudioEffectDelayExternal::BAAudioEffectDelayExternal(BAGuitar::MemSelect type,
 
 BAAudioEffectDelayExternal::~BAAudioEffectDelayExternal()
 {
-	if (m_spi) delete m_spi;
+	m_activeMask = 0;
+	m_slot.release();
 }
 
 void BAAudioEffectDelayExternal::delay(uint8_t channel, float milliseconds) {
 
-	if (channel >= 8) return;
+	if (channel >= NUM_TAPS) return;
+	if (!m_slot.isValid() && !m_allocateMemory()) return;
 	if (milliseconds < 0.0) milliseconds = 0.0;
 	uint32_t n = (milliseconds*(AUDIO_SAMPLE_RATE_EXACT/1000.0f))+0.5f;
 	n += AUDIO_BLOCK_SAMPLES;
 	if (n > m_memoryLength - AUDIO_BLOCK_SAMPLES)
 		n = m_memoryLength - AUDIO_BLOCK_SAMPLES;
 	m_channelDelayLength[channel] = n;
-	unsigned mask = m_activeMask;
-	if (m_activeMask == 0) m_startUsingSPI(m_spiChannel);
-	m_activeMask = mask | (1<<channel);
+	// anything read ahead for this channel used the old delay
+	m_prefetchMask &= ~(1<<channel);
+	m_activeMask |= (1<<channel);
 }
 
 void BAAudioEffectDelayExternal::disable(uint8_t channel) {
-	if (channel >= 8) return;
-	uint8_t mask = m_activeMask & ~(1<<channel);
-	m_activeMask = mask;
-	if (mask == 0) m_stopUsingSPI(m_spiChannel);
+	if (channel >= NUM_TAPS) return;
+	m_activeMask &= ~(1<<channel);
 }
 
 void BAAudioEffectDelayExternal::update(void)
 {
 	audio_block_t *block;
-	uint32_t n, channel, read_offset;
+	unsigned channel;
 
 	// grab incoming data and put it into the memory
 	block = receiveReadOnly();
 
+	if (!m_slot.isValid()) {
+		// no taps have been set yet
+		if (block) release(block);
+		return;
+	}
+
+	// The slot copies the data into its own staging buffer, so the audio
+	// block is released right away rather than held until the write finishes.
 	if (block) {
-		if (m_headOffset + AUDIO_BLOCK_SAMPLES <= m_memoryLength) {
-			// a single write is enough
-			write(m_headOffset, AUDIO_BLOCK_SAMPLES, block->data);
-			m_headOffset += AUDIO_BLOCK_SAMPLES;
-		} else {
-			// write wraps across end-of-memory
-			n = m_memoryLength - m_headOffset;
-			write(m_headOffset, n, block->data);
-			m_headOffset = AUDIO_BLOCK_SAMPLES - n;
-			write(0, m_headOffset, block->data + n);
-		}
+		m_slot.writeAdvance16Copy(block->data, AUDIO_BLOCK_SAMPLES);
 		release(block);
 	} else {
 		// if no input, store zeros, so later playback will
 		// not be random garbage previously stored in memory
-		if (m_headOffset + AUDIO_BLOCK_SAMPLES <= m_memoryLength) {
-			zero(m_headOffset, AUDIO_BLOCK_SAMPLES);
-			m_headOffset += AUDIO_BLOCK_SAMPLES;
-		} else {
-			n = m_memoryLength - m_headOffset;
-			zero(m_headOffset, n);
-			m_headOffset = AUDIO_BLOCK_SAMPLES - n;
-			zero(0, m_headOffset);
-		}
+		m_slot.zeroAdvance16(AUDIO_BLOCK_SAMPLES);
 	}
+	m_headOffset = m_slot.getWritePosition() / sizeof(int16_t);
+
+	// Channels that weren't read ahead are read now. They are queued after the
+	// write, so a tap reading the block just written gets the new data.
+	unsigned activeMask = m_activeMask;
+	ExtMemGatherEntry entries[NUM_TAPS];
+	size_t numEntries = 0;
+	for (channel = 0; channel < NUM_TAPS; channel++) {
+		if (!(activeMask & (1<<channel)) || (m_prefetchMask & (1<<channel))) continue;
+		entries[numEntries++] = {m_tapOffset(channel, m_headOffset), m_tapBuffer[channel], AUDIO_BLOCK_SAMPLES};
+	}
+	if (numEntries > 0) { m_slot.readGather16(entries, numEntries); }
+
+	// reads complete in order, so this covers the read ahead from the last update too
+	m_slot.waitForRead();
 
 	// transmit the delayed outputs
-	for (channel = 0; channel < 8; channel++) {
-		if (!(m_activeMask & (1<<channel))) continue;
+	for (channel = 0; channel < NUM_TAPS; channel++) {
+		if (!(activeMask & (1<<channel))) continue;
 		block = allocate();
 		if (!block) continue;
-		// compute the delayed location where we read
-		if (m_channelDelayLength[channel] <= m_headOffset) {
-			read_offset = m_headOffset - m_channelDelayLength[channel];
-		} else {
-			read_offset = m_memoryLength + m_headOffset - m_channelDelayLength[channel];
-		}
-		if (read_offset + AUDIO_BLOCK_SAMPLES <= m_memoryLength) {
-			// a single read will do it
-			read(read_offset, AUDIO_BLOCK_SAMPLES, block->data);
-		} else {
-			// read wraps across end-of-memory
-			n = m_memoryLength - read_offset;
-			read(read_offset, n, block->data);
-			read(0, AUDIO_BLOCK_SAMPLES - n, block->data + n);
-		}
+		memcpy(block->data, m_tapBuffer[channel], sizeof(m_tapBuffer[channel]));
 		transmit(block, channel);
 		release(block);
 	}
-}
 
-unsigned BAAudioEffectDelayExternal::m_allocated[2] = {0, 0};
+	// Read the next block for each channel now, so the transfers run while the
+	// rest of the audio graph is processed. Taps shorter than two blocks would need
+	// the block that hasn't been written yet.
+	unsigned prefetchMask = 0;
+	numEntries = 0;
+	for (channel = 0; channel < NUM_TAPS; channel++) {
+		if (!(activeMask & (1<<channel))) continue;
+		if (m_channelDelayLength[channel] < 2*AUDIO_BLOCK_SAMPLES) continue;
+		entries[numEntries++] = {m_tapOffset(channel, m_headOffset + AUDIO_BLOCK_SAMPLES), m_tapBuffer[channel], AUDIO_BLOCK_SAMPLES};
+		prefetchMask |= (1<<channel);
+	}
+	if (numEntries > 0) { m_slot.readGather16(entries, numEntries); }
+	m_prefetchMask = prefetchMask;
+}
 
 void BAAudioEffectDelayExternal::initialize(MemSelect mem, unsigned delayLength)
 {
-	unsigned samples = 0;
-	unsigned memsize, avail;
-
 	m_activeMask = 0;
+	m_prefetchMask = 0;
 	m_headOffset = 0;
+	m_memoryLength = 0;
 	m_mem = mem;
-
-	switch (mem) {
-	case MemSelect::MEM0 :
-	{
-		memsize = Mem0Config.memSize;
-		m_spi = &SPI;
-		m_spiChannel = 0;
-		m_misoPin = Mem0Config.misoPin;
-		m_mosiPin = Mem0Config.mosiPin;
-		m_sckPin =  Mem0Config.sckPin;
-		m_csPin = Mem0Config.csPin;
-
-		m_spi->setMOSI(m_mosiPin);
-		m_spi->setMISO(m_misoPin);
-		m_spi->setSCK(m_sckPin);
-		m_spi->begin();
-		break;
-	}
-	case MemSelect::MEM1 :
-	{
-#if defined(__MK64FX512__) || defined(__MK66FX1M0__)
-		memsize = Mem1Config.memSize;
-		m_spi = &SPI1;
-		m_spiChannel = 1;
-		m_misoPin = Mem1Config.misoPin;
-		m_mosiPin = Mem1Config.mosiPin;
-		m_sckPin =  Mem1Config.sckPin;
-		m_csPin = Mem1Config.csPin;
-
-		m_spi->setMOSI(m_mosiPin);
-		m_spi->setMISO(m_misoPin);
-		m_spi->setSCK(m_sckPin);
-		m_spi->begin();
-#endif
-		break;
-	}
-
-	}
-
-	pinMode(m_csPin, OUTPUT);
-	digitalWriteFast(m_csPin, HIGH);
-
-	avail = memsize - m_allocated[mem];
-
-	if (delayLength > avail) samples = avail;
-	m_memoryStart = m_allocated[mem];
-	m_allocated[mem] += samples;
-	m_memoryLength = samples;
-
-	zero(0, m_memoryLength);
-
-}
-
-
-void BAAudioEffectDelayExternal::read(uint32_t offset, uint32_t count, int16_t *data)
-{
-	uint32_t addr = m_memoryStart + offset;
-	addr *= 2;
-
-	m_spi->beginTransaction(SPISETTING);
-	digitalWriteFast(m_csPin, LOW);
-	m_spi->transfer16((0x03 << 8) | (addr >> 16));
-	m_spi->transfer16(addr & 0xFFFF);
-
-	while (count) {
-		*data++ = (int16_t)(m_spi->transfer16(0));
-		count--;
-	}
-	digitalWriteFast(m_csPin, HIGH);
-	m_spi->endTransaction();
-
-}
-
-void BAAudioEffectDelayExternal::write(uint32_t offset, uint32_t count, const int16_t *data)
-{
-	uint32_t addr = m_memoryStart + offset;
-
-	addr *= 2;
-	m_spi->beginTransaction(SPISETTING);
-	digitalWriteFast(m_csPin, LOW);
-	m_spi->transfer16((0x02 << 8) | (addr >> 16));
-	m_spi->transfer16(addr & 0xFFFF);
-	while (count) {
-		int16_t w = 0;
-		if (data) w = *data++;
-		m_spi->transfer16(w);
-		count--;
-	}
-	digitalWriteFast(m_csPin, HIGH);
-	m_spi->endTransaction();
-
+	m_requestedLength = delayLength;
+	memset(m_channelDelayLength, 0, sizeof(m_channelDelayLength));
 }
 
 ///////////////////////////////////////////////////////////////////
 // PRIVATE METHODS
 ///////////////////////////////////////////////////////////////////
-void BAAudioEffectDelayExternal::zero(uint32_t address, uint32_t count) {
-	write(address, count, NULL);
-}
-
-#ifdef SPI_HAS_NOTUSINGINTERRUPT
-inline void BAAudioEffectDelayExternal::m_startUsingSPI(int spiBus) {
-	if (spiBus == 0) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
-	} else if (spiBus == 1) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
-	}
-	m_usingSPICount[spiBus]++;
-}
-
-inline void BAAudioEffectDelayExternal::m_stopUsingSPI(int spiBus) {
-	if (m_usingSPICount[spiBus] == 0 || --m_usingSPICount[spiBus] == 0)
-	{
-		if (spiBus == 0) {
-			m_spi->notUsingInterrupt(IRQ_SOFTWARE);
-		} else if (spiBus == 1) {
-			m_spi->notUsingInterrupt(IRQ_SOFTWARE);
-		}
-
+// The memory isn't requested until it's needed so the SPI and DMA hardware are not
+// started from a global constructor. When less is available than was requested, we
+// use what's left.
+bool BAAudioEffectDelayExternal::m_allocateMemory()
+{
+	m_memoryManager.detectMemory(m_mem, true);
+	size_t sizeBytes = min(sizeof(int16_t)*m_requestedLength, m_memoryManager.largestAvailable(m_mem));
+	if (sizeBytes < 3*AUDIO_BLOCK_SAMPLES*sizeof(int16_t)) {
+		Serial.println("BAAudioEffectDelayExternal: not enough external memory");
+		return false;
 	}
+	if (!m_memoryManager.requestMemory(&m_slot, sizeBytes, m_mem, true)) { return false; }
+	m_memoryLength = m_slot.size() / sizeof(int16_t);
+	m_headOffset = m_slot.getWritePosition() / sizeof(int16_t);
+	return true;
 }
 
-#else
-inline void BAAudioEffectDelayExternal::m_startUsingSPI(int spiBus) {
-	if (spiBus == 0) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
-	} else if (spiBus == 1) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
-	}
-
-}
-inline void BAAudioEffectDelayExternal::m_stopUsingSPI(int spiBus) {
+// The offset of the first sample a channel outputs when the head is at headOffset
+unsigned BAAudioEffectDelayExternal::m_tapOffset(unsigned channel, unsigned headOffset) const
+{
+	return (headOffset + m_memoryLength - m_channelDelayLength[channel]) % m_memoryLength;
 }
 
-#endif
-
-
 } /* namespace BAGuitar */
@@ -18,32 +18,21 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstring>
+
 #include "../BAAudioEffectLoopExternal.h"
 
 namespace BAGuitar {
 
-#define SPISETTING SPISettings(20000000, MSBFIRST, SPI_MODE0)
-
-struct MemSpiConfig {
-	unsigned mosiPin;
-	unsigned misoPin;
-	unsigned sckPin;
-	unsigned csPin;
-	unsigned memSize;
-};
-
-constexpr MemSpiConfig Mem0Config = {7,  8, 14, 15, 65536 };
-constexpr MemSpiConfig Mem1Config = {21, 5, 20, 31, 65536 };
-
-unsigned BAAudioEffectLoopExternal::m_usingSPICount[2] = {0,0};
+ExternalSramManager BAAudioEffectLoopExternal::m_memoryManager;
 
-    BAAudioEffectLoopExternal::BAAudioEffectLoopExternal()
+BAAudioEffectLoopExternal::BAAudioEffectLoopExternal()
 : AudioStream(1, m_inputQueueArray)
 {
 	initialize(MemSelect::MEM0);
 }
 
-    BAAudioEffectLoopExternal::BAAudioEffectLoopExternal(MemSelect mem)
+BAAudioEffectLoopExternal::BAAudioEffectLoopExternal(MemSelect mem)
 : AudioStream(1, m_inputQueueArray)
 {
 	initialize(mem);
@@ -56,246 +45,137 @@ BAAudioEffectLoopExternal::BAAudioEffectLoopExternal(BAGuitar::MemSelect type, f
 	initialize(type, delayLengthInt);
 }
 
-    BAAudioEffectLoopExternal::~BAAudioEffectLoopExternal()
+BAAudioEffectLoopExternal::~BAAudioEffectLoopExternal()
 {
-	if (m_spi) delete m_spi;
+	m_activeMask = 0;
+	m_slot.release();
 }
 
 void BAAudioEffectLoopExternal::delay(float milliseconds) {
 
+	if (!m_slot.isValid()) return;
 	if (milliseconds < 0.0) milliseconds = 0.0;
 	uint32_t n = round(milliseconds*(AUDIO_SAMPLE_RATE_EXACT/1000.0f));
-	Serial.printf(":samples: %d", n);
-	//n += AUDIO_BLOCK_SAMPLES;
-	//if (n > m_memoryLength - AUDIO_BLOCK_SAMPLES)
-//		n = m_memoryLength - AUDIO_BLOCK_SAMPLES;
-	m_channelDelayLength = n;
-	if (m_activeMask == 0) m_startUsingSPI(m_spiChannel);
+	if (n < AUDIO_BLOCK_SAMPLES) n = AUDIO_BLOCK_SAMPLES;
+	if (n > m_memoryLength) n = m_memoryLength;
+
+	// the loop ends where recording stopped
+	__disable_irq();
+	m_loopLength = n;
+	m_loopStart = (m_headOffset + m_memoryLength - n) % m_memoryLength;
+	m_loopPosition = 0;
+	m_prefetched = false;
 	m_activeMask = 1;
-
-	if (m_headOffset >= n )
-		read_offset = m_headOffset - n;
-	else
-		read_offset = m_memoryLength - (n - m_headOffset);
+	__enable_irq();
 }
 
 void BAAudioEffectLoopExternal::disable() {
-	uint8_t mask = 0;
-	m_activeMask = mask;
-	if (mask == 0) m_stopUsingSPI(m_spiChannel);
+	m_activeMask = 0;
+	m_prefetched = false;
 }
 
 void BAAudioEffectLoopExternal::update(void)
 {
 	audio_block_t *blockIn, *blockOut;
-	uint32_t n;
 
 	blockIn = receiveReadOnly();
-	blockOut = allocate();
-    if (!blockOut) return;
+	if (!m_slot.isValid() && !m_allocateMemory()) {
+		if (blockIn) release(blockIn);
+		return;
+	}
 
 	if (!m_activeMask) {
 		// pass-through, loop NOT active
-		// only record to memory when looping is not active
+		// only record to memory when looping is not active.
+		// The slot copies the data into its own staging buffer, so the audio
+		// block isn't held until the write finishes.
 		if (blockIn) {
-			memcpy(blockIn->data, blockOut->data, AUDIO_BLOCK_SAMPLES);
-
-			if (m_headOffset + AUDIO_BLOCK_SAMPLES <= m_memoryLength) {
-				// a single write is enough
-				write(m_headOffset, AUDIO_BLOCK_SAMPLES, blockIn->data);
-				m_headOffset += AUDIO_BLOCK_SAMPLES;
-			} else {
-				// write wraps across end-of-memory
-				n = m_memoryLength - m_headOffset;
-				write(m_headOffset, n, blockIn->data);
-				m_headOffset = AUDIO_BLOCK_SAMPLES - n;
-				write(0, m_headOffset, blockIn->data + n);
-			}
+			m_slot.writeAdvance16Copy(blockIn->data, AUDIO_BLOCK_SAMPLES);
+			transmit(blockIn, 0);
 			release(blockIn);
-		}
-		else {
-			memset(blockOut->data, 0, AUDIO_BLOCK_SAMPLES);
-
+		} else {
 			// if no input, store zeros, so later playback will
 			// not be random garbage previously stored in memory
-			if (m_headOffset + AUDIO_BLOCK_SAMPLES <= m_memoryLength) {
-				zero(m_headOffset, AUDIO_BLOCK_SAMPLES);
-				m_headOffset += AUDIO_BLOCK_SAMPLES;
-			} else {
-				n = m_memoryLength - m_headOffset;
-				zero(m_headOffset, n);
-				m_headOffset = AUDIO_BLOCK_SAMPLES - n;
-				zero(0, m_headOffset);
-			}
+			m_slot.zeroAdvance16(AUDIO_BLOCK_SAMPLES);
 		}
-
-
-	} else {
-        release(blockIn);
-        // compute the delayed location where we read
-        if (read_offset + AUDIO_BLOCK_SAMPLES <= m_memoryLength) {
-            // a single read will do it
-            read(read_offset, AUDIO_BLOCK_SAMPLES, blockOut->data);
-			read_offset += AUDIO_BLOCK_SAMPLES;
-			if (read_offset >= m_headOffset)
-                read_offset = m_headOffset - m_channelDelayLength;
-        } else {
-            // read wraps across end-of-memory
-            n = m_memoryLength - read_offset;
-            read(read_offset, n, blockOut->data);
-            read(0, AUDIO_BLOCK_SAMPLES - n, blockOut->data + n);
-			read_offset = AUDIO_BLOCK_SAMPLES - n;
-        }
-    }
-	transmit(blockOut, 0);
-	release(blockOut);
-}
-
-void BAAudioEffectLoopExternal::initialize(MemSelect mem, unsigned delayLength)
-{
-	unsigned samples = 0;
-	unsigned memsize, avail;
-
-	m_activeMask = 0;
-	m_headOffset = 0;
-	m_mem = mem;
-
-	switch (mem) {
-	case MemSelect::MEM0 :
-	{
-		memsize = Mem0Config.memSize;
-		m_spi = &SPI;
-		m_spiChannel = 0;
-		m_misoPin = Mem0Config.misoPin;
-		m_mosiPin = Mem0Config.mosiPin;
-		m_sckPin =  Mem0Config.sckPin;
-		m_csPin = Mem0Config.csPin;
-
-		m_spi->setMOSI(m_mosiPin);
-		m_spi->setMISO(m_misoPin);
-		m_spi->setSCK(m_sckPin);
-		m_spi->begin();
-		break;
-	}
-	case MemSelect::MEM1 :
-	{
-#if defined(__MK64FX512__) || defined(__MK66FX1M0__)
-		memsize = Mem1Config.memSize;
-		m_spi = &SPI1;
-		m_spiChannel = 1;
-		m_misoPin = Mem1Config.misoPin;
-		m_mosiPin = Mem1Config.mosiPin;
-		m_sckPin =  Mem1Config.sckPin;
-		m_csPin = Mem1Config.csPin;
-
-		m_spi->setMOSI(m_mosiPin);
-		m_spi->setMISO(m_misoPin);
-		m_spi->setSCK(m_sckPin);
-		m_spi->begin();
-#endif
-		break;
-	}
-
+		m_headOffset = m_slot.getWritePosition() / sizeof(int16_t);
+		return;
 	}
 
-	pinMode(m_csPin, OUTPUT);
-	digitalWriteFast(m_csPin, HIGH);
+	if (blockIn) release(blockIn);
 
-	avail = memsize;
-	//Serial.printf("avail: %d\n", avail);
+	// the first block after the loop starts hasn't been read ahead
+	if (!m_prefetched) { m_readLoopBlock(); }
+	m_slot.waitForRead();
 
-	if (delayLength > avail) samples = avail;
-	m_memoryStart = 0;
-	m_memoryLength = samples;
-    //Serial.printf("about to zero: %d\n", m_memoryLength);
-    delay(2000);
-	zero(0, m_memoryLength);
-    //Serial.print("zeroed!\n");
-    delay(2000);
-}
-
-
-void BAAudioEffectLoopExternal::read(uint32_t offset, uint32_t count, int16_t *data)
-{
-	uint32_t addr = m_memoryStart + offset;
-	addr *= 2;
-
-	m_spi->beginTransaction(SPISETTING);
-	digitalWriteFast(m_csPin, LOW);
-	m_spi->transfer16((0x03 << 8) | (addr >> 16));
-	m_spi->transfer16(addr & 0xFFFF);
-
-	while (count) {
-		*data++ = (int16_t)(m_spi->transfer16(0));
-		count--;
+	blockOut = allocate();
+	if (blockOut) {
+		memcpy(blockOut->data, m_playBuffer, sizeof(m_playBuffer));
+		transmit(blockOut, 0);
+		release(blockOut);
 	}
-	digitalWriteFast(m_csPin, HIGH);
-	m_spi->endTransaction();
 
+	// read the next block while the rest of the audio graph is processed
+	m_readLoopBlock();
+	m_prefetched = true;
 }
 
-void BAAudioEffectLoopExternal::write(uint32_t offset, uint32_t count, const int16_t *data)
+void BAAudioEffectLoopExternal::initialize(MemSelect mem, unsigned delayLength)
 {
-	uint32_t addr = m_memoryStart + offset;
-
-	addr *= 2;
-	m_spi->beginTransaction(SPISETTING);
-	digitalWriteFast(m_csPin, LOW);
-	m_spi->transfer16((0x02 << 8) | (addr >> 16));
-	m_spi->transfer16(addr & 0xFFFF);
-	while (count) {
-		int16_t w = 0;
-		if (data) w = *data++;
-		m_spi->transfer16(w);
-		count--;
-	}
-	digitalWriteFast(m_csPin, HIGH);
-	m_spi->endTransaction();
-
+	m_activeMask = 0;
+	m_prefetched = false;
+	m_headOffset = 0;
+	m_memoryLength = 0;
+	m_loopStart = 0;
+	m_loopLength = 0;
+	m_loopPosition = 0;
+	m_mem = mem;
+	m_requestedLength = delayLength;
+	m_allocationFailed = false;
 }
 
 ///////////////////////////////////////////////////////////////////
 // PRIVATE METHODS
 ///////////////////////////////////////////////////////////////////
-void BAAudioEffectLoopExternal::zero(uint32_t address, uint32_t count) {
-	write(address, count, NULL);
-}
-
-#ifdef SPI_HAS_NOTUSINGINTERRUPT
-inline void BAAudioEffectLoopExternal::m_startUsingSPI(int spiBus) {
-	if (spiBus == 0) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
-	} else if (spiBus == 1) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
-	}
-	m_usingSPICount[spiBus]++;
-}
-
-inline void BAAudioEffectLoopExternal::m_stopUsingSPI(int spiBus) {
-	if (m_usingSPICount[spiBus] == 0 || --m_usingSPICount[spiBus] == 0)
-	{
-		if (spiBus == 0) {
-			m_spi->notUsingInterrupt(IRQ_SOFTWARE);
-		} else if (spiBus == 1) {
-			m_spi->notUsingInterrupt(IRQ_SOFTWARE);
-		}
-
+// The memory isn't requested until the first update() so the SPI and DMA hardware
+// are not started from a global constructor, which may also run before the memory
+// manager has been constructed. When less is available than was requested, we use
+// what's left. A failed request isn't retried on every update.
+bool BAAudioEffectLoopExternal::m_allocateMemory()
+{
+	if (m_allocationFailed) { return false; }
+	m_allocationFailed = true;
+	m_memoryManager.detectMemory(m_mem, true);
+	size_t sizeBytes = min(sizeof(int16_t)*m_requestedLength, m_memoryManager.largestAvailable(m_mem));
+	if (sizeBytes < 2*AUDIO_BLOCK_SAMPLES*sizeof(int16_t)) {
+		Serial.println("BAAudioEffectLoopExternal: not enough external memory");
+		return false;
 	}
+	if (!m_memoryManager.requestMemory(&m_slot, sizeBytes, m_mem, true)) { return false; }
+	m_memoryLength = m_slot.size() / sizeof(int16_t);
+	m_headOffset = m_slot.getWritePosition() / sizeof(int16_t);
+	m_allocationFailed = false;
+	return true;
 }
 
-#else
-inline void BAAudioEffectLoopExternal::m_startUsingSPI(int spiBus) {
-	if (spiBus == 0) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
-	} else if (spiBus == 1) {
-		m_spi->usingInterrupt(IRQ_SOFTWARE);
+// Queue the read of the next block of the loop into m_playBuffer. A block that
+// crosses the end of the loop continues from the loop start, both parts are read
+// in one gather request. The slot takes care of the loop crossing the end of memory.
+void BAAudioEffectLoopExternal::m_readLoopBlock()
+{
+	ExtMemGatherEntry entries[2];
+	size_t numEntries = 0;
+
+	unsigned firstPart = min(static_cast<unsigned>(AUDIO_BLOCK_SAMPLES), m_loopLength - m_loopPosition);
+	entries[numEntries++] = {(m_loopStart + m_loopPosition) % m_memoryLength, m_playBuffer, firstPart};
+	m_loopPosition += firstPart;
+	if (m_loopPosition >= m_loopLength) {
+		// the loop is at least one block long, so the rest fits before the end
+		unsigned secondPart = AUDIO_BLOCK_SAMPLES - firstPart;
+		if (secondPart > 0) { entries[numEntries++] = {m_loopStart, m_playBuffer + firstPart, secondPart}; }
+		m_loopPosition = secondPart;
 	}
-
+	m_slot.readGather16(entries, numEntries);
 }
-inline void BAAudioEffectLoopExternal::m_stopUsingSPI(int spiBus) {
-}
-
-#endif
-
 
 } /* namespace BAGuitar */
@@ -0,0 +1,144 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  Host version of the parts of the Teensyduino core used by the library, see
+ *  BAHost.h. Serial goes to stdout, the DWT cycle counter counts F_CPU cycles of
+ *  wall clock time, and __disable_irq() / __enable_irq() take a lock that can be
+ *  shared with a thread standing in for the audio interrupt.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_HOST_ARDUINO_H
+#define __BAGUITAR_HOST_ARDUINO_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+#ifndef F_CPU
+#define F_CPU 180000000
+#endif
+#ifndef F_BUS
+#define F_BUS 60000000
+#endif
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+/// Host version of the Arduino String, enough for building messages
+class String {
+public:
+	String(const char *str = "") : m_str(str ? str : "") {}
+	String(const std::string &str) : m_str(str) {}
+	explicit String(char c) : m_str(1, c) {}
+	template <typename T, typename std::enable_if<std::is_integral<T>::value, int>::type = 0>
+	String(T value, unsigned char base = DEC) : m_str(m_fromInteger(static_cast<long long>(value), base)) {}
+	template <typename T, typename std::enable_if<std::is_enum<T>::value, int>::type = 0>
+	String(T value) : m_str(m_fromInteger(static_cast<long long>(value), DEC)) {}
+	String(float value, unsigned char decimalPlaces = 2) : m_str(m_fromFloat(value, decimalPlaces)) {}
+	String(double value, unsigned char decimalPlaces = 2) : m_str(m_fromFloat(value, decimalPlaces)) {}
+
+	String& operator+=(const String &other) { m_str += other.m_str; return *this; }
+	const char *c_str() const { return m_str.c_str(); }
+	unsigned int length() const { return static_cast<unsigned int>(m_str.size()); }
+	bool operator==(const String &other) const { return m_str == other.m_str; }
+
+private:
+	static std::string m_fromInteger(long long value, unsigned char base);
+	static std::string m_fromFloat(double value, unsigned char decimalPlaces);
+	std::string m_str;
+};
+
+template <typename T>
+String operator+(const String &lhs, const T &rhs) { String result(lhs); result += String(rhs); return result; }
+inline String operator+(const char *lhs, const String &rhs) { String result(lhs); result += rhs; return result; }
+template <typename T, typename std::enable_if<std::is_arithmetic<T>::value, int>::type = 0>
+String operator+(T lhs, const String &rhs) { String result(lhs); result += rhs; return result; }
+
+/// Serial port, printed to stdout
+class HostSerial {
+public:
+	void begin(unsigned long baud) {}
+	void flush();
+	operator bool() const { return true; }
+
+	template <typename T>
+	void print(const T &value) { m_write(String(value)); }
+	template <typename T>
+	void print(const T &value, int format) { m_write(String(value, format)); }
+	void print(const char *str) { m_write(String(str)); }
+	void print(const String &str) { m_write(str); }
+
+	void println() { m_write(String("\n")); }
+	template <typename T>
+	void println(const T &value) { print(value); println(); }
+	template <typename T>
+	void println(const T &value, int format) { print(value, format); println(); }
+
+	int printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+private:
+	void m_write(const String &str);
+};
+
+extern HostSerial Serial;
+
+/// Cycle count at F_CPU since the program started
+uint32_t hostCycleCount();
+
+// Debug Watch and Trace registers used for cycle counting
+extern volatile uint32_t hostArmDemcr;
+extern volatile uint32_t hostArmDwtCtrl;
+#define ARM_DEMCR hostArmDemcr
+#define ARM_DEMCR_TRCENA (1 << 24)
+#define ARM_DWT_CTRL hostArmDwtCtrl
+#define ARM_DWT_CTRL_CYCCNTENA (1 << 0)
+#define ARM_DWT_CYCCNT (hostCycleCount())
+
+void __disable_irq();
+void __enable_irq();
+
+void pinMode(uint8_t pin, uint8_t mode);
+/// Chip select pins of the emulated SPI RAMs select and deselect them
+void digitalWrite(uint8_t pin, uint8_t value);
+inline void digitalWriteFast(uint8_t pin, uint8_t value) { digitalWrite(pin, value); }
+int digitalRead(uint8_t pin);
+
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t msec);
+void delayMicroseconds(uint32_t usec);
+
+template <typename A, typename B>
+auto min(const A &a, const B &b) -> decltype(a < b ? a : b) { return (a < b) ? a : b; }
+template <typename A, typename B>
+auto max(const A &a, const B &b) -> decltype(a > b ? a : b) { return (a > b) ? a : b; }
+
+#endif /* __BAGUITAR_HOST_ARDUINO_H */
@@ -0,0 +1,33 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  Host version of the Teensy Audio library header, see BAHost.h. Only the
+ *  AudioStream framework is provided, none of the library's audio objects.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_HOST_AUDIO_H
+#define __BAGUITAR_HOST_AUDIO_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "AudioStream.h"
+
+#endif /* __BAGUITAR_HOST_AUDIO_H */
@@ -0,0 +1,103 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  Host version of the Teensy AudioStream, see BAHost.h. There is no audio
+ *  interrupt, the program passes blocks to an object, calls its update(), and
+ *  collects what it transmitted.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_HOST_AUDIOSTREAM_H
+#define __BAGUITAR_HOST_AUDIOSTREAM_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <cstdint>
+
+#include "Arduino.h"
+
+#define AUDIO_BLOCK_SAMPLES 128
+#define AUDIO_SAMPLE_RATE_EXACT 44117.64706f
+#define AUDIO_SAMPLE_RATE AUDIO_SAMPLE_RATE_EXACT
+
+/// Block of audio samples, reference counted like the Teensy pool
+typedef struct audio_block_struct {
+	uint8_t  ref_count;
+	uint8_t  reserved1;
+	uint16_t memory_pool_index;
+	int16_t  data[AUDIO_BLOCK_SAMPLES];
+} audio_block_t;
+
+/// Base class for the audio objects
+class AudioStream {
+public:
+	/// The most outputs an object can transmit on, the largest fan-out in the Teensy
+	/// Audio library and BAAudioEffectDelayExternal
+	static constexpr unsigned MAX_OUTPUTS = 8;
+
+	AudioStream(unsigned char ninput, audio_block_t **iqueue);
+	virtual ~AudioStream();
+
+	/// Process one block period
+	virtual void update(void) = 0;
+
+	/// Give the object an input block for the next update(). The object takes a
+	/// reference, so the caller still releases its own.
+	/// @param index the input
+	/// @param block the block, nullptr for no input
+	void hostSetInput(unsigned index, audio_block_t *block);
+
+	/// Collect the block an object transmitted during the last update()
+	/// @param index the output
+	/// @returns the block, which the caller releases, or nullptr if none was sent
+	audio_block_t *hostTakeOutput(unsigned index = 0);
+
+	/// Allocate a block from the pool, for use by the program
+	static audio_block_t *hostAllocate() { return allocate(); }
+
+	/// Release a block, for use by the program
+	static void hostRelease(audio_block_t *block) { release(block); }
+
+	/// The number of blocks currently allocated
+	static unsigned hostBlocksInUse();
+
+	/// Set the most blocks that can be allocated at once, see AudioMemory()
+	static void hostSetPoolSize(unsigned numBlocks);
+
+protected:
+	bool active = true;
+	static audio_block_t *allocate(void);
+	static void release(audio_block_t *block);
+	void transmit(audio_block_t *block, unsigned char index = 0);
+	audio_block_t *receiveReadOnly(unsigned int index = 0);
+	audio_block_t *receiveWritable(unsigned int index = 0);
+
+private:
+	unsigned char m_numInputs;
+	audio_block_t **m_inputQueue;
+	audio_block_t *m_outputs[MAX_OUTPUTS] = {};
+};
+
+/// Set the size of the block pool
+inline void AudioMemory(unsigned numBlocks) { AudioStream::hostSetPoolSize(numBlocks); }
+inline void AudioNoInterrupts() {}
+inline void AudioInterrupts() {}
+inline void AudioStartUsingSPI() {}
+inline void AudioStopUsingSPI() {}
+
+#endif /* __BAGUITAR_HOST_AUDIOSTREAM_H */
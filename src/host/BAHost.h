@@ -0,0 +1,93 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  BAHost lets the external memory stack run on a Linux PC. The SPI RAMs are
+ *  emulated behind the Arduino SPI and DmaSpi interfaces, so BASpiMemory,
+ *  BASpiMemoryDMA, ExtMemSlot, AudioDelay and the external memory effects run
+ *  unchanged, and can be tested and profiled without a Teensy and a TGA Pro.
+ *  @details Build with BAGUITAR_HOST defined, and put src/host ahead of the
+ *  rest of the include path. It provides host versions of Arduino.h, SPI.h,
+ *  DmaSpi.h, Audio.h, AudioStream.h and arm_math.h. The library sources are compiled as
+ *  they are, together with the .cpp files in src/host, e.g.<br>
+ *  g++ -std=gnu++11 -pthread -DBAGUITAR_HOST -D__MK66FX1M0__ -Isrc/host -Isrc
+ *  test.cpp src/host/\*.cpp src/common/\*.cpp src/peripherals/BASpiMemory.cpp<br>
+ *  The arm_math.h only covers the CMSIS-DSP functions the library uses, in plain
+ *  C++ with the same fixed point formats, see BAHostArmMath.cpp.<br>
+ *  Each SPI RAM is a file mapped into memory with mmap(), so its contents can be
+ *  inspected or kept from one run to the next. DMA transfers are carried out by
+ *  a worker thread for each SPI bus, in the order they were registered, just as
+ *  the DMA does on the Teensy. They can optionally take as long as they would at
+ *  the SPI clock, see HostSpiRamConfig::realTime.<br>
+ *  There are no audio interrupts on the host. The program calls update() on each
+ *  AudioStream itself, passing blocks in with AudioStream::hostSetInput() and
+ *  collecting them with AudioStream::hostTakeOutput(), or HostBudgetSimulator
+ *  does it for a chain of them and reports the ISR time and SPI bus load each
+ *  block would have on the Teensy, see BAHostBudget.h.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_BAHOST_H
+#define __BAGUITAR_BAHOST_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+
+#include "BAHardware.h"
+
+namespace BAGuitar {
+
+/// Describes the SPI RAM emulated on one SPI device
+struct HostSpiRamConfig {
+	/// File holding the memory contents. It is created if needed and sized to
+	/// sizeBytes. nullptr uses anonymous memory that is lost when the program exits.
+	const char *path = nullptr;
+	/// Size of the memory in bytes, a power of two. Addresses above it wrap around,
+	/// as they do on the real parts.
+	size_t sizeBytes = SPI_MAX_ADDR+1;
+	/// When true the memory answers like an ESP-PSRAM64 class PSRAM, with 1 KB
+	/// pages, otherwise like a 23LC1024 class SRAM.
+	bool psram = false;
+	/// When true, each DMA transfer finishes no sooner than it would at the SPI
+	/// clock, so the time spent waiting on the memory is realistic. Otherwise
+	/// transfers finish as fast as the worker thread can copy them.
+	bool realTime = false;
+};
+
+/// Replace the SPI RAM emulated on an SPI device.
+/// @details Call before any BASpiMemory for the device is started. By default
+/// both devices have an anonymous 23LC1024 class SRAM.
+/// @param device the SPI device the memory is attached to
+/// @param config describes the memory
+/// @returns true on success, false if the file couldn't be opened or mapped
+bool hostConfigureSpiRam(SpiDeviceId device, const HostSpiRamConfig &config);
+
+/// Write any changes to the memory file of an SPI device back to the disk
+/// @param device the SPI device the memory is attached to
+void hostSyncSpiRam(SpiDeviceId device);
+
+/// Get a pointer to the emulated memory contents, for checking them directly
+/// @details Accesses aren't synchronized with DMA transfers in progress.
+/// @param device the SPI device the memory is attached to
+/// @returns pointer to the first byte of the memory
+uint8_t *hostSpiRamContents(SpiDeviceId device);
+
+}
+
+#endif /* __BAGUITAR_BAHOST_H */
@@ -0,0 +1,223 @@
+/*
+ * BAHostArduino.cpp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(BAGUITAR_HOST)
+
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+
+#include "Arduino.h"
+#include "SPI.h"
+#include "DmaSpi.h"
+#include "BAHostSpiRam.h"
+#include "BAHostBudget.h"
+
+using namespace BAGuitar;
+
+HostSerial Serial;
+SPIClass SPI(0);
+SPIClass SPI1(1);
+
+volatile uint32_t hostArmDemcr = 0;
+volatile uint32_t hostArmDwtCtrl = 0;
+
+namespace {
+
+const std::chrono::steady_clock::time_point g_startTime = std::chrono::steady_clock::now();
+
+// Stands in for masking interrupts. It's recursive so nested sections behave the
+// way they do on the Teensy.
+std::recursive_mutex &irqMutex()
+{
+	static std::recursive_mutex mutex;
+	return mutex;
+}
+
+uint64_t elapsedNanoseconds()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - g_startTime).count();
+}
+
+}
+
+/////////////////////////////////////////////////////////////////////
+// String and Serial
+/////////////////////////////////////////////////////////////////////
+std::string String::m_fromInteger(long long value, unsigned char base)
+{
+	if ((base < 2) || (base > 16)) { base = DEC; }
+	// like Arduino, only decimal numbers are printed with a sign
+	unsigned long long magnitude = static_cast<unsigned long long>(value);
+	bool negative = false;
+	if (base == DEC && value < 0) {
+		negative = true;
+		magnitude = 0ULL - magnitude;
+	} else if (base != DEC && value < 0) {
+		magnitude &= 0xFFFFFFFFULL;
+	}
+
+	char digits[66];
+	size_t pos = sizeof(digits);
+	digits[--pos] = '\0';
+	do {
+		digits[--pos] = "0123456789ABCDEF"[magnitude % base];
+		magnitude /= base;
+	} while (magnitude);
+	if (negative) { digits[--pos] = '-'; }
+	return std::string(&digits[pos]);
+}
+
+std::string String::m_fromFloat(double value, unsigned char decimalPlaces)
+{
+	char buffer[64];
+	snprintf(buffer, sizeof(buffer), "%.*f", static_cast<int>(decimalPlaces), value);
+	return std::string(buffer);
+}
+
+void HostSerial::m_write(const String &str)
+{
+	fputs(str.c_str(), stdout);
+}
+
+void HostSerial::flush()
+{
+	fflush(stdout);
+}
+
+int HostSerial::printf(const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int result = vprintf(format, args);
+	va_end(args);
+	return result;
+}
+
+/////////////////////////////////////////////////////////////////////
+// Timing and interrupts
+/////////////////////////////////////////////////////////////////////
+uint32_t hostCycleCount()
+{
+	if (hostBudgetActive()) { return static_cast<uint32_t>(hostBudgetNow()); }
+	return static_cast<uint32_t>((elapsedNanoseconds() * (F_CPU / 1000000ULL)) / 1000ULL);
+}
+
+uint32_t millis()
+{
+	return static_cast<uint32_t>(elapsedNanoseconds() / 1000000ULL);
+}
+
+uint32_t micros()
+{
+	return static_cast<uint32_t>(elapsedNanoseconds() / 1000ULL);
+}
+
+void delay(uint32_t msec)
+{
+	std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+}
+
+void delayMicroseconds(uint32_t usec)
+{
+	std::this_thread::sleep_for(std::chrono::microseconds(usec));
+}
+
+void __disable_irq()
+{
+	irqMutex().lock();
+}
+
+void __enable_irq()
+{
+	irqMutex().unlock();
+}
+
+/////////////////////////////////////////////////////////////////////
+// GPIO, only the memory chip selects do anything
+/////////////////////////////////////////////////////////////////////
+void pinMode(uint8_t pin, uint8_t mode)
+{
+}
+
+void digitalWrite(uint8_t pin, uint8_t value)
+{
+	HostSpiRam *device = HostSpiRam::deviceForPin(pin);
+	if (!device) { return; }
+	if (value == LOW) {
+		hostBudgetSelect(device->index());
+		device->select();
+	}
+	else { device->deselect(); }
+}
+
+int digitalRead(uint8_t pin)
+{
+	return LOW;
+}
+
+/////////////////////////////////////////////////////////////////////
+// SPI and DmaSpi
+/////////////////////////////////////////////////////////////////////
+void SPIClass::beginTransaction(SPISettings settings)
+{
+	m_clockHz = settings.clockHz();
+}
+
+void SPIClass::endTransaction()
+{
+}
+
+uint8_t SPIClass::transfer(uint8_t data)
+{
+	hostBudgetByte(m_spiIndex, m_clockHz);
+	return HostSpiRam::device(m_spiIndex).transfer(data);
+}
+
+uint16_t SPIClass::transfer16(uint16_t data)
+{
+	uint16_t upper = transfer(static_cast<uint8_t>(data >> 8));
+	uint16_t lower = transfer(static_cast<uint8_t>(data & 0xFF));
+	return static_cast<uint16_t>((upper << 8) | lower);
+}
+
+void ActiveLowChipSelect::select(TransferType transferType)
+{
+	// driven by the DMA rather than the CPU, so it goes straight to the memory
+	HostSpiRam *device = HostSpiRam::deviceForPin(m_pin);
+	if (device && (transferType != TransferType::NO_START_CS)) { device->select(); }
+}
+
+void ActiveLowChipSelect::deselect(TransferType transferType)
+{
+	HostSpiRam *device = HostSpiRam::deviceForPin(m_pin);
+	if (device && (transferType != TransferType::NO_END_CS)) { device->deselect(); }
+}
+
+bool DmaSpiGeneric::busy() const
+{
+	return HostSpiRam::device(m_spiIndex).isDmaBusy();
+}
+
+bool DmaSpiGeneric::registerTransfer(DmaSpi::Transfer &transfer)
+{
+	HostSpiRam::device(m_spiIndex).registerTransfer(transfer);
+	return true;
+}
+
+#endif // BAGUITAR_HOST
@@ -0,0 +1,194 @@
+/*
+ * BAHostArmMath.cpp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(BAGUITAR_HOST)
+
+#include <cstring>
+
+#include "arm_math.h"
+
+namespace {
+
+q15_t saturateQ15(int32_t value)
+{
+	if (value > INT16_MAX) { return INT16_MAX; }
+	if (value < INT16_MIN) { return INT16_MIN; }
+	return static_cast<q15_t>(value);
+}
+
+q31_t saturateQ31(q63_t value)
+{
+	if (value > INT32_MAX) { return INT32_MAX; }
+	if (value < INT32_MIN) { return INT32_MIN; }
+	return static_cast<q31_t>(value);
+}
+
+// A 1.63 value times a 1.31 value, keeping the top 64 bits the way CMSIS does
+q63_t mult32x64(q63_t a, q31_t b)
+{
+	q63_t low = static_cast<q63_t>(static_cast<uint32_t>(a)) * b;
+	q63_t high = static_cast<q63_t>(static_cast<q31_t>(a >> 32)) * b;
+	return (low >> 32) + high;
+}
+
+}
+
+void arm_scale_q15(q15_t *pSrc, q15_t scaleFract, int8_t shift, q15_t *pDst, uint32_t blockSize)
+{
+	int kShift = 15 - shift;
+	for (uint32_t i=0; i < blockSize; i++) {
+		pDst[i] = saturateQ15((static_cast<int32_t>(pSrc[i]) * scaleFract) >> kShift);
+	}
+}
+
+void arm_add_q15(q15_t *pSrcA, q15_t *pSrcB, q15_t *pDst, uint32_t blockSize)
+{
+	for (uint32_t i=0; i < blockSize; i++) {
+		pDst[i] = saturateQ15(static_cast<int32_t>(pSrcA[i]) + pSrcB[i]);
+	}
+}
+
+// The product keeps the top 32 bits, then the total shift of shift+1 is applied
+void arm_scale_q31(q31_t *pSrc, q31_t scaleFract, int8_t shift, q31_t *pDst, uint32_t blockSize)
+{
+	int kShift = shift + 1;
+	for (uint32_t i=0; i < blockSize; i++) {
+		q63_t product = static_cast<q63_t>(pSrc[i]) * scaleFract;
+		if (kShift >= 0) {
+			pDst[i] = saturateQ31((product >> 32) * (static_cast<q63_t>(1) << kShift));
+		} else {
+			pDst[i] = static_cast<q31_t>(product >> (32 - kShift));
+		}
+	}
+}
+
+void arm_add_q31(q31_t *pSrcA, q31_t *pSrcB, q31_t *pDst, uint32_t blockSize)
+{
+	for (uint32_t i=0; i < blockSize; i++) {
+		pDst[i] = saturateQ31(static_cast<q63_t>(pSrcA[i]) + pSrcB[i]);
+	}
+}
+
+void arm_biquad_cascade_df1_init_q31(arm_biquad_casd_df1_inst_q31 *S, uint8_t numStages, q31_t *pCoeffs, q31_t *pState,
+		int8_t postShift)
+{
+	S->numStages = numStages;
+	S->pCoeffs = pCoeffs;
+	S->postShift = postShift;
+	memset(pState, 0, 4*numStages*sizeof(q31_t));
+	S->pState = pState;
+}
+
+// The fast version accumulates 32-bit partial products on the Teensy, this one
+// keeps the full 64-bit sum, so the output can differ in the lowest bits.
+void arm_biquad_cascade_df1_fast_q31(const arm_biquad_casd_df1_inst_q31 *S, q31_t *pSrc, q31_t *pDst, uint32_t blockSize)
+{
+	const q31_t *coeffs = S->pCoeffs;
+	q31_t *state = S->pState;
+	int lShift = 31 - S->postShift;
+	const q31_t *input = pSrc;
+
+	for (uint32_t stage=0; stage < S->numStages; stage++) {
+		q31_t b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
+		q31_t x1 = state[0], x2 = state[1], y1 = state[2], y2 = state[3];
+		for (uint32_t i=0; i < blockSize; i++) {
+			q31_t x = input[i];
+			q63_t acc = static_cast<q63_t>(b0)*x + static_cast<q63_t>(b1)*x1 + static_cast<q63_t>(b2)*x2
+					+ static_cast<q63_t>(a1)*y1 + static_cast<q63_t>(a2)*y2;
+			q31_t y = static_cast<q31_t>(acc >> lShift);
+			x2 = x1; x1 = x;
+			y2 = y1; y1 = y;
+			pDst[i] = y;
+		}
+		state[0] = x1; state[1] = x2; state[2] = y1; state[3] = y2;
+		coeffs += 5;
+		state += 4;
+		input = pDst; // later stages work in place on the output
+	}
+}
+
+void arm_biquad_cas_df1_32x64_init_q31(arm_biquad_cas_df1_32x64_ins_q31 *S, uint8_t numStages, q31_t *pCoeffs, q63_t *pState,
+		uint8_t postShift)
+{
+	S->numStages = numStages;
+	S->pCoeffs = pCoeffs;
+	S->postShift = postShift;
+	memset(pState, 0, 4*numStages*sizeof(q63_t));
+	S->pState = pState;
+}
+
+// The outputs are kept in 1.63 for the feedback, only the stage output is cut to 1.31
+void arm_biquad_cas_df1_32x64_q31(const arm_biquad_cas_df1_32x64_ins_q31 *S, q31_t *pSrc, q31_t *pDst, uint32_t blockSize)
+{
+	const q31_t *coeffs = S->pCoeffs;
+	q63_t *state = S->pState;
+	int shift = S->postShift + 1;
+	const q31_t *input = pSrc;
+
+	for (uint32_t stage=0; stage < S->numStages; stage++) {
+		q31_t b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
+		q31_t x1 = static_cast<q31_t>(state[0]), x2 = static_cast<q31_t>(state[1]);
+		q63_t y1 = state[2], y2 = state[3];
+		for (uint32_t i=0; i < blockSize; i++) {
+			q31_t x = input[i];
+			q63_t acc = static_cast<q63_t>(b0)*x + static_cast<q63_t>(b1)*x1 + static_cast<q63_t>(b2)*x2
+					+ mult32x64(y1, a1) + mult32x64(y2, a2);
+			x2 = x1; x1 = x;
+			y2 = y1;
+			y1 = static_cast<q63_t>(static_cast<uint64_t>(acc) << shift);
+			pDst[i] = static_cast<q31_t>(y1 >> 32);
+		}
+		state[0] = x1; state[1] = x2; state[2] = y1; state[3] = y2;
+		coeffs += 5;
+		state += 4;
+		input = pDst;
+	}
+}
+
+void arm_biquad_cascade_df2T_init_f32(arm_biquad_cascade_df2T_instance_f32 *S, uint8_t numStages, float32_t *pCoeffs,
+		float32_t *pState)
+{
+	S->numStages = numStages;
+	S->pCoeffs = pCoeffs;
+	memset(pState, 0, 2*numStages*sizeof(float32_t));
+	S->pState = pState;
+}
+
+void arm_biquad_cascade_df2T_f32(const arm_biquad_cascade_df2T_instance_f32 *S, float32_t *pSrc, float32_t *pDst,
+		uint32_t blockSize)
+{
+	const float32_t *coeffs = S->pCoeffs;
+	float32_t *state = S->pState;
+	const float32_t *input = pSrc;
+
+	for (uint32_t stage=0; stage < S->numStages; stage++) {
+		float32_t b0 = coeffs[0], b1 = coeffs[1], b2 = coeffs[2], a1 = coeffs[3], a2 = coeffs[4];
+		float32_t d1 = state[0], d2 = state[1];
+		for (uint32_t i=0; i < blockSize; i++) {
+			float32_t x = input[i];
+			float32_t y = b0*x + d1;
+			d1 = b1*x + a1*y + d2;
+			d2 = b2*x + a2*y;
+			pDst[i] = y;
+		}
+		state[0] = d1; state[1] = d2;
+		coeffs += 5;
+		state += 2;
+		input = pDst;
+	}
+}
+
+#endif /* BAGUITAR_HOST */
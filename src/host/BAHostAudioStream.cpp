@@ -0,0 +1,132 @@
+/*
+ * BAHostAudioStream.cpp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(BAGUITAR_HOST)
+
+#include <cstring>
+
+#include "AudioStream.h"
+
+constexpr unsigned AudioStream::MAX_OUTPUTS;
+
+namespace {
+
+unsigned g_poolSize = 0xFFFF; // unlimited until AudioMemory() is called
+unsigned g_blocksInUse = 0;
+
+}
+
+AudioStream::AudioStream(unsigned char ninput, audio_block_t **iqueue)
+: m_numInputs(ninput), m_inputQueue(iqueue)
+{
+	for (unsigned i=0; i < m_numInputs; i++) { m_inputQueue[i] = nullptr; }
+}
+
+AudioStream::~AudioStream()
+{
+	for (unsigned i=0; i < m_numInputs; i++) { release(m_inputQueue[i]); }
+	for (unsigned i=0; i < MAX_OUTPUTS; i++) { release(m_outputs[i]); }
+}
+
+// Blocks come from the heap, the pool size only limits how many can be in use
+audio_block_t *AudioStream::allocate(void)
+{
+	__disable_irq();
+	if (g_blocksInUse >= g_poolSize) {
+		__enable_irq();
+		return nullptr;
+	}
+	g_blocksInUse++;
+	__enable_irq();
+
+	audio_block_t *block = new audio_block_t;
+	memset(block, 0, sizeof(audio_block_t));
+	block->ref_count = 1;
+	return block;
+}
+
+void AudioStream::release(audio_block_t *block)
+{
+	if (!block) { return; }
+	__disable_irq();
+	bool free = (--block->ref_count == 0);
+	if (free) { g_blocksInUse--; }
+	__enable_irq();
+	if (free) { delete block; }
+}
+
+void AudioStream::transmit(audio_block_t *block, unsigned char index)
+{
+	if (!block || (index >= MAX_OUTPUTS)) { return; }
+	__disable_irq();
+	block->ref_count++;
+	__enable_irq();
+	// an output nobody collected is dropped, as if it wasn't connected
+	release(m_outputs[index]);
+	m_outputs[index] = block;
+}
+
+audio_block_t *AudioStream::receiveReadOnly(unsigned int index)
+{
+	if (index >= m_numInputs) { return nullptr; }
+	audio_block_t *block = m_inputQueue[index];
+	m_inputQueue[index] = nullptr;
+	return block;
+}
+
+audio_block_t *AudioStream::receiveWritable(unsigned int index)
+{
+	audio_block_t *block = receiveReadOnly(index);
+	if (block && (block->ref_count > 1)) {
+		audio_block_t *copy = allocate();
+		if (copy) { memcpy(copy->data, block->data, sizeof(copy->data)); }
+		release(block);
+		block = copy;
+	}
+	return block;
+}
+
+void AudioStream::hostSetInput(unsigned index, audio_block_t *block)
+{
+	if (index >= m_numInputs) { return; }
+	if (block) {
+		__disable_irq();
+		block->ref_count++;
+		__enable_irq();
+	}
+	release(m_inputQueue[index]);
+	m_inputQueue[index] = block;
+}
+
+audio_block_t *AudioStream::hostTakeOutput(unsigned index)
+{
+	if (index >= MAX_OUTPUTS) { return nullptr; }
+	audio_block_t *block = m_outputs[index];
+	m_outputs[index] = nullptr;
+	return block;
+}
+
+unsigned AudioStream::hostBlocksInUse()
+{
+	return g_blocksInUse;
+}
+
+void AudioStream::hostSetPoolSize(unsigned numBlocks)
+{
+	g_poolSize = numBlocks;
+}
+
+#endif // BAGUITAR_HOST
@@ -0,0 +1,329 @@
+/*
+ * BAHostBudget.cpp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(BAGUITAR_HOST)
+
+#include <thread>
+
+#include "DmaSpi.h"
+#include "BAHostSpiRam.h"
+#include "BAHostBudget.h"
+
+namespace BAGuitar {
+
+// Estimated costs on a Teensy 3.6 at 180 MHz with CMSIS-DSP, in DspKernel order
+constexpr KernelCost DEFAULT_KERNEL_COSTS[NUM_DSP_KERNELS] = {
+	{ 20, 0.25f}, // CLEAR
+	{ 60, 1.0f},  // GAIN
+	{150, 3.0f},  // ALPHA_BLEND
+	{ 60, 2.0f},  // GAIN_24
+	{150, 5.0f},  // ALPHA_BLEND_24
+	{100, 9.0f},  // BIQUAD
+	{100, 18.0f}, // BIQUAD_HQ
+	{100, 11.0f}, // BIQUAD_FLOAT
+	{ 20, 0.5f},  // COPY
+	{ 20, 6.0f},  // PACKED12_ENCODE
+	{ 20, 4.0f},  // PACKED12_DECODE
+	{ 20, 2.5f},  // PACKED24_ENCODE
+	{ 20, 2.5f},  // PACKED24_DECODE
+	{ 20, 1.5f},  // CONVERT_16_TO_24
+	{ 20, 3.0f},  // CONVERT_24_TO_16
+	{ 20, 10.0f}, // MULAW_ENCODE
+	{ 20, 5.0f},  // MULAW_DECODE
+	{ 40, 30.0f}, // ADPCM_ENCODE
+	{ 40, 14.0f}, // ADPCM_DECODE
+	{ 30, 1.5f},  // INTERLEAVE
+	{ 30, 1.5f},  // DEINTERLEAVE
+};
+
+// Names for the report, in DspKernel order
+const char * const DSP_KERNEL_NAMES[NUM_DSP_KERNELS] = {
+	"clear", "gain", "alpha blend", "gain 24-bit", "alpha blend 24-bit",
+	"biquad", "biquad HQ", "biquad float", "copy",
+	"packed12 encode", "packed12 decode", "packed24 encode", "packed24 decode",
+	"convert 16 to 24", "convert 24 to 16", "mulaw encode", "mulaw decode",
+	"adpcm encode", "adpcm decode", "interleave", "deinterleave",
+};
+
+namespace {
+
+// The state of the simulation in progress. Only the thread calling run() touches
+// it, the DMA workers are idle while a simulation runs.
+struct BudgetState {
+	bool active = false;
+	SpiTimingModel model;
+	uint64_t blockPeriodCycles = 0;
+	uint64_t now = 0;                         // the simulated CPU clock
+	uint64_t busFree[NUM_MEM_SLOTS] = {};     // when each bus finishes its last transfer
+	std::vector<uint64_t> busBusy[NUM_MEM_SLOTS]; // busy cycles of the transfers each block's update issued
+	size_t block = 0;                         // the block whose update is running
+	uint64_t dspCycles = 0;
+	uint64_t memoryCycles = 0;
+	uint32_t dmaTransfers = 0;
+	uint64_t kernelCycles[NUM_DSP_KERNELS] = {};
+};
+
+BudgetState g_budget;
+
+uint64_t nsToCycles(uint64_t ns)
+{
+	return (ns * g_budget.model.cpuHz + 999999999ULL) / 1000000000ULL;
+}
+
+// CPU cycles for numBytes on the bus
+uint64_t busCycles(size_t numBytes, uint32_t clockHz)
+{
+	if (g_budget.model.spiClockHz) { clockHz = g_budget.model.spiClockHz; }
+	if (clockHz == 0) { return 0; }
+	return (static_cast<uint64_t>(numBytes) * 8 * g_budget.model.cpuHz + clockHz - 1) / clockHz;
+}
+
+// Charge bus time to the block whose update issued the transfer. Once the chain
+// overruns, the transfers run later than the block period they belong to, but they
+// still count against the block that needed them.
+void addBusyTime(unsigned bus, uint64_t cycles)
+{
+	std::vector<uint64_t> &busy = g_budget.busBusy[bus];
+	if (busy.size() <= g_budget.block) { busy.resize(g_budget.block + 1, 0); }
+	busy[g_budget.block] += cycles;
+}
+
+void chargeMemory(uint64_t cycles)
+{
+	g_budget.now += cycles;
+	g_budget.memoryCycles += cycles;
+}
+
+}
+
+SpiTimingModel::SpiTimingModel()
+{
+	for (unsigned i=0; i < NUM_DSP_KERNELS; i++) { kernels[i] = DEFAULT_KERNEL_COSTS[i]; }
+}
+
+/////////////////////////////////////////////////////////////////////
+// Timing hooks
+/////////////////////////////////////////////////////////////////////
+bool hostBudgetActive()
+{
+	return g_budget.active;
+}
+
+uint64_t hostBudgetNow()
+{
+	return g_budget.now;
+}
+
+// A blocking transaction waits for the bus to be free, as select() does
+void hostBudgetSelect(unsigned bus)
+{
+	if (!g_budget.active || (bus >= NUM_MEM_SLOTS)) { return; }
+	uint64_t ready = g_budget.busFree[bus] + nsToCycles(g_budget.model.csGapNs);
+	if (ready > g_budget.now) { chargeMemory(ready - g_budget.now); }
+	chargeMemory(g_budget.model.transactionCycles);
+}
+
+void hostBudgetByte(unsigned bus, uint32_t clockHz)
+{
+	if (!g_budget.active || (bus >= NUM_MEM_SLOTS)) { return; }
+	uint64_t wire = busCycles(1, clockHz);
+	addBusyTime(bus, wire);
+	chargeMemory(wire + g_budget.model.blockingByteCycles);
+	g_budget.busFree[bus] = g_budget.now;
+}
+
+// The transfer starts once the DMA has been set up and the bus is free. The data
+// half of a command and data pair follows its command without a chip select gap.
+uint64_t hostBudgetDma(unsigned bus, size_t numBytes, uint32_t clockHz, bool startsTransaction)
+{
+	if (!g_budget.active || (bus >= NUM_MEM_SLOTS)) { return 0; }
+	chargeMemory(g_budget.model.dmaSetupCycles);
+	g_budget.dmaTransfers++;
+
+	uint64_t start = g_budget.now + nsToCycles(g_budget.model.dmaLatencyNs);
+	uint64_t ready = g_budget.busFree[bus] + (startsTransaction ? nsToCycles(g_budget.model.csGapNs) : 0);
+	if (ready > start) { start = ready; }
+	uint64_t end = start + busCycles(numBytes, clockHz);
+	addBusyTime(bus, end - start);
+	g_budget.busFree[bus] = end;
+	return end;
+}
+
+bool hostBudgetPending(uint64_t finishCycles)
+{
+	if (!g_budget.active) { return false; }
+	chargeMemory(g_budget.model.pollCycles);
+	return g_budget.now < finishCycles;
+}
+
+void hostProfileKernel(DspKernel kernel, size_t numSamples)
+{
+	if (!g_budget.active) { return; }
+	unsigned index = static_cast<unsigned>(kernel);
+	const KernelCost &cost = g_budget.model.kernels[index];
+	uint64_t cycles = cost.fixedCycles + static_cast<uint64_t>(cost.cyclesPerSample * numSamples + 0.5f);
+	g_budget.now += cycles;
+	g_budget.dspCycles += cycles;
+	g_budget.kernelCycles[index] += cycles;
+}
+
+/////////////////////////////////////////////////////////////////////
+// HostBudgetSimulator
+/////////////////////////////////////////////////////////////////////
+HostBudgetSimulator::HostBudgetSimulator(const SpiTimingModel &model)
+: m_model(model)
+{
+}
+
+void HostBudgetSimulator::addStage(AudioStream &stage)
+{
+	m_stages.push_back(&stage);
+}
+
+void HostBudgetSimulator::setInput(HostInputCallback callback, void *context)
+{
+	m_inputCallback = callback;
+	m_inputContext = context;
+}
+
+BudgetReport HostBudgetSimulator::run(size_t numBlocks)
+{
+	BudgetReport report;
+	if (g_budget.active || (numBlocks == 0)) { return report; }
+
+	// anything queued before the simulation is finished for real first
+	for (unsigned bus=0; bus < NUM_MEM_SLOTS; bus++) {
+		while (HostSpiRam::device(bus).isDmaBusy()) { std::this_thread::yield(); }
+	}
+
+	g_budget = BudgetState();
+	g_budget.model = m_model;
+	g_budget.blockPeriodCycles = static_cast<uint64_t>(
+		(static_cast<double>(AUDIO_BLOCK_SAMPLES) * m_model.cpuHz) / AUDIO_SAMPLE_RATE_EXACT + 0.5);
+	g_budget.active = true;
+
+	report.cpuHz = m_model.cpuHz;
+	report.blockPeriodCycles = static_cast<uint32_t>(g_budget.blockPeriodCycles);
+	report.blocks.resize(numBlocks);
+
+	uint64_t isrEnd = 0;
+	for (size_t blockNumber=0; blockNumber < numBlocks; blockNumber++) {
+		// the update starts with its block period, or late when the last one overran
+		uint64_t blockStart = blockNumber * g_budget.blockPeriodCycles;
+		uint64_t isrStart = (isrEnd > blockStart) ? isrEnd : blockStart;
+		g_budget.now = isrStart;
+		g_budget.block = blockNumber;
+		g_budget.dspCycles = 0;
+		g_budget.memoryCycles = 0;
+		g_budget.dmaTransfers = 0;
+
+		audio_block_t *block = AudioStream::hostAllocate();
+		if (block && m_inputCallback) { m_inputCallback(m_inputContext, blockNumber, block->data); }
+
+		for (AudioStream *stage : m_stages) {
+			g_budget.now += m_model.updateCycles;
+			stage->hostSetInput(0, block);
+			AudioStream::hostRelease(block);
+			stage->update();
+			block = stage->hostTakeOutput(0);
+			for (unsigned output=1; output < AudioStream::MAX_OUTPUTS; output++) {
+				AudioStream::hostRelease(stage->hostTakeOutput(output));
+			}
+		}
+		AudioStream::hostRelease(block);
+		isrEnd = g_budget.now;
+
+		BlockBudget &budget = report.blocks[blockNumber];
+		budget.isrCycles = static_cast<uint32_t>(isrEnd - isrStart);
+		budget.dspCycles = static_cast<uint32_t>(g_budget.dspCycles);
+		budget.memoryCycles = static_cast<uint32_t>(g_budget.memoryCycles);
+		budget.dmaTransfers = g_budget.dmaTransfers;
+		// time lost to a late start comes out of this block's headroom as well
+		budget.headroomCycles = static_cast<int32_t>(
+			static_cast<int64_t>(blockStart + g_budget.blockPeriodCycles) - static_cast<int64_t>(isrEnd));
+	}
+	g_budget.active = false;
+
+	// summarize
+	uint64_t totalIsr = 0;
+	float totalUtilization[NUM_MEM_SLOTS] = {};
+	report.minHeadroomCycles = report.blocks[0].headroomCycles;
+	for (size_t i=0; i < numBlocks; i++) {
+		BlockBudget &budget = report.blocks[i];
+		for (unsigned bus=0; bus < NUM_MEM_SLOTS; bus++) {
+			uint64_t busy = (i < g_budget.busBusy[bus].size()) ? g_budget.busBusy[bus][i] : 0;
+			budget.busUtilization[bus] = static_cast<float>(busy) / g_budget.blockPeriodCycles;
+			totalUtilization[bus] += budget.busUtilization[bus];
+			if (budget.busUtilization[bus] > report.worstBusUtilization[bus]) {
+				report.worstBusUtilization[bus] = budget.busUtilization[bus];
+			}
+		}
+		totalIsr += budget.isrCycles;
+		if (budget.isrCycles > report.worstIsrCycles) {
+			report.worstIsrCycles = budget.isrCycles;
+			report.worstBlock = i;
+		}
+		if (budget.headroomCycles < report.minHeadroomCycles) { report.minHeadroomCycles = budget.headroomCycles; }
+		if (budget.headroomCycles < 0) { report.numOverruns++; }
+	}
+	report.meanIsrCycles = static_cast<uint32_t>(totalIsr / numBlocks);
+	for (unsigned bus=0; bus < NUM_MEM_SLOTS; bus++) {
+		report.meanBusUtilization[bus] = totalUtilization[bus] / numBlocks;
+	}
+	for (unsigned i=0; i < NUM_DSP_KERNELS; i++) { report.kernelCycles[i] = g_budget.kernelCycles[i]; }
+	return report;
+}
+
+/////////////////////////////////////////////////////////////////////
+// BudgetReport
+/////////////////////////////////////////////////////////////////////
+void BudgetReport::print(bool perBlock) const
+{
+	if (blocks.empty()) {
+		Serial.println("BudgetReport: nothing was simulated");
+		return;
+	}
+	Serial.println(String("Blocks: ") + blocks.size() + String(", block period ") + cyclesToUs(blockPeriodCycles)
+		+ String(" us (") + blockPeriodCycles + String(" cycles)"));
+	Serial.println(String("Worst ISR: ") + cyclesToUs(worstIsrCycles) + String(" us (")
+		+ (100.0f * worstIsrCycles / blockPeriodCycles) + String("%) in block ") + worstBlock
+		+ String(", mean ") + cyclesToUs(meanIsrCycles) + String(" us"));
+	Serial.println(String("Min headroom: ") + cyclesToUs(minHeadroomCycles) + String(" us, overruns: ") + numOverruns);
+	for (unsigned bus=0; bus < NUM_MEM_SLOTS; bus++) {
+		Serial.println(String("SPI") + bus + String(" bus utilization: worst ") + (100.0f * worstBusUtilization[bus])
+			+ String("%, mean ") + (100.0f * meanBusUtilization[bus]) + String("%"));
+	}
+	Serial.println("DSP kernels:");
+	for (unsigned i=0; i < NUM_DSP_KERNELS; i++) {
+		if (kernelCycles[i] == 0) { continue; }
+		Serial.println(String("  ") + DSP_KERNEL_NAMES[i] + String(": ") + cyclesToUs(kernelCycles[i] / blocks.size())
+			+ String(" us per block"));
+	}
+
+	if (!perBlock) { return; }
+	Serial.println("block, isr us, dsp us, memory us, dma transfers, spi0 %, spi1 %, headroom us");
+	for (size_t i=0; i < blocks.size(); i++) {
+		const BlockBudget &budget = blocks[i];
+		Serial.println(String(i) + String(", ") + cyclesToUs(budget.isrCycles) + String(", ")
+			+ cyclesToUs(budget.dspCycles) + String(", ") + cyclesToUs(budget.memoryCycles) + String(", ")
+			+ budget.dmaTransfers + String(", ") + (100.0f * budget.busUtilization[0]) + String(", ")
+			+ (100.0f * budget.busUtilization[1]) + String(", ") + cyclesToUs(budget.headroomCycles));
+	}
+}
+
+}
+
+#endif // BAGUITAR_HOST
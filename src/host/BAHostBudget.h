@@ -0,0 +1,175 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  HostBudgetSimulator checks whether a chain of audio objects fits in the
+ *  audio block period before it is tried on the hardware.
+ *  @details The chain runs on the host, see BAHost.h, against a simulated clock
+ *  instead of the wall clock. Time on the clock comes from a timing model of the
+ *  Teensy and the SPI RAMs:
+ *  - blocking SPI transfers take as long as the bytes take at the SPI clock, plus
+ *    CPU overhead per transaction and per byte.
+ *  - DMA transfers cost the CPU only to set up, and are scheduled on a timeline
+ *    for each SPI bus. The memory code sends them in chunks of at most
+ *    MAX_DMA_XFER_SIZE bytes, exactly as on the Teensy. A transfer stays busy
+ *    until the timeline reaches its end, and each check of its state costs the
+ *    CPU a few cycles, so time spent waiting on the memory is counted.
+ *  - the DSP kernels charge a cost per call and per sample, see LibKernelProfile.h.
+ *  The simulator reports for each block how long the audio update took, how
+ *  busy each SPI bus was, and how much of the block period was left over.
+ *  The default costs are estimates for a Teensy 3.6 at 180 MHz using CMSIS-DSP.
+ *  They can be replaced with measurements in SpiTimingModel.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_BAHOSTBUDGET_H
+#define __BAGUITAR_BAHOSTBUDGET_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Arduino.h"
+#include "AudioStream.h"
+#include "BAHost.h"
+#include "LibKernelProfile.h"
+
+namespace BAGuitar {
+
+/// The number of DSP kernels in the cost table
+constexpr unsigned NUM_DSP_KERNELS = static_cast<unsigned>(DspKernel::NUM_KERNELS);
+
+/// The cost of a DSP kernel on the Teensy
+struct KernelCost {
+	uint32_t fixedCycles;  ///< cycles per call
+	float cyclesPerSample; ///< cycles per sample processed
+};
+
+/// Timing of the Teensy and the SPI RAMs used by HostBudgetSimulator
+struct SpiTimingModel {
+	SpiTimingModel();
+
+	uint32_t cpuHz = F_CPU;              ///< the CPU clock
+	uint32_t spiClockHz = 0;             ///< when not zero, replaces the SPI clock the memories are set up with
+	uint32_t csGapNs = 50;               ///< chip select high time between SPI transactions
+	uint32_t dmaLatencyNs = 1000;        ///< time from registering a DMA transfer until it can start on the bus
+	uint32_t dmaSetupCycles = 250;       ///< CPU cycles to register a DMA transfer
+	uint32_t transactionCycles = 80;     ///< CPU cycles to start a blocking SPI transaction
+	uint32_t blockingByteCycles = 12;    ///< CPU cycles per blocking byte on top of its time on the bus
+	uint32_t pollCycles = 40;            ///< CPU cycles to check the state of a DMA transfer
+	uint32_t updateCycles = 400;         ///< CPU cycles of audio library overhead for each update()
+	KernelCost kernels[NUM_DSP_KERNELS]; ///< cost of each DSP kernel, indexed by DspKernel
+};
+
+/// The budget of one audio block
+struct BlockBudget {
+	uint32_t isrCycles = 0;                 ///< CPU cycles spent in the audio update
+	uint32_t dspCycles = 0;                 ///< part of isrCycles spent in DSP kernels
+	uint32_t memoryCycles = 0;              ///< part of isrCycles spent on SPI transfers and waiting for them
+	uint32_t dmaTransfers = 0;              ///< DMA transfers registered, each chunk is a command and a data transfer
+	float busUtilization[NUM_MEM_SLOTS] = {}; ///< bus time of the transfers the block's update issued, as a fraction
+	                                          ///< of the block period. Above 1 the bus can't keep up with the chain.
+	int32_t headroomCycles = 0;             ///< cycles left in the block period, negative when the update overran
+};
+
+/// The results of HostBudgetSimulator::run()
+struct BudgetReport {
+	uint32_t cpuHz = 0;                 ///< the CPU clock the cycles are counted at
+	uint32_t blockPeriodCycles = 0;     ///< the audio block period in CPU cycles
+	std::vector<BlockBudget> blocks;    ///< the budget of each block
+	size_t worstBlock = 0;              ///< the block with the longest audio update
+	uint32_t worstIsrCycles = 0;        ///< the longest audio update
+	uint32_t meanIsrCycles = 0;         ///< the average audio update
+	int32_t minHeadroomCycles = 0;      ///< the least time left in a block period
+	float worstBusUtilization[NUM_MEM_SLOTS] = {}; ///< the highest busUtilization of any block on each SPI bus
+	float meanBusUtilization[NUM_MEM_SLOTS] = {};  ///< the average utilization of each SPI bus
+	size_t numOverruns = 0;             ///< blocks where the update took longer than the block period
+	uint64_t kernelCycles[NUM_DSP_KERNELS] = {}; ///< total cycles of each DSP kernel over the run
+
+	/// Check the chain fits in the block period every time
+	bool fits() const { return numOverruns == 0; }
+
+	/// Convert CPU cycles to microseconds
+	float cyclesToUs(int64_t cycles) const { return (1.0e6f * cycles) / cpuHz; }
+
+	/// Print a summary to Serial
+	/// @param perBlock when true the budget of every block is printed as well
+	void print(bool perBlock = false) const;
+};
+
+/// Called by the simulator to fill the input block of the chain
+/// @param context the user pointer given to setInput()
+/// @param blockNumber the number of the block, from 0
+/// @param samples the AUDIO_BLOCK_SAMPLES samples to fill
+typedef void (*HostInputCallback)(void *context, size_t blockNumber, int16_t *samples);
+
+/**************************************************************************//**
+ * HostBudgetSimulator runs a chain of audio objects block by block against
+ * the timing model, and reports how much of each block period they use.
+ * @details Set up the objects, and any memory they use, before calling run().
+ * Only one simulator runs at a time. While run() is in progress DMA transfers
+ * are carried out right away by the calling thread, and ARM_DWT_CYCCNT reads
+ * the simulated clock, so the memory's own SpiMemStats count simulated cycles.
+ *****************************************************************************/
+class HostBudgetSimulator {
+public:
+	/// Construct a simulator
+	/// @param model the timing model
+	HostBudgetSimulator(const SpiTimingModel &model = SpiTimingModel());
+
+	/// Add an audio object to the end of the chain. Output 0 of each object
+	/// feeds input 0 of the next one.
+	/// @param stage the audio object
+	void addStage(AudioStream &stage);
+
+	/// Set the source of the input to the chain. Without one the input is silence.
+	/// @param callback function that fills each input block
+	/// @param context user pointer passed to the callback
+	void setInput(HostInputCallback callback, void *context = nullptr);
+
+	/// Run the chain for a number of blocks
+	/// @param numBlocks the number of audio blocks to simulate
+	/// @returns the budget of each block and a summary
+	BudgetReport run(size_t numBlocks);
+
+private:
+	SpiTimingModel m_model;
+	std::vector<AudioStream*> m_stages;
+	HostInputCallback m_inputCallback = nullptr;
+	void *m_inputContext = nullptr;
+};
+
+/////////////////////////////////////////////////////////////////////
+// Called by the host versions of SPI and DmaSpi to account for time
+/////////////////////////////////////////////////////////////////////
+/// Check if a simulation is running
+bool hostBudgetActive();
+/// The simulated CPU clock in cycles
+uint64_t hostBudgetNow();
+/// A blocking SPI transaction starts on a bus
+void hostBudgetSelect(unsigned bus);
+/// A blocking byte is clocked through a bus
+void hostBudgetByte(unsigned bus, uint32_t clockHz);
+/// A DMA transfer is registered on a bus
+/// @returns the simulated time the transfer finishes
+uint64_t hostBudgetDma(unsigned bus, size_t numBytes, uint32_t clockHz, bool startsTransaction);
+
+}
+
+#endif /* __BAGUITAR_BAHOSTBUDGET_H */
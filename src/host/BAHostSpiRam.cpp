@@ -0,0 +1,385 @@
+/*
+ * BAHostSpiRam.cpp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+#if defined(BAGUITAR_HOST)
+
+#include <chrono>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "DmaSpi.h"
+#include "BAHostSpiRam.h"
+#include "BAHostBudget.h"
+
+namespace BAGuitar {
+
+// Chip selects, these match the MEM0 and MEM1 settings in BASpiMemory.cpp
+constexpr int HOST_CS_MEM0 = 15;
+constexpr int HOST_CS_MEM1 = 31;
+
+// SPI commands understood by the 23LC1024 and the ESP-PSRAM64
+constexpr uint8_t CMD_WRITE_MODE_REG = 0x1;
+constexpr uint8_t CMD_WRITE = 0x2;
+constexpr uint8_t CMD_READ = 0x3;
+constexpr uint8_t CMD_READ_MODE_REG = 0x5;
+constexpr uint8_t CMD_FAST_READ = 0x0B;
+constexpr uint8_t CMD_RESET_ENABLE = 0x66;
+constexpr uint8_t CMD_RESET = 0x99;
+constexpr uint8_t CMD_READ_ID = 0x9F;
+constexpr uint8_t CMD_RESET_IO = 0xFF;
+
+constexpr size_t ADDRESS_BYTES = 3;
+constexpr size_t FAST_READ_WAIT_BYTES = 1;
+constexpr uint8_t MISO_FLOATING = 0xFF;
+
+// 23LC1024 mode register
+constexpr uint8_t MODE_MASK = 0xC0;
+constexpr uint8_t MODE_BYTE = 0x00;
+constexpr uint8_t MODE_PAGE = 0x80;
+constexpr uint8_t MODE_SEQUENTIAL = 0x40;
+constexpr size_t SRAM_PAGE_SIZE = 32;
+
+// ESP-PSRAM64 ID, bursts wrap within a page
+constexpr uint8_t PSRAM_MFID = 0x0D;
+constexpr uint8_t PSRAM_KGD_PASS = 0x5D;
+constexpr size_t PSRAM_PAGE_SIZE = 1024;
+
+constexpr unsigned HostSpiRam::NUM_DEVICES;
+
+HostSpiRam &HostSpiRam::device(unsigned index)
+{
+	// constructed on first use and destroyed in reverse order at exit, which stops the workers
+	static HostSpiRam device0(0);
+	static HostSpiRam device1(1);
+	return (index == 0) ? device0 : device1;
+}
+
+HostSpiRam *HostSpiRam::deviceForPin(int pin)
+{
+	switch (pin) {
+	case HOST_CS_MEM0 : return &device(0);
+	case HOST_CS_MEM1 : return &device(1);
+	default : return nullptr;
+	}
+}
+
+HostSpiRam::HostSpiRam(unsigned index)
+: m_index(index)
+{
+	configure(HostSpiRamConfig());
+}
+
+HostSpiRam::~HostSpiRam()
+{
+	if (m_thread.joinable()) {
+		{
+			std::lock_guard<std::mutex> lock(m_queueMutex);
+			m_stopping = true;
+		}
+		m_queueChanged.notify_all();
+		m_thread.join();
+	}
+	m_unmap();
+}
+
+bool HostSpiRam::configure(const HostSpiRamConfig &config)
+{
+	// the size must be a power of two so addresses can wrap like they do on the real parts
+	if ((config.sizeBytes == 0) || (config.sizeBytes & (config.sizeBytes-1))) { return false; }
+	while (isDmaBusy()) { std::this_thread::yield(); }
+
+	int fd = -1;
+	void *memory;
+	if (config.path) {
+		fd = open(config.path, O_RDWR | O_CREAT, 0644);
+		if (fd < 0) { return false; }
+		if (ftruncate(fd, static_cast<off_t>(config.sizeBytes)) != 0) {
+			close(fd);
+			return false;
+		}
+		memory = mmap(nullptr, config.sizeBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	} else {
+		memory = mmap(nullptr, config.sizeBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+	if (memory == MAP_FAILED) {
+		if (fd >= 0) { close(fd); }
+		return false;
+	}
+
+	m_unmap();
+	m_memory = static_cast<uint8_t*>(memory);
+	m_size = config.sizeBytes;
+	m_mappedSize = config.sizeBytes;
+	m_fd = fd;
+	m_psram = config.psram;
+	m_realTime = config.realTime;
+	m_mode = MODE_SEQUENTIAL;
+	m_phase = Phase::COMMAND;
+	return true;
+}
+
+void HostSpiRam::m_unmap()
+{
+	if (m_memory) {
+		if (m_fd >= 0) { msync(m_memory, m_mappedSize, MS_SYNC); }
+		munmap(m_memory, m_mappedSize);
+	}
+	if (m_fd >= 0) { close(m_fd); }
+	m_memory = nullptr;
+	m_fd = -1;
+}
+
+void HostSpiRam::sync()
+{
+	if (m_memory && (m_fd >= 0)) { msync(m_memory, m_mappedSize, MS_SYNC); }
+}
+
+// Chip select can be driven by the program with digitalWrite() or by the DMA worker,
+// so ownership of the bus is passed between threads.
+void HostSpiRam::select()
+{
+	std::unique_lock<std::mutex> lock(m_selectMutex);
+	m_selectChanged.wait(lock, [this] { return !m_selected; });
+	m_selected = true;
+	m_phase = Phase::COMMAND;
+	m_count = 0;
+}
+
+void HostSpiRam::deselect()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_selectMutex);
+		if (!m_selected) { return; }
+		m_selected = false;
+	}
+	m_selectChanged.notify_all();
+}
+
+// Move to the next byte of a burst, wrapping at the page or the end of the memory
+void HostSpiRam::m_advance()
+{
+	size_t wrap = m_size;
+	if (m_psram) {
+		wrap = PSRAM_PAGE_SIZE;
+	} else if ((m_mode & MODE_MASK) == MODE_PAGE) {
+		wrap = SRAM_PAGE_SIZE;
+	}
+	m_address = (m_address & ~(wrap-1)) | ((m_address+1) & (wrap-1));
+	if (!m_psram && ((m_mode & MODE_MASK) == MODE_BYTE)) {
+		// byte mode transfers a single byte per command
+		m_phase = Phase::IGNORE;
+	}
+}
+
+uint8_t HostSpiRam::transfer(uint8_t out)
+{
+	uint8_t in = MISO_FLOATING;
+	if (!m_selected) { return in; }
+
+	switch (m_phase) {
+	case Phase::COMMAND :
+		m_command = out;
+		m_count = 0;
+		m_address = 0;
+		switch (out) {
+		case CMD_READ :
+		case CMD_WRITE :
+		case CMD_FAST_READ :
+			m_phase = Phase::ADDRESS;
+			break;
+		case CMD_READ_MODE_REG :
+		case CMD_WRITE_MODE_REG :
+			m_phase = m_psram ? Phase::IGNORE : Phase::RESPONSE;
+			break;
+		case CMD_READ_ID :
+			m_phase = Phase::RESPONSE;
+			break;
+		case CMD_RESET_ENABLE :
+		case CMD_RESET :
+			if (m_psram && (out == CMD_RESET)) { m_mode = MODE_SEQUENTIAL; }
+			m_phase = Phase::IGNORE;
+			break;
+		case CMD_RESET_IO :
+		default :
+			m_phase = Phase::IGNORE;
+			break;
+		}
+		break;
+
+	case Phase::ADDRESS :
+		m_address = (m_address << 8) | out;
+		if (++m_count == ADDRESS_BYTES) {
+			m_address &= (m_size-1);
+			m_count = 0;
+			m_phase = (m_psram && (m_command == CMD_FAST_READ)) ? Phase::WAIT : Phase::DATA;
+		}
+		break;
+
+	case Phase::WAIT :
+		if (++m_count == FAST_READ_WAIT_BYTES) { m_phase = Phase::DATA; }
+		break;
+
+	case Phase::DATA :
+		if (m_command == CMD_WRITE) {
+			m_memory[m_address] = out;
+		} else {
+			in = m_memory[m_address];
+		}
+		m_advance();
+		break;
+
+	case Phase::RESPONSE :
+		if (m_command == CMD_READ_MODE_REG) {
+			in = m_mode;
+			m_phase = Phase::IGNORE;
+		} else if (m_command == CMD_WRITE_MODE_REG) {
+			m_mode = out;
+			m_phase = Phase::IGNORE;
+		} else if (m_psram) {
+			// READ_ID : three address bytes, then the manufacturer ID and the KGD byte
+			m_count++;
+			if (m_count == ADDRESS_BYTES+1) { in = PSRAM_MFID; }
+			else if (m_count == ADDRESS_BYTES+2) { in = PSRAM_KGD_PASS; }
+			else if (m_count > ADDRESS_BYTES+2) { in = 0; }
+		}
+		break;
+
+	case Phase::IGNORE :
+	default :
+		break;
+	}
+	return in;
+}
+
+// Data phases are copied in runs up to the next wrap point, everything else goes
+// through the byte decoder.
+void HostSpiRam::transfer(const uint8_t *src, volatile uint8_t *dest, size_t numBytes, uint8_t fill)
+{
+	size_t i = 0;
+	while (i < numBytes) {
+		bool burst = m_selected && (m_phase == Phase::DATA) &&
+			(m_psram || ((m_mode & MODE_MASK) != MODE_BYTE));
+		if (!burst) {
+			uint8_t in = transfer(src ? src[i] : fill);
+			if (dest) { dest[i] = in; }
+			i++;
+			continue;
+		}
+
+		size_t wrap = m_psram ? PSRAM_PAGE_SIZE :
+			(((m_mode & MODE_MASK) == MODE_PAGE) ? SRAM_PAGE_SIZE : m_size);
+		size_t run = wrap - (m_address & (wrap-1));
+		if (run > numBytes - i) { run = numBytes - i; }
+
+		if (m_command == CMD_WRITE) {
+			if (src) { memcpy(&m_memory[m_address], &src[i], run); }
+			else { memset(&m_memory[m_address], fill, run); }
+			if (dest) {
+				for (size_t j=0; j < run; j++) { dest[i+j] = MISO_FLOATING; }
+			}
+		} else if (dest) {
+			// the destination is volatile so it's filled a byte at a time
+			const uint8_t *memPtr = &m_memory[m_address];
+			for (size_t j=0; j < run; j++) { dest[i+j] = memPtr[j]; }
+		}
+		m_address = (m_address & ~(wrap-1)) | ((m_address + run) & (wrap-1));
+		i += run;
+	}
+}
+
+void HostSpiRam::registerTransfer(DmaSpi::Transfer &transfer)
+{
+	if (hostBudgetActive()) {
+		// the data moves right away, the timing model decides when the transfer is done
+		AbstractChipSelect *cs = transfer.m_pSelect;
+		if (cs) { cs->select(transfer.m_transferType); }
+		this->transfer(transfer.m_pSource, transfer.m_pDest, transfer.m_transferCount, transfer.m_fill);
+		if (cs) { cs->deselect(transfer.m_transferType); }
+		transfer.m_hostFinishCycles = hostBudgetDma(m_index, transfer.m_transferCount, cs ? cs->clockHz() : 0,
+			transfer.m_transferType != TransferType::NO_START_CS);
+		transfer.m_state = DmaSpi::Transfer::State::done;
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	transfer.m_state = DmaSpi::Transfer::State::pending;
+	m_queue.push_back(&transfer);
+	if (!m_thread.joinable()) {
+		m_thread = std::thread(&HostSpiRam::m_worker, this);
+	}
+	m_queueChanged.notify_all();
+}
+
+bool HostSpiRam::isDmaBusy()
+{
+	std::lock_guard<std::mutex> lock(m_queueMutex);
+	return m_dmaActive || !m_queue.empty();
+}
+
+// The worker carries out the transfers one at a time in the order they were
+// registered, the same as the DMA engine.
+void HostSpiRam::m_worker()
+{
+	std::unique_lock<std::mutex> lock(m_queueMutex);
+	while (true) {
+		m_queueChanged.wait(lock, [this] { return m_stopping || !m_queue.empty(); });
+		if (m_queue.empty()) { return; }
+
+		DmaSpi::Transfer *transfer = m_queue.front();
+		m_queue.pop_front();
+		m_dmaActive = true;
+		lock.unlock();
+
+		auto start = std::chrono::steady_clock::now();
+		transfer->m_state = DmaSpi::Transfer::State::inProgress;
+		AbstractChipSelect *cs = transfer->m_pSelect;
+		if (cs) { cs->select(transfer->m_transferType); }
+		this->transfer(transfer->m_pSource, transfer->m_pDest, transfer->m_transferCount, transfer->m_fill);
+		if (cs) { cs->deselect(transfer->m_transferType); }
+
+		if (m_realTime && cs && cs->clockHz()) {
+			auto duration = std::chrono::nanoseconds(
+				(static_cast<uint64_t>(transfer->m_transferCount) * 8 * 1000000000ULL) / cs->clockHz());
+			std::this_thread::sleep_until(start + duration);
+		}
+
+		lock.lock();
+		m_dmaActive = false;
+		transfer->m_state = DmaSpi::Transfer::State::done;
+	}
+}
+
+bool hostConfigureSpiRam(SpiDeviceId device, const HostSpiRamConfig &config)
+{
+	return HostSpiRam::device(static_cast<unsigned>(device)).configure(config);
+}
+
+void hostSyncSpiRam(SpiDeviceId device)
+{
+	HostSpiRam::device(static_cast<unsigned>(device)).sync();
+}
+
+uint8_t *hostSpiRamContents(SpiDeviceId device)
+{
+	return HostSpiRam::device(static_cast<unsigned>(device)).contents();
+}
+
+}
+
+#endif // BAGUITAR_HOST
@@ -0,0 +1,148 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  HostSpiRam emulates the SPI RAM on one SPI bus of the TGA Pro for host builds.
+ *  It is used by the host versions of SPI.h and DmaSpi.h, see BAHost.h.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_BAHOSTSPIRAM_H
+#define __BAGUITAR_BAHOSTSPIRAM_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#include "BAHost.h"
+
+namespace DmaSpi { class Transfer; }
+
+namespace BAGuitar {
+
+/**************************************************************************//**
+ * HostSpiRam decodes the SPI commands sent to one memory and carries them out
+ * on a memory mapped file.
+ * @details Blocking transfers are clocked through transfer() by the calling
+ * thread. DMA transfers are queued with registerTransfer() and carried out by
+ * the bus worker thread. Chip select is shared, so a blocking transaction waits
+ * for the DMA transaction in progress to end, and vice versa.
+ *****************************************************************************/
+class HostSpiRam {
+public:
+	/// The number of emulated SPI buses, one memory on each
+	static constexpr unsigned NUM_DEVICES = NUM_MEM_SLOTS;
+
+	/// Get the memory on an SPI bus
+	/// @param index the bus, 0 for MEM0 and 1 for MEM1
+	/// @returns the memory, created with the default configuration on first use
+	static HostSpiRam &device(unsigned index);
+
+	/// Get the memory that uses a chip select pin
+	/// @param pin the Teensy pin number
+	/// @returns the memory, or nullptr if the pin isn't a memory chip select
+	static HostSpiRam *deviceForPin(int pin);
+
+	HostSpiRam(const HostSpiRam&) = delete;
+	HostSpiRam& operator=(const HostSpiRam&) = delete;
+	~HostSpiRam();
+
+	/// Replace the memory, see hostConfigureSpiRam()
+	bool configure(const HostSpiRamConfig &config);
+
+	/// Write changes to the memory file back to the disk
+	void sync();
+
+	/// Get the memory contents
+	uint8_t *contents() const { return m_memory; }
+
+	/// Get the SPI bus the memory is on
+	unsigned index() const { return m_index; }
+
+	/// Drive chip select low, waiting until no other transaction is in progress
+	void select();
+
+	/// Drive chip select high, ending the transaction
+	void deselect();
+
+	/// Clock one byte through the memory
+	/// @param out the byte sent on MOSI
+	/// @returns the byte received on MISO
+	uint8_t transfer(uint8_t out);
+
+	/// Clock a block of bytes through the memory
+	/// @param src the bytes to send, nullptr sends fill
+	/// @param dest where to put the received bytes, nullptr discards them
+	/// @param numBytes the number of bytes to clock
+	/// @param fill the byte sent when src is nullptr
+	void transfer(const uint8_t *src, volatile uint8_t *dest, size_t numBytes, uint8_t fill);
+
+	/// Queue a DMA transfer for the worker thread
+	/// @param transfer the transfer, which is marked done when it completes
+	void registerTransfer(DmaSpi::Transfer &transfer);
+
+	/// Check if DMA transfers are queued or in progress
+	bool isDmaBusy();
+
+private:
+	/// Where the memory is in decoding the current transaction
+	enum class Phase {
+		COMMAND,  ///< waiting for the command byte
+		ADDRESS,  ///< receiving the 24-bit address
+		WAIT,     ///< wait cycles before read data
+		DATA,     ///< reading or writing data
+		RESPONSE, ///< answering a register or ID read
+		IGNORE,   ///< unsupported command, MISO is left floating high
+	};
+
+	explicit HostSpiRam(unsigned index);
+	void m_unmap();
+	void m_worker();
+	void m_advance();
+
+	unsigned m_index;
+	uint8_t *m_memory = nullptr;
+	size_t m_size = 0;
+	size_t m_mappedSize = 0;
+	int m_fd = -1;
+	bool m_psram = false;
+	bool m_realTime = false;
+	uint8_t m_mode = 0x40;             ///< mode register, sequential after power up
+
+	Phase m_phase = Phase::COMMAND;
+	uint8_t m_command = 0;
+	size_t m_count = 0;                ///< bytes received in the current phase
+	size_t m_address = 0;
+
+	std::mutex m_selectMutex;
+	std::condition_variable m_selectChanged;
+	bool m_selected = false;
+
+	std::mutex m_queueMutex;
+	std::condition_variable m_queueChanged;
+	std::deque<DmaSpi::Transfer*> m_queue;
+	bool m_dmaActive = false;          ///< the worker is carrying out a transfer
+	bool m_stopping = false;
+	std::thread m_thread;
+};
+
+}
+
+#endif /* __BAGUITAR_BAHOSTSPIRAM_H */
@@ -0,0 +1,150 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  Host version of the parts of the DmaSpi library used by BASpiMemoryDMA.
+ *  Registered transfers are carried out by the worker thread of the emulated
+ *  SPI RAM, in the order they were registered, see BAHost.h. While a budget
+ *  simulation runs they finish on the simulated clock, see BAHostBudget.h.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_HOST_DMASPI_H
+#define __BAGUITAR_HOST_DMASPI_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <atomic>
+#include <cstdint>
+
+#include "SPI.h"
+
+/// Which ends of a transfer drive the chip select
+enum class TransferType {
+	NORMAL,      ///< select before and deselect after the transfer
+	NO_START_CS, ///< the chip is already selected by the previous transfer
+	NO_END_CS,   ///< leave the chip selected for the next transfer
+};
+
+/// Chip select used by a DMA transfer
+class AbstractChipSelect {
+public:
+	virtual ~AbstractChipSelect() {}
+	/// Select the chip at the start of a transfer
+	virtual void select(TransferType transferType = TransferType::NORMAL) = 0;
+	/// Deselect the chip at the end of a transfer
+	virtual void deselect(TransferType transferType = TransferType::NORMAL) = 0;
+	/// The SPI clock used while the chip is selected
+	virtual uint32_t clockHz() const = 0;
+};
+
+/// Active low chip select on SPI0
+class ActiveLowChipSelect : public AbstractChipSelect {
+public:
+	ActiveLowChipSelect(const unsigned int &pin, const SPISettings &settings)
+	: m_pin(pin), m_settings(settings) {}
+	void select(TransferType transferType = TransferType::NORMAL) override;
+	void deselect(TransferType transferType = TransferType::NORMAL) override;
+	uint32_t clockHz() const override { return m_settings.clockHz(); }
+private:
+	unsigned int m_pin;
+	SPISettings m_settings;
+};
+
+/// Active low chip select on SPI1
+class ActiveLowChipSelect1 : public ActiveLowChipSelect {
+public:
+	ActiveLowChipSelect1(const unsigned int &pin, const SPISettings &settings)
+	: ActiveLowChipSelect(pin, settings) {}
+};
+
+namespace BAGuitar {
+/// Check if a transfer is still in progress on the simulated clock, see BAHostBudget.h
+bool hostBudgetPending(uint64_t finishCycles);
+}
+
+namespace DmaSpi {
+
+/// A block of bytes to clock through the SPI port with DMA
+class Transfer {
+public:
+	/// Progress of the transfer, done once the worker has finished it
+	enum class State {
+		idle,
+		done,
+		pending,
+		inProgress,
+		error
+	};
+
+	Transfer(const uint8_t *pSource = nullptr, const uint16_t &transferCount = 0, volatile uint8_t *pDest = nullptr,
+		const uint8_t &fill = 0, AbstractChipSelect *pSelect = nullptr, TransferType transferType = TransferType::NORMAL)
+	: m_state(State::idle), m_pSource(pSource), m_transferCount(transferCount), m_pDest(pDest), m_fill(fill),
+	  m_pSelect(pSelect), m_transferType(transferType) {}
+
+	Transfer(const Transfer &other) { *this = other; }
+	Transfer& operator=(const Transfer &other) {
+		m_state = other.m_state.load();
+		m_pSource = other.m_pSource;
+		m_transferCount = other.m_transferCount;
+		m_pDest = other.m_pDest;
+		m_fill = other.m_fill;
+		m_pSelect = other.m_pSelect;
+		m_transferType = other.m_transferType;
+		m_hostFinishCycles = other.m_hostFinishCycles;
+		return *this;
+	}
+
+	/// Check if the transfer is waiting for or in the worker
+	bool busy() const {
+		if (BAGuitar::hostBudgetPending(m_hostFinishCycles)) { return true; }
+		State state = m_state;
+		return (state == State::pending) || (state == State::inProgress) || (state == State::error);
+	}
+
+	/// Check if the transfer has completed
+	bool done() const { return !BAGuitar::hostBudgetPending(m_hostFinishCycles) && (m_state == State::done); }
+
+	std::atomic<State> m_state;
+	const uint8_t *m_pSource;
+	uint16_t m_transferCount;
+	volatile uint8_t *m_pDest;
+	uint8_t m_fill;
+	AbstractChipSelect *m_pSelect;
+	TransferType m_transferType;
+	uint64_t m_hostFinishCycles = 0; ///< when the transfer finishes on the simulated clock
+};
+
+}
+
+/// Queues transfers for the emulated SPI RAM on one SPI bus
+class DmaSpiGeneric {
+public:
+	/// @param spiIndex 0 for SPI, 1 for SPI1
+	explicit DmaSpiGeneric(int spiIndex = 0) : m_spiIndex(spiIndex) {}
+	bool begin() { return true; }
+	void start() {}
+	void stop() {}
+	/// Check if transfers are queued or in progress
+	bool busy() const;
+	/// Queue a transfer, it is marked done when it completes
+	bool registerTransfer(DmaSpi::Transfer &transfer);
+private:
+	int m_spiIndex;
+};
+
+#endif /* __BAGUITAR_HOST_DMASPI_H */
@@ -0,0 +1,80 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  Host version of the parts of the Arduino SPI library used by BASpiMemory.
+ *  SPI talks to the emulated SPI RAM on MEM0 and SPI1 to the one on MEM1, see
+ *  BAHost.h.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_HOST_SPI_H
+#define __BAGUITAR_HOST_SPI_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <cstdint>
+
+#include "Arduino.h"
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x04
+#define SPI_MODE2 0x08
+#define SPI_MODE3 0x0C
+
+/// Clock, bit order and mode for an SPI transaction
+class SPISettings {
+public:
+	SPISettings() {}
+	SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode)
+	: m_clock(clock), m_bitOrder(bitOrder), m_dataMode(dataMode) {}
+	/// The requested SPI clock
+	uint32_t clockHz() const { return m_clock; }
+private:
+	uint32_t m_clock = 4000000;
+	uint8_t m_bitOrder = MSBFIRST;
+	uint8_t m_dataMode = SPI_MODE0;
+};
+
+/// An SPI port, with the emulated SPI RAM attached
+class SPIClass {
+public:
+	/// @param spiIndex 0 for SPI, 1 for SPI1
+	explicit SPIClass(unsigned spiIndex) : m_spiIndex(spiIndex) {}
+	void begin() {}
+	void end() {}
+	void setMOSI(uint8_t pin) {}
+	void setMISO(uint8_t pin) {}
+	void setSCK(uint8_t pin) {}
+	void usingInterrupt(uint8_t interruptNumber) {}
+	void beginTransaction(SPISettings settings);
+	void endTransaction();
+	/// Clock a byte out and return the byte clocked in
+	uint8_t transfer(uint8_t data);
+	/// Clock a word out MSB first and return the word clocked in
+	uint16_t transfer16(uint16_t data);
+private:
+	unsigned m_spiIndex;
+	uint32_t m_clockHz = 0;
+};
+
+extern SPIClass SPI;
+extern SPIClass SPI1;
+
+#endif /* __BAGUITAR_HOST_SPI_H */
@@ -0,0 +1,80 @@
+/**************************************************************************//**
+ *  @file
+ *  @author Steve Lascos
+ *  @company Blackaddr Audio
+ *
+ *  Host version of the CMSIS-DSP arm_math.h, see BAHost.h. Only the types and
+ *  functions used by the library are provided. They are plain C++ versions of
+ *  the CMSIS ones with the same fixed point formats and saturation, so effects
+ *  produce the same audio on the host as on the Teensy, give or take the last
+ *  bit where a CMSIS "fast" function drops precision.
+ *
+ *  @copyright This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.*
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *****************************************************************************/
+#ifndef __BAGUITAR_HOST_ARM_MATH_H
+#define __BAGUITAR_HOST_ARM_MATH_H
+
+#if !defined(BAGUITAR_HOST)
+#error "src/host is only for host builds, define BAGUITAR_HOST"
+#endif
+
+#include <cstdint>
+
+typedef int16_t q15_t;   ///< 1.15 fixed point
+typedef int32_t q31_t;   ///< 1.31 fixed point
+typedef int64_t q63_t;   ///< 1.63 fixed point
+typedef float float32_t; ///< 32-bit floating point
+
+/// Q31 direct form I biquad cascade, 4 states per stage: x[n-1], x[n-2], y[n-1], y[n-2]
+struct arm_biquad_casd_df1_inst_q31 {
+	uint32_t numStages; ///< number of 2nd order stages
+	q31_t *pState;      ///< 4*numStages states
+	q31_t *pCoeffs;     ///< 5*numStages coefficients: b0, b1, b2, a1, a2
+	uint8_t postShift;  ///< shift applied to the output to cover coefficients beyond +/-1
+};
+
+/// Q31 direct form I biquad cascade with 64-bit states
+struct arm_biquad_cas_df1_32x64_ins_q31 {
+	uint8_t numStages;  ///< number of 2nd order stages
+	q63_t *pState;      ///< 4*numStages states
+	q31_t *pCoeffs;     ///< 5*numStages coefficients: b0, b1, b2, a1, a2
+	uint8_t postShift;  ///< shift applied to the output to cover coefficients beyond +/-1
+};
+
+/// Floating point transposed direct form II biquad cascade, 2 states per stage
+struct arm_biquad_cascade_df2T_instance_f32 {
+	uint8_t numStages;  ///< number of 2nd order stages
+	float32_t *pState;  ///< 2*numStages states
+	float32_t *pCoeffs; ///< 5*numStages coefficients: b0, b1, b2, a1, a2
+};
+
+void arm_scale_q15(q15_t *pSrc, q15_t scaleFract, int8_t shift, q15_t *pDst, uint32_t blockSize);
+void arm_add_q15(q15_t *pSrcA, q15_t *pSrcB, q15_t *pDst, uint32_t blockSize);
+void arm_scale_q31(q31_t *pSrc, q31_t scaleFract, int8_t shift, q31_t *pDst, uint32_t blockSize);
+void arm_add_q31(q31_t *pSrcA, q31_t *pSrcB, q31_t *pDst, uint32_t blockSize);
+
+void arm_biquad_cascade_df1_init_q31(arm_biquad_casd_df1_inst_q31 *S, uint8_t numStages, q31_t *pCoeffs, q31_t *pState,
+		int8_t postShift);
+void arm_biquad_cascade_df1_fast_q31(const arm_biquad_casd_df1_inst_q31 *S, q31_t *pSrc, q31_t *pDst, uint32_t blockSize);
+
+void arm_biquad_cas_df1_32x64_init_q31(arm_biquad_cas_df1_32x64_ins_q31 *S, uint8_t numStages, q31_t *pCoeffs, q63_t *pState,
+		uint8_t postShift);
+void arm_biquad_cas_df1_32x64_q31(const arm_biquad_cas_df1_32x64_ins_q31 *S, q31_t *pSrc, q31_t *pDst, uint32_t blockSize);
+
+void arm_biquad_cascade_df2T_init_f32(arm_biquad_cascade_df2T_instance_f32 *S, uint8_t numStages, float32_t *pCoeffs,
+		float32_t *pState);
+void arm_biquad_cascade_df2T_f32(const arm_biquad_cascade_df2T_instance_f32 *S, float32_t *pSrc, float32_t *pDst,
+		uint32_t blockSize);
+
+#endif /* __BAGUITAR_HOST_ARM_MATH_H */
@@ -18,6 +18,8 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <cstring>
+
 #include "Arduino.h"
 #include "BASpiMemory.h"
 
@@ -39,6 +41,8 @@ constexpr int SPI_SCK_MEM1 = 20;
 constexpr int SPI_WRITE_MODE_REG = 0x1;
 constexpr int SPI_WRITE_CMD = 0x2;
 constexpr int SPI_READ_CMD = 0x3;
+constexpr int SPI_READ_MODE_REG = 0x5;
+constexpr int SPI_RESET_IO_CMD = 0xFF;
 constexpr int SPI_ADDR_2_MASK = 0xFF0000;
 constexpr int SPI_ADDR_2_SHIFT = 16;
 constexpr int SPI_ADDR_1_MASK = 0x00FF00;
@@ -48,16 +52,46 @@ constexpr int SPI_ADDR_0_MASK = 0x0000FF;
 constexpr int CMD_ADDRESS_SIZE = 4;
 constexpr int MAX_DMA_XFER_SIZE = 0x4000;
 
+// PSRAM Constants
+constexpr int PSRAM_FAST_READ_CMD = 0x0B;
+constexpr int PSRAM_FAST_READ_WAIT_BYTES = 1; // 8 wait cycles
+constexpr int PSRAM_RESET_ENABLE_CMD = 0x66;
+constexpr int PSRAM_RESET_CMD = 0x99;
+constexpr int PSRAM_READ_ID_CMD = 0x9F;
+constexpr uint8_t PSRAM_KGD_PASS = 0x5D; // "known good die" byte returned with the ID
+constexpr size_t PSRAM_PAGE_SIZE = 1024;
+constexpr uint32_t PSRAM_TCEM_NS = 8000;     // longest chip select low time, so the PSRAM can refresh
+constexpr uint32_t PSRAM_CS_MARGIN_NS = 1000; // chip select low time outside the SPI clocks, e.g. the DMA interrupt between phases
+
+// The commands are followed by the wait cycles for the longest read command
+constexpr int MAX_COMMAND_SIZE = CMD_ADDRESS_SIZE + PSRAM_FAST_READ_WAIT_BYTES;
+
+// Size probe
+constexpr size_t PROBE_MIN_SIZE = 0x10000;
+constexpr uint8_t PROBE_SIGNATURE[4] = {0xBA, 0x5E, 0xC0, 0xDE};
+constexpr size_t PROBE_MAX_ADDRESSES = 10; // address zero and each power of two from PROBE_MIN_SIZE to 16 MB
+
+// Clock calibration
+// The fastest dividers of the bus clock the SPI settings pick from. The DSPI divides
+// by a prescaler of 2, 3, 5 or 7 times a scaler of 2, 4, 6, 8, 16 and so on, halved
+// when the double baud rate bit is set, so only some integers are possible.
+constexpr uint32_t SPI_CLOCK_DIVIDERS[] = {2, 3, 4, 5, 6, 8, 10, 12, 16};
+constexpr size_t NUM_SPI_CLOCK_DIVIDERS = sizeof(SPI_CLOCK_DIVIDERS) / sizeof(SPI_CLOCK_DIVIDERS[0]);
+static_assert(NUM_SPI_CLOCK_DIVIDERS == BASpiMemory::NUM_CLOCK_RATES, "NUM_CLOCK_RATES must match SPI_CLOCK_DIVIDERS");
+constexpr int CALIBRATION_PASSES = 4;
+constexpr size_t CALIBRATION_CHUNK_SIZE = 256;
+constexpr uint8_t CALIBRATION_MASKS[] = {0xAA, 0x55, 0x00, 0xFF};
+
 BASpiMemory::BASpiMemory(SpiDeviceId memDeviceId)
 {
 	m_memDeviceId = memDeviceId;
-	m_settings = {20000000, MSBFIRST, SPI_MODE0};
+	BASpiMemory::setClock(DEFAULT_CLOCK_HZ);
 }
 
 BASpiMemory::BASpiMemory(SpiDeviceId memDeviceId, uint32_t speedHz)
 {
 	m_memDeviceId = memDeviceId;
-	m_settings = {speedHz, MSBFIRST, SPI_MODE0};
+	BASpiMemory::setClock(speedHz);
 }
 
 // Intitialize the correct Arduino SPI interface
@@ -89,123 +123,435 @@ void BASpiMemory::begin()
 		return;
 	}
 
-	pinMode(m_csPin, OUTPUT);
-	digitalWrite(m_csPin, HIGH);
+	m_configureDevice();
 	m_started = true;
 
 }
 
-BASpiMemory::~BASpiMemory() {
+// Put the memory in a known state, single-bit SPI in sequential mode, then find out
+// what it is and how big it is.
+void BASpiMemory::m_configureDevice()
+{
+	pinMode(m_csPin, OUTPUT);
+	digitalWrite(m_csPin, HIGH);
+	resetIo();
+
+	if (m_isPsram()) {
+		m_device = SpiMemDevice::PSRAM;
+		m_spi->beginTransaction(m_settings);
+		digitalWrite(m_csPin, LOW);
+		m_spi->transfer(PSRAM_RESET_ENABLE_CMD);
+		digitalWrite(m_csPin, HIGH);
+		digitalWrite(m_csPin, LOW);
+		m_spi->transfer(PSRAM_RESET_CMD);
+		m_spi->endTransaction();
+		digitalWrite(m_csPin, HIGH);
+	} else {
+		m_device = SpiMemDevice::SRAM_23LC1024;
+		setMode(SpiMemMode::SEQUENTIAL);
+	}
+
+	m_size = m_probeSize();
+	if (m_size == 0) {
+		Serial.println(String("BASpiMemory: no memory detected on device ") + static_cast<unsigned>(m_memDeviceId));
+	}
+
+	// the traffic counters need the cycle counter running
+	ARM_DEMCR |= ARM_DEMCR_TRCENA;
+	ARM_DWT_CTRL |= ARM_DWT_CTRL_CYCCNTENA;
+	m_resetStats();
 }
 
-// Single address write
-void BASpiMemory::write(size_t address, uint8_t data)
+// PSRAM answers the read ID command with a fixed "known good die" byte after the
+// manufacturer ID. The 23LC1024 doesn't have the command and leaves MISO alone.
+bool BASpiMemory::m_isPsram()
 {
 	m_spi->beginTransaction(m_settings);
 	digitalWrite(m_csPin, LOW);
-	m_spi->transfer(SPI_WRITE_CMD);
-	m_spi->transfer((address & SPI_ADDR_2_MASK) >> SPI_ADDR_2_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_1_MASK) >> SPI_ADDR_1_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_0_MASK));
-	m_spi->transfer(data);
+	m_spi->transfer(PSRAM_READ_ID_CMD);
+	m_spi->transfer(0);
+	m_spi->transfer(0);
+	m_spi->transfer(0);
+	m_spi->transfer(0); // manufacturer ID
+	uint8_t kgd = m_spi->transfer(0);
 	m_spi->endTransaction();
 	digitalWrite(m_csPin, HIGH);
+	return kgd == PSRAM_KGD_PASS;
 }
 
-// Single address write
-void BASpiMemory::write(size_t address, uint8_t *src, size_t numBytes)
+// Find the size with an address aliasing test. A signature is written at address
+// zero, then a different one at each power of two address. A memory ignores the
+// address bits above its size, so the first write that lands on address zero, or
+// doesn't read back, is at the size of the memory. The bytes under each signature
+// are saved first and put back in reverse order, so an address that aliased to zero
+// is restored before zero itself and the memory is left as it was.
+size_t BASpiMemory::m_probeSize()
 {
-	uint8_t *dataPtr = src;
+	// the blocking transfers are used explicitly, DMA isn't running yet
+	uint8_t signature[sizeof(PROBE_SIGNATURE)];
+	uint8_t readback[sizeof(PROBE_SIGNATURE)];
+	uint8_t saved[PROBE_MAX_ADDRESSES][sizeof(PROBE_SIGNATURE)];
+	size_t savedAddress[PROBE_MAX_ADDRESSES];
+	size_t numSaved = 0;
+
+	savedAddress[numSaved] = 0;
+	BASpiMemory::read(0, saved[numSaved++], sizeof(PROBE_SIGNATURE));
+	memcpy(signature, PROBE_SIGNATURE, sizeof(signature));
+	BASpiMemory::write(0, signature, sizeof(signature));
+	BASpiMemory::read(0, readback, sizeof(readback));
+
+	size_t size = 0;
+	if (memcmp(readback, PROBE_SIGNATURE, sizeof(readback)) == 0) {
+		size = PROBE_MIN_SIZE;
+		while (size <= SPI_MAX_ADDR_24BIT) {
+			savedAddress[numSaved] = size;
+			BASpiMemory::read(size, saved[numSaved++], sizeof(PROBE_SIGNATURE));
+			// make each signature different so a stuck bus can't pass
+			signature[3] = static_cast<uint8_t>(size >> SPI_ADDR_2_SHIFT);
+			BASpiMemory::write(size, signature, sizeof(signature));
+			BASpiMemory::read(size, readback, sizeof(readback));
+			if (memcmp(readback, signature, sizeof(readback)) != 0) { break; }
+
+			BASpiMemory::read(0, readback, sizeof(readback));
+			if (memcmp(readback, PROBE_SIGNATURE, sizeof(readback)) != 0) { break; }
+			size <<= 1;
+		}
+	}
 
-	m_spi->beginTransaction(m_settings);
-	digitalWrite(m_csPin, LOW);
-	m_spi->transfer(SPI_WRITE_CMD);
-	m_spi->transfer((address & SPI_ADDR_2_MASK) >> SPI_ADDR_2_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_1_MASK) >> SPI_ADDR_1_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_0_MASK));
+	while (numSaved > 0) {
+		numSaved--;
+		BASpiMemory::write(savedAddress[numSaved], saved[numSaved], sizeof(PROBE_SIGNATURE));
+	}
+	return size;
+}
+
+void BASpiMemory::setClock(uint32_t speedHz)
+{
+	m_clockHz = speedHz;
+	m_settings = {speedHz, MSBFIRST, SPI_MODE0};
+	m_updateBurstLimit();
+}
 
-	for (size_t i=0; i < numBytes; i++) {
-		m_spi->transfer(*dataPtr++);
+void BASpiMemory::getClockRates(uint32_t *rates)
+{
+	for (size_t i=0; i < NUM_SPI_CLOCK_DIVIDERS; i++) {
+		rates[i] = F_BUS / SPI_CLOCK_DIVIDERS[i];
 	}
-	m_spi->endTransaction();
-	digitalWrite(m_csPin, HIGH);
 }
 
+// Steps through the dividers the SPI can generate, from the rate nearest
+// DEFAULT_CLOCK_HZ up, so each rate is tried once.
+uint32_t BASpiMemory::calibrateClock(uint32_t maxSpeedHz, size_t address, size_t numBytes)
+{
+	if (!m_started || (m_size == 0)) { return 0; }
+	if (address >= m_size) { address = 0; }
+	if (numBytes > m_size - address) { numBytes = m_size - address; }
+
+	m_waitIdle();
+	uint32_t startClockHz = m_clockHz;
+	uint32_t fastestPassHz = 0;
+	uint32_t previousPassHz = 0;
+
+	// start with the slowest divider that doesn't go below the default clock
+	size_t step = 0;
+	while ((step < NUM_SPI_CLOCK_DIVIDERS-1) && (F_BUS / SPI_CLOCK_DIVIDERS[step+1] >= DEFAULT_CLOCK_HZ)) { step++; }
+	for (size_t i=step+1; i > 0; i--) {
+		uint32_t clockHz = F_BUS / SPI_CLOCK_DIVIDERS[i-1];
+		if (clockHz > maxSpeedHz) { break; }
+
+		setClock(clockHz);
+		bool pass = true;
+		for (int passNum=0; (passNum < CALIBRATION_PASSES) && pass; passNum++) {
+			pass = m_patternTest(address, numBytes);
+		}
+		if (!pass) { break; }
+		previousPassHz = fastestPassHz;
+		fastestPassHz = clockHz;
+	}
 
-void BASpiMemory::zero(size_t address, size_t numBytes)
+	// back off a step from the fastest rate that passed for some margin, also when every
+	// rate up to maxSpeedHz passed, as it was only tested briefly. When only the first
+	// rate passed it's kept, it's the nearest to the rated clock.
+	uint32_t calibratedHz = previousPassHz ? previousPassHz : fastestPassHz;
+	if (calibratedHz == 0) {
+		setClock(startClockHz);
+		m_resetStats();
+		Serial.println(String("BASpiMemory: clock calibration failed on device ") + static_cast<unsigned>(m_memDeviceId));
+		return 0;
+	}
+
+	setClock(calibratedHz);
+	zero(address, numBytes);
+	m_waitIdle();
+	m_resetStats();
+	Serial.println(String("BASpiMemory: SPI clock calibrated to ") + calibratedHz + String(" Hz"));
+	return calibratedHz;
+}
+
+// Write each pattern across the region and read it back, then clear it and check it
+// reads back as zero. Based on the DMA_MEM0_test example.
+bool BASpiMemory::m_patternTest(size_t address, size_t numBytes)
+{
+	uint8_t src[CALIBRATION_CHUNK_SIZE];
+	uint8_t dest[CALIBRATION_CHUNK_SIZE];
+	size_t end = address + numBytes;
+
+	for (auto mask : CALIBRATION_MASKS) {
+		for (size_t chunkAddress = address; chunkAddress < end; chunkAddress += CALIBRATION_CHUNK_SIZE) {
+			size_t chunkBytes = min(CALIBRATION_CHUNK_SIZE, end - chunkAddress);
+			for (size_t i=0; i < chunkBytes; i++) {
+				src[i] = static_cast<uint8_t>(chunkAddress + i) ^ mask;
+			}
+			write(chunkAddress, src, chunkBytes);
+			m_waitIdle();
+		}
+
+		for (size_t chunkAddress = address; chunkAddress < end; chunkAddress += CALIBRATION_CHUNK_SIZE) {
+			size_t chunkBytes = min(CALIBRATION_CHUNK_SIZE, end - chunkAddress);
+			for (size_t i=0; i < chunkBytes; i++) {
+				src[i] = static_cast<uint8_t>(chunkAddress + i) ^ mask;
+			}
+			read(chunkAddress, dest, chunkBytes);
+			m_waitIdle();
+			if (memcmp(src, dest, chunkBytes) != 0) { return false; }
+		}
+	}
+
+	memset(src, 0, sizeof(src));
+	zero(address, numBytes);
+	m_waitIdle();
+	for (size_t chunkAddress = address; chunkAddress < end; chunkAddress += CALIBRATION_CHUNK_SIZE) {
+		size_t chunkBytes = min(CALIBRATION_CHUNK_SIZE, end - chunkAddress);
+		read(chunkAddress, dest, chunkBytes);
+		m_waitIdle();
+		if (memcmp(src, dest, chunkBytes) != 0) { return false; }
+	}
+	return true;
+}
+
+size_t BASpiMemory::getPageSize() const
+{
+	return (m_device == SpiMemDevice::PSRAM) ? PSRAM_PAGE_SIZE : 0;
+}
+
+// The number of bytes from address that fit in a single transaction. PSRAM bursts
+// wrap around within a page, so they are split at the page boundaries. Chip select
+// must also go high within tCEM, which at 20 MHz only leaves time for a few bytes
+// after the command, see m_tcemBurstBytes().
+size_t BASpiMemory::m_burstBytes(size_t address, size_t numBytes) const
+{
+	size_t pageSize = getPageSize();
+	if (pageSize == 0) { return numBytes; }
+	size_t burst = min(numBytes, pageSize - (address % pageSize));
+	return min(burst, m_tcemBurstBytes);
+}
+
+// The SPI rounds the clock down to a divider of the bus clock, the bytes are timed at
+// that rate. Slower clocks than the dividers in the table only get slower, so the
+// requested clock is used for those.
+void BASpiMemory::m_updateBurstLimit()
+{
+	uint32_t clockHz = m_clockHz;
+	for (size_t i=0; i < NUM_SPI_CLOCK_DIVIDERS; i++) {
+		if (F_BUS / SPI_CLOCK_DIVIDERS[i] <= m_clockHz) {
+			clockHz = F_BUS / SPI_CLOCK_DIVIDERS[i];
+			break;
+		}
+	}
+	uint64_t clocks = (static_cast<uint64_t>(clockHz) * (PSRAM_TCEM_NS - PSRAM_CS_MARGIN_NS)) / 1000000000ULL;
+	size_t bytes = static_cast<size_t>(clocks / 8);
+	bytes = (bytes > static_cast<size_t>(MAX_COMMAND_SIZE)) ? bytes - MAX_COMMAND_SIZE : 0;
+	m_tcemBurstBytes = (bytes < sizeof(uint16_t)) ? sizeof(uint16_t) : bytes;
+}
+
+// The number of bytes sent before the data. PSRAM reads use the fast read command,
+// which works at any clock rate but needs wait cycles after the address.
+size_t BASpiMemory::m_commandSize(int command) const
 {
+	if ((m_device == SpiMemDevice::PSRAM) && (command == SPI_READ_CMD)) {
+		return CMD_ADDRESS_SIZE + PSRAM_FAST_READ_WAIT_BYTES;
+	}
+	return CMD_ADDRESS_SIZE;
+}
+
+// Start a transaction with the command, 24-bit address and any wait cycles
+void BASpiMemory::m_beginCommand(int command, size_t address)
+{
+	m_commandStartCycles = ARM_DWT_CYCCNT;
 	m_spi->beginTransaction(m_settings);
 	digitalWrite(m_csPin, LOW);
-	m_spi->transfer(SPI_WRITE_CMD);
+	bool fastRead = (m_device == SpiMemDevice::PSRAM) && (command == SPI_READ_CMD);
+	m_spi->transfer(fastRead ? PSRAM_FAST_READ_CMD : command);
 	m_spi->transfer((address & SPI_ADDR_2_MASK) >> SPI_ADDR_2_SHIFT);
 	m_spi->transfer((address & SPI_ADDR_1_MASK) >> SPI_ADDR_1_SHIFT);
 	m_spi->transfer((address & SPI_ADDR_0_MASK));
-
-	for (size_t i=0; i < numBytes; i++) {
+	for (size_t i=CMD_ADDRESS_SIZE; i < m_commandSize(command); i++) {
 		m_spi->transfer(0);
 	}
+}
+
+void BASpiMemory::m_endCommand()
+{
 	m_spi->endTransaction();
 	digitalWrite(m_csPin, HIGH);
+	m_stats.busyCycles += ARM_DWT_CYCCNT - m_commandStartCycles;
 }
 
-void BASpiMemory::write16(size_t address, uint16_t data)
+SpiMemStats BASpiMemory::getStats() const
+{
+	__disable_irq();
+	SpiMemStats stats = m_stats;
+	stats.elapsedCycles = ARM_DWT_CYCCNT - m_statsStartCycles;
+	__enable_irq();
+	return stats;
+}
+
+SpiMemStats BASpiMemory::snapshotStats()
+{
+	__disable_irq();
+	SpiMemStats stats = m_stats;
+	stats.elapsedCycles = ARM_DWT_CYCCNT - m_statsStartCycles;
+	m_resetStats();
+	__enable_irq();
+	return stats;
+}
+
+void BASpiMemory::m_resetStats()
+{
+	m_stats = SpiMemStats();
+	m_statsStartCycles = ARM_DWT_CYCCNT;
+}
+
+// The counters are updated from the same context as the transfers, like the DMA queue
+void BASpiMemory::m_countTransfer(bool isRead, size_t numBytes)
+{
+	m_stats.transactions++;
+	if (isRead) {
+		m_stats.bytesRead += numBytes;
+	} else {
+		m_stats.bytesWritten += numBytes;
+	}
+}
+
+void BASpiMemory::resetIo()
 {
 	m_spi->beginTransaction(m_settings);
 	digitalWrite(m_csPin, LOW);
-	m_spi->transfer16((SPI_WRITE_CMD << 8) | (address >> 16) );
-	m_spi->transfer16(address & 0xFFFF);
-	m_spi->transfer16(data);
+	m_spi->transfer(SPI_RESET_IO_CMD);
 	m_spi->endTransaction();
 	digitalWrite(m_csPin, HIGH);
 }
 
-void BASpiMemory::write16(size_t address, uint16_t *src, size_t numWords)
+void BASpiMemory::setMode(SpiMemMode mode)
 {
-	uint16_t *dataPtr = src;
-
+	if (m_device == SpiMemDevice::PSRAM) { return; }
 	m_spi->beginTransaction(m_settings);
 	digitalWrite(m_csPin, LOW);
-	m_spi->transfer16((SPI_WRITE_CMD << 8) | (address >> 16) );
-	m_spi->transfer16(address & 0xFFFF);
-
-	for (size_t i=0; i<numWords; i++) {
-		m_spi->transfer16(*dataPtr++);
-	}
-
+	m_spi->transfer(SPI_WRITE_MODE_REG);
+	m_spi->transfer(static_cast<uint8_t>(mode));
 	m_spi->endTransaction();
 	digitalWrite(m_csPin, HIGH);
 }
 
-void BASpiMemory::zero16(size_t address, size_t numWords)
+SpiMemMode BASpiMemory::getMode()
 {
+	if (m_device == SpiMemDevice::PSRAM) { return SpiMemMode::SEQUENTIAL; }
+	uint8_t mode;
 	m_spi->beginTransaction(m_settings);
 	digitalWrite(m_csPin, LOW);
-	m_spi->transfer16((SPI_WRITE_CMD << 8) | (address >> 16) );
-	m_spi->transfer16(address & 0xFFFF);
+	m_spi->transfer(SPI_READ_MODE_REG);
+	mode = m_spi->transfer(0);
+	m_spi->endTransaction();
+	digitalWrite(m_csPin, HIGH);
+	return static_cast<SpiMemMode>(mode);
+}
+
+BASpiMemory::~BASpiMemory() {
+}
+
+// Single address write
+void BASpiMemory::write(size_t address, uint8_t data)
+{
+	m_countTransfer(false, sizeof(data));
+	m_beginCommand(SPI_WRITE_CMD, address);
+	m_spi->transfer(data);
+	m_endCommand();
+}
 
-	for (size_t i=0; i<numWords; i++) {
-		m_spi->transfer16(0);
+// Block write, split into transactions that don't cross a page
+void BASpiMemory::write(size_t address, uint8_t *src, size_t numBytes)
+{
+	uint8_t *dataPtr = src;
+	m_countTransfer(false, numBytes);
+
+	while (numBytes > 0) {
+		size_t burst = m_burstBytes(address, numBytes);
+		m_beginCommand(SPI_WRITE_CMD, address);
+		for (size_t i=0; i < burst; i++) {
+			m_spi->transfer(*dataPtr++);
+		}
+		m_endCommand();
+		address += burst;
+		numBytes -= burst;
 	}
+}
 
-	m_spi->endTransaction();
-	digitalWrite(m_csPin, HIGH);
-	Serial.println("DONE!");
+
+void BASpiMemory::zero(size_t address, size_t numBytes)
+{
+	m_countTransfer(false, numBytes);
+	while (numBytes > 0) {
+		size_t burst = m_burstBytes(address, numBytes);
+		m_beginCommand(SPI_WRITE_CMD, address);
+		for (size_t i=0; i < burst; i++) {
+			m_spi->transfer(0);
+		}
+		m_endCommand();
+		address += burst;
+		numBytes -= burst;
+	}
+}
+
+void BASpiMemory::write16(size_t address, uint16_t data)
+{
+	m_countTransfer(false, sizeof(data));
+	m_beginCommand(SPI_WRITE_CMD, address);
+	m_spi->transfer16(data);
+	m_endCommand();
+}
+
+void BASpiMemory::write16(size_t address, uint16_t *src, size_t numWords)
+{
+	uint16_t *dataPtr = src;
+	m_countTransfer(false, sizeof(uint16_t)*numWords);
+
+	while (numWords > 0) {
+		size_t burst = m_burstBytes(address, sizeof(uint16_t)*numWords) / sizeof(uint16_t);
+		if (burst == 0) { burst = 1; } // an unaligned word at the end of a page, see getPageSize()
+		m_beginCommand(SPI_WRITE_CMD, address);
+		for (size_t i=0; i<burst; i++) {
+			m_spi->transfer16(*dataPtr++);
+		}
+		m_endCommand();
+		address += sizeof(uint16_t)*burst;
+		numWords -= burst;
+	}
+}
+
+void BASpiMemory::zero16(size_t address, size_t numWords)
+{
+	zero(address, sizeof(uint16_t)*numWords);
 }
 
 // single address read
 uint8_t BASpiMemory::read(size_t address)
 {
 	int data;
+	m_countTransfer(true, sizeof(uint8_t));
 
-	m_spi->beginTransaction(m_settings);
-	digitalWrite(m_csPin, LOW);
-	m_spi->transfer(SPI_READ_CMD);
-	m_spi->transfer((address & SPI_ADDR_2_MASK) >> SPI_ADDR_2_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_1_MASK) >> SPI_ADDR_1_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_0_MASK));
+	m_beginCommand(SPI_READ_CMD, address);
 	data = m_spi->transfer(0);
-	m_spi->endTransaction();
-	digitalWrite(m_csPin, HIGH);
+	m_endCommand();
 	return data;
 }
 
@@ -213,52 +559,52 @@ uint8_t BASpiMemory::read(size_t address)
 void BASpiMemory::read(size_t address, uint8_t *dest, size_t numBytes)
 {
 	uint8_t *dataPtr = dest;
-
-	m_spi->beginTransaction(m_settings);
-	digitalWrite(m_csPin, LOW);
-	m_spi->transfer(SPI_READ_CMD);
-	m_spi->transfer((address & SPI_ADDR_2_MASK) >> SPI_ADDR_2_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_1_MASK) >> SPI_ADDR_1_SHIFT);
-	m_spi->transfer((address & SPI_ADDR_0_MASK));
-
-	for (size_t i=0; i<numBytes; i++) {
-		*dataPtr++ = m_spi->transfer(0);
+	m_countTransfer(true, numBytes);
+
+	while (numBytes > 0) {
+		size_t burst = m_burstBytes(address, numBytes);
+		m_beginCommand(SPI_READ_CMD, address);
+		for (size_t i=0; i<burst; i++) {
+			*dataPtr++ = m_spi->transfer(0);
+		}
+		m_endCommand();
+		address += burst;
+		numBytes -= burst;
 	}
-
-	m_spi->endTransaction();
-	digitalWrite(m_csPin, HIGH);
 }
 
 uint16_t BASpiMemory::read16(size_t address)
 {
-
 	uint16_t data;
-	m_spi->beginTransaction(m_settings);
-	digitalWrite(m_csPin, LOW);
-	m_spi->transfer16((SPI_READ_CMD << 8) | (address >> 16) );
-	m_spi->transfer16(address & 0xFFFF);
+	m_countTransfer(true, sizeof(data));
+	m_beginCommand(SPI_READ_CMD, address);
 	data = m_spi->transfer16(0);
-	m_spi->endTransaction();
-
-	digitalWrite(m_csPin, HIGH);
+	m_endCommand();
 	return data;
 }
 
 void BASpiMemory::read16(size_t address, uint16_t *dest, size_t numWords)
 {
-
 	uint16_t *dataPtr = dest;
-	m_spi->beginTransaction(m_settings);
-	digitalWrite(m_csPin, LOW);
-	m_spi->transfer16((SPI_READ_CMD << 8) | (address >> 16) );
-	m_spi->transfer16(address & 0xFFFF);
-
-	for (size_t i=0; i<numWords; i++) {
-		*dataPtr++ = m_spi->transfer16(0);
+	m_countTransfer(true, sizeof(uint16_t)*numWords);
+	while (numWords > 0) {
+		size_t burst = m_burstBytes(address, sizeof(uint16_t)*numWords) / sizeof(uint16_t);
+		if (burst == 0) { burst = 1; } // an unaligned word at the end of a page, see getPageSize()
+		m_beginCommand(SPI_READ_CMD, address);
+		for (size_t i=0; i<burst; i++) {
+			*dataPtr++ = m_spi->transfer16(0);
+		}
+		m_endCommand();
+		address += sizeof(uint16_t)*burst;
+		numWords -= burst;
 	}
+}
 
-	m_spi->endTransaction();
-	digitalWrite(m_csPin, HIGH);
+void BASpiMemory::readGather(const SpiGatherEntry *entries, size_t numEntries)
+{
+	for (size_t i=0; i < numEntries; i++) {
+		read(entries[i].address, entries[i].dest, entries[i].numBytes);
+	}
 }
 
 /////////////////////////////////////////////////////////////////////////////
@@ -267,69 +613,85 @@ void BASpiMemory::read16(size_t address, uint16_t *dest, size_t numWords)
 BASpiMemoryDMA::BASpiMemoryDMA(SpiDeviceId memDeviceId)
 : BASpiMemory(memDeviceId)
 {
-	int cs;
-	switch (memDeviceId) {
-	case SpiDeviceId::SPI_DEVICE0 :
-		cs = SPI_CS_MEM0;
-		m_cs = new ActiveLowChipSelect(cs, m_settings);
-		break;
-#if defined(__MK66FX1M0__)
-	case SpiDeviceId::SPI_DEVICE1 :
-		cs = SPI_CS_MEM1;
-		m_cs = new ActiveLowChipSelect1(cs, m_settings);
-		break;
-#endif
-	default :
-		cs = SPI_CS_MEM0;
-	}
-
-	// add 4 bytes to buffer for SPI CMD and 3 bytes of address
-	m_txCommandBuffer = new uint8_t[CMD_ADDRESS_SIZE];
-	m_rxCommandBuffer = new uint8_t[CMD_ADDRESS_SIZE];
-	m_txTransfer = new DmaSpi::Transfer[2];
-	m_rxTransfer = new DmaSpi::Transfer[2];
+	m_initialize(DEFAULT_QUEUE_DEPTH);
 }
 
-BASpiMemoryDMA::BASpiMemoryDMA(SpiDeviceId memDeviceId, uint32_t speedHz)
+BASpiMemoryDMA::BASpiMemoryDMA(SpiDeviceId memDeviceId, uint32_t speedHz, size_t queueDepth)
 : BASpiMemory(memDeviceId, speedHz)
 {
-	int cs;
-	switch (memDeviceId) {
+	m_initialize(queueDepth);
+}
+
+BASpiMemoryDMA::~BASpiMemoryDMA()
+{
+	delete m_cs;
+	if (m_queue) delete [] m_queue;
+	if (m_commandBuffers) delete [] m_commandBuffers;
+	if (m_active) delete [] m_active;
+}
+
+void BASpiMemoryDMA::m_initialize(size_t queueDepth)
+{
+	m_createChipSelect();
+
+	// Each queue entry needs 1 byte for the SPI CMD, 3 bytes of address and any wait cycles
+	if (queueDepth < 1) { queueDepth = 1; }
+	m_queueDepth = queueDepth;
+	m_window = (queueDepth < DEFAULT_SCHEDULE_WINDOW) ? queueDepth : DEFAULT_SCHEDULE_WINDOW;
+	m_queue = new DmaQueueEntry[m_queueDepth];
+	m_commandBuffers = new uint8_t[m_queueDepth * MAX_COMMAND_SIZE];
+	m_active = new size_t[m_queueDepth];
+	for (size_t i=0; i < m_queueDepth; i++) {
+		m_queue[i].commandBuffer = &m_commandBuffers[i * MAX_COMMAND_SIZE];
+	}
+}
+
+// The chip select applies the SPI settings at the start of each DMA transaction
+void BASpiMemoryDMA::m_createChipSelect()
+{
+	if (m_cs) { delete m_cs; }
+	m_cs = nullptr;
+
+	switch (m_memDeviceId) {
 	case SpiDeviceId::SPI_DEVICE0 :
-		cs = SPI_CS_MEM0;
-		m_cs = new ActiveLowChipSelect(cs, m_settings);
+		m_cs = new ActiveLowChipSelect(SPI_CS_MEM0, m_settings);
 		break;
 #if defined(__MK66FX1M0__)
 	case SpiDeviceId::SPI_DEVICE1 :
-		cs = SPI_CS_MEM1;
-		m_cs = new ActiveLowChipSelect1(cs, m_settings);
+		m_cs = new ActiveLowChipSelect1(SPI_CS_MEM1, m_settings);
 		break;
 #endif
 	default :
-		cs = SPI_CS_MEM0;
+		break;
 	}
+}
 
-	m_txCommandBuffer = new uint8_t[CMD_ADDRESS_SIZE];
-	m_rxCommandBuffer = new uint8_t[CMD_ADDRESS_SIZE];
-	m_txTransfer = new DmaSpi::Transfer[2];
-	m_rxTransfer = new DmaSpi::Transfer[2];
+void BASpiMemoryDMA::setClock(uint32_t speedHz)
+{
+	// queued transfers keep a pointer to the chip select
+	m_waitIdle();
+	BASpiMemory::setClock(speedHz);
+	m_createChipSelect();
 }
 
-BASpiMemoryDMA::~BASpiMemoryDMA()
+void BASpiMemoryDMA::m_waitIdle()
 {
-	delete m_cs;
-	if (m_txTransfer) delete [] m_txTransfer;
-	if (m_rxTransfer) delete [] m_rxTransfer;
-	if (m_txCommandBuffer) delete [] m_txCommandBuffer;
-	if (m_rxCommandBuffer) delete [] m_txCommandBuffer;
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+	while (isWriteBusy() || isReadBusy()) {}
+	m_stats.busyCycles += ARM_DWT_CYCCNT - startCycles;
 }
 
-void BASpiMemoryDMA::m_setSpiCmdAddr(int command, size_t address, uint8_t *dest)
+// Build the command, address and wait cycles for a transaction, returns the number of bytes
+size_t BASpiMemoryDMA::m_setSpiCmdAddr(int command, size_t address, uint8_t *dest)
 {
-	dest[0] = command;
+	size_t commandSize = m_commandSize(command);
+	bool fastRead = (m_device == SpiMemDevice::PSRAM) && (command == SPI_READ_CMD);
+	dest[0] = fastRead ? PSRAM_FAST_READ_CMD : command;
 	dest[1] = ((address & SPI_ADDR_2_MASK) >> SPI_ADDR_2_SHIFT);
 	dest[2] = ((address & SPI_ADDR_1_MASK) >> SPI_ADDR_1_SHIFT);
 	dest[3] = ((address & SPI_ADDR_0_MASK));
+	for (size_t i=CMD_ADDRESS_SIZE; i < commandSize; i++) { dest[i] = 0; }
+	return commandSize;
 }
 
 void BASpiMemoryDMA::begin(void)
@@ -364,6 +726,9 @@ void BASpiMemoryDMA::begin(void)
 		return;
 	}
 
+	// configure the memory with blocking transfers before DMA takes over the port
+	m_configureDevice();
+
     m_spiDma->begin();
     m_spiDma->start();
 
@@ -372,83 +737,301 @@ void BASpiMemoryDMA::begin(void)
 
 
 
-// SPI must build up a payload that starts the teh CMD/Address first. It will cycle
-// through the payloads in a circular buffer and use the transfer objects to check if they
-// are done before continuing.
-void BASpiMemoryDMA::write(size_t address, uint8_t *src, size_t numBytes)
+// Returns true when sequence number a was issued before sequence number b. Sequence
+// numbers only increase so this remains correct when the counter wraps.
+static inline bool sequenceIsBefore(uint32_t a, uint32_t b)
 {
-	size_t bytesRemaining = numBytes;
-	uint8_t *srcPtr = src;
-	size_t nextAddress = address;
-	while (bytesRemaining > 0) {
-		m_txXferCount = min(bytesRemaining, MAX_DMA_XFER_SIZE);
-		while ( m_txTransfer[1].busy()) {} // wait until not busy
-		m_setSpiCmdAddr(SPI_WRITE_CMD, nextAddress, m_txCommandBuffer);
-		m_txTransfer[1] = DmaSpi::Transfer(m_txCommandBuffer, CMD_ADDRESS_SIZE, nullptr, 0, m_cs, TransferType::NO_END_CS);
-		m_spiDma->registerTransfer(m_txTransfer[1]);
+	return static_cast<int32_t>(a - b) < 0;
+}
 
-		while ( m_txTransfer[0].busy()) {} // wait until not busy
-		m_txTransfer[0] = DmaSpi::Transfer(srcPtr, m_txXferCount, nullptr, 0, m_cs, TransferType::NO_START_CS);
-		m_spiDma->registerTransfer(m_txTransfer[0]);
-		bytesRemaining -= m_txXferCount;
-		srcPtr += m_txXferCount;
-		nextAddress += m_txXferCount;
+void BASpiMemoryDMA::setScheduleWindow(size_t numEntries)
+{
+	if (numEntries < 1) { numEntries = 1; }
+	if (numEntries > m_queueDepth) { numEntries = m_queueDepth; }
+	m_window = numEntries;
+}
+
+// Claim a free entry from the pool. When every entry is in use we keep servicing
+// the queue until one is retired. The claim is made with interrupts off so the audio
+// interrupt can't take the same entry.
+BASpiMemoryDMA::DmaQueueEntry *BASpiMemoryDMA::m_nextQueueEntry()
+{
+	uint32_t startCycles = 0;
+	bool waited = false;
+	while (true) {
+		__disable_irq();
+		for (size_t i=0; i < m_queueDepth; i++) {
+			if (m_queue[i].state == DmaQueueEntry::State::FREE) {
+				m_queue[i].state = DmaQueueEntry::State::CLAIMED;
+				m_queue[i].token = DMA_TOKEN_NONE;
+				__enable_irq();
+				if (waited) { m_stats.busyCycles += ARM_DWT_CYCCNT - startCycles; }
+				return &m_queue[i];
+			}
+		}
+		__enable_irq();
+		if (!waited) {
+			// the queue is full
+			startCycles = ARM_DWT_CYCCNT;
+			waited = true;
+		}
+		service();
 	}
 }
 
+// A pending entry may only be sent ahead of an earlier one when they don't touch the
+// same memory, or when both of them are reads.
+bool BASpiMemoryDMA::m_isBlocked(const DmaQueueEntry &entry) const
+{
+	for (size_t i=0; i < m_queueDepth; i++) {
+		const DmaQueueEntry &other = m_queue[i];
+		if (other.state != DmaQueueEntry::State::PENDING) { continue; }
+		if (!sequenceIsBefore(other.sequence, entry.sequence)) { continue; }
+		if (entry.isRead && other.isRead) { continue; }
+		if ((entry.address < other.address + other.numBytes) && (other.address < entry.address + entry.numBytes)) {
+			return true;
+		}
+	}
+	return false;
+}
 
-void BASpiMemoryDMA::zero(size_t address, size_t numBytes)
+// Hand the most urgent pending entry to the DMA. Each priority level is taken in
+// the order it was queued, and the earliest pending entry overall is never blocked,
+// so every entry is eventually sent. The entry is chosen and marked ACTIVE with
+// interrupts off, so it can't also be chosen by a service() that interrupts this one.
+bool BASpiMemoryDMA::m_issueOne()
 {
-	size_t bytesRemaining = numBytes;
-	size_t nextAddress = address;
-	while (bytesRemaining > 0) {
-		m_txXferCount = min(bytesRemaining, MAX_DMA_XFER_SIZE);
-		while ( m_txTransfer[1].busy()) {} // wait until not busy
-		m_setSpiCmdAddr(SPI_WRITE_CMD, nextAddress, m_txCommandBuffer);
-		m_txTransfer[1] = DmaSpi::Transfer(m_txCommandBuffer, CMD_ADDRESS_SIZE, nullptr, 0, m_cs, TransferType::NO_END_CS);
-		m_spiDma->registerTransfer(m_txTransfer[1]);
+	__disable_irq();
+	if (m_activeCount + m_issuingCount >= m_window) {
+		__enable_irq();
+		return false;
+	}
 
-		while ( m_txTransfer[0].busy()) {} // wait until not busy
-		m_txTransfer[0] = DmaSpi::Transfer(nullptr, m_txXferCount, nullptr, 0, m_cs, TransferType::NO_START_CS);
-		m_spiDma->registerTransfer(m_txTransfer[0]);
-		bytesRemaining -= m_txXferCount;
-		nextAddress += m_txXferCount;
+	DmaQueueEntry *entry = nullptr;
+	for (unsigned level=0; level < NUM_SPI_PRIORITIES; level++) {
+		DmaQueueEntry *candidate = nullptr;
+		for (size_t i=0; i < m_queueDepth; i++) {
+			DmaQueueEntry *e = &m_queue[i];
+			if ((e->state != DmaQueueEntry::State::PENDING) || (static_cast<unsigned>(e->priority) != level)) { continue; }
+			if (!candidate || sequenceIsBefore(e->sequence, candidate->sequence)) { candidate = e; }
+		}
+		if (candidate && !m_isBlocked(*candidate)) {
+			entry = candidate;
+			break;
+		}
 	}
+	if (!entry) {
+		__enable_irq();
+		return false;
+	}
+	entry->state = DmaQueueEntry::State::ACTIVE;
+	m_issuingCount++;
+	__enable_irq();
+
+	m_spiDma->registerTransfer(entry->commandTransfer);
+	m_spiDma->registerTransfer(entry->dataTransfer);
+
+	// only add the entry to the active list once it's registered so service() can't retire it early
+	__disable_irq();
+	m_active[m_activeHead] = static_cast<size_t>(entry - m_queue);
+	m_activeHead = (m_activeHead < m_queueDepth-1) ? m_activeHead+1 : 0;
+	m_activeCount++;
+	m_issuingCount--;
+	__enable_irq();
+	return true;
 }
 
+// DmaSpi completes registered transfers in the order they were registered, so the
+// oldest active entry is always the next one to finish.
+bool BASpiMemoryDMA::m_retireOne()
+{
+	__disable_irq();
+	if (m_activeCount == 0) { __enable_irq(); return false; }
+	DmaQueueEntry *entry = &m_queue[m_active[m_activeTail]];
+	if (entry->commandTransfer.busy() || entry->dataTransfer.busy()) {
+		// the oldest entry is still in flight, so are all the others.
+		__enable_irq();
+		return false;
+	}
 
-void BASpiMemoryDMA::write16(size_t address, uint16_t *src, size_t numWords)
+	DmaCallback callback = entry->callback;
+	void *context = entry->context;
+	DmaToken token = entry->token;
+	entry->callback = nullptr;
+	entry->state = DmaQueueEntry::State::FREE;
+	m_activeTail = (m_activeTail < m_queueDepth-1) ? m_activeTail+1 : 0;
+	m_activeCount--;
+	__enable_irq();
+
+	if (callback) { callback(context, token); }
+	return true;
+}
+
+void BASpiMemoryDMA::service()
 {
-	write(address, reinterpret_cast<uint8_t*>(src), sizeof(uint16_t)*numWords);
+	while (m_retireOne()) {}
+	while (m_issueOne()) {}
 }
 
-void BASpiMemoryDMA::zero16(size_t address, size_t numWords)
+bool BASpiMemoryDMA::isDone(DmaToken token)
 {
-	zero(address, sizeof(uint16_t)*numWords);
+	if (token == DMA_TOKEN_NONE) { return true; }
+	service();
+
+	// Entries of the same priority are sent and retired in order, so once no entry
+	// carries the token every earlier entry of that priority is done too.
+	for (size_t i=0; i < m_queueDepth; i++) {
+		if ((m_queue[i].state != DmaQueueEntry::State::FREE) && (m_queue[i].token == token)) { return false; }
+	}
+	return true;
 }
 
+void BASpiMemoryDMA::waitFor(DmaToken token)
+{
+	if (isDone(token)) { return; }
+	uint32_t startCycles = ARM_DWT_CYCCNT;
+	while (!isDone(token)) {}
+	m_stats.busyCycles += ARM_DWT_CYCCNT - startCycles;
+}
 
-void BASpiMemoryDMA::read(size_t address, uint8_t *dest, size_t numBytes)
+DmaToken BASpiMemoryDMA::m_nextToken()
+{
+	m_lastToken++;
+	if (m_lastToken == DMA_TOKEN_NONE) { m_lastToken++; } // skip the reserved token on wrap
+	return m_lastToken;
+}
+
+// SPI must build up a payload that starts with the CMD/Address first. Each payload
+// uses its own queue entry so the command buffer can't be overwritten while a previous
+// transfer is still waiting to go out. Transfers larger than MAX_DMA_XFER_SIZE, or
+// that cross a PSRAM page or would hold its chip select low too long, are split across
+// several entries which all share the same token and priority, so they go out in order. Only the last entry carries the callback.
+void BASpiMemoryDMA::m_queueTransfer(DmaToken token, SpiPriority priority, int command, size_t address, uint8_t *src,
+		uint8_t *dest, size_t numBytes, DmaCallback callback, void *context)
 {
 	size_t bytesRemaining = numBytes;
+	uint8_t *srcPtr = src;
 	uint8_t *destPtr = dest;
 	size_t nextAddress = address;
+
+	if (numBytes == 0) {
+		// nothing to transfer, the request is complete right away
+		if (callback) { callback(context, token); }
+		return;
+	}
+
 	while (bytesRemaining > 0) {
-		m_setSpiCmdAddr(SPI_READ_CMD, nextAddress, m_rxCommandBuffer);
+		size_t xferCount = m_burstBytes(nextAddress, min(bytesRemaining, static_cast<size_t>(MAX_DMA_XFER_SIZE)));
+		DmaQueueEntry *entry = m_nextQueueEntry();
+
+		size_t commandSize = m_setSpiCmdAddr(command, nextAddress, entry->commandBuffer);
+		entry->isRead = (command == SPI_READ_CMD);
+		entry->priority = priority;
+		entry->address = nextAddress;
+		entry->numBytes = xferCount;
+		entry->token = token;
+		entry->callback = (bytesRemaining == xferCount) ? callback : nullptr;
+		entry->context = context;
+		entry->commandTransfer = DmaSpi::Transfer(entry->commandBuffer, commandSize, nullptr, 0, m_cs, TransferType::NO_END_CS);
+		entry->dataTransfer = DmaSpi::Transfer(srcPtr, xferCount, destPtr, 0, m_cs, TransferType::NO_START_CS);
+		__disable_irq();
+		entry->sequence = m_sequence++;
+		entry->state = DmaQueueEntry::State::PENDING;
+		__enable_irq();
+		m_stats.dmaChunks++;
+		if (entry->isRead) {
+			m_stats.bytesRead += xferCount;
+		} else {
+			m_stats.bytesWritten += xferCount;
+		}
+
+		bytesRemaining -= xferCount;
+		nextAddress += xferCount;
+		if (srcPtr)  { srcPtr  += xferCount; }
+		if (destPtr) { destPtr += xferCount; }
+	}
+	service();
+}
 
-		while ( m_rxTransfer[1].busy()) {}
-		m_rxTransfer[1] = DmaSpi::Transfer(m_rxCommandBuffer, CMD_ADDRESS_SIZE, nullptr, 0, m_cs, TransferType::NO_END_CS);
-		m_spiDma->registerTransfer(m_rxTransfer[1]);
+DmaToken BASpiMemoryDMA::readAsync(size_t address, uint8_t *dest, size_t numBytes, DmaCallback callback, void *context,
+		SpiPriority priority)
+{
+	DmaToken token = m_nextToken();
+	m_stats.transactions++;
+	m_queueTransfer(token, priority, SPI_READ_CMD, address, nullptr, dest, numBytes, callback, context);
+	return token;
+}
 
-		m_rxXferCount = min(bytesRemaining, MAX_DMA_XFER_SIZE);
-		while ( m_rxTransfer[0].busy()) {}
-		m_rxTransfer[0] = DmaSpi::Transfer(nullptr, m_rxXferCount, destPtr, 0, m_cs, TransferType::NO_START_CS);
-		m_spiDma->registerTransfer(m_rxTransfer[0]);
+DmaToken BASpiMemoryDMA::readGatherAsync(const SpiGatherEntry *entries, size_t numEntries, DmaCallback callback, void *context,
+		SpiPriority priority)
+{
+	DmaToken token = m_nextToken();
+	m_stats.transactions++;
+
+	// The callback goes with the last part that actually transfers data, since parts
+	// of the same priority complete in order.
+	size_t lastEntry = 0;
+	bool haveData = false;
+	for (size_t i=0; i < numEntries; i++) {
+		if (entries[i].numBytes > 0) { lastEntry = i; haveData = true; }
+	}
+	if (!haveData) {
+		if (callback) { callback(context, token); }
+		return token;
+	}
 
-		bytesRemaining -= m_rxXferCount;
-		destPtr += m_rxXferCount;
-		nextAddress += m_rxXferCount;
+	for (size_t i=0; i <= lastEntry; i++) {
+		if (entries[i].numBytes == 0) { continue; }
+		m_queueTransfer(token, priority, SPI_READ_CMD, entries[i].address, nullptr, entries[i].dest, entries[i].numBytes,
+				(i == lastEntry) ? callback : nullptr, context);
 	}
+	return token;
+}
+
+DmaToken BASpiMemoryDMA::writeAsync(size_t address, uint8_t *src, size_t numBytes, DmaCallback callback, void *context,
+		SpiPriority priority)
+{
+	DmaToken token = m_nextToken();
+	m_stats.transactions++;
+	m_queueTransfer(token, priority, SPI_WRITE_CMD, address, src, nullptr, numBytes, callback, context);
+	return token;
+}
+
+DmaToken BASpiMemoryDMA::zeroAsync(size_t address, size_t numBytes, DmaCallback callback, void *context,
+		SpiPriority priority)
+{
+	DmaToken token = m_nextToken();
+	m_stats.transactions++;
+	m_queueTransfer(token, priority, SPI_WRITE_CMD, address, nullptr, nullptr, numBytes, callback, context);
+	return token;
+}
+
+void BASpiMemoryDMA::write(size_t address, uint8_t *src, size_t numBytes)
+{
+	writeAsync(address, src, numBytes);
+}
+
+
+void BASpiMemoryDMA::zero(size_t address, size_t numBytes)
+{
+	zeroAsync(address, numBytes);
+}
+
+
+void BASpiMemoryDMA::write16(size_t address, uint16_t *src, size_t numWords)
+{
+	write(address, reinterpret_cast<uint8_t*>(src), sizeof(uint16_t)*numWords);
+}
+
+void BASpiMemoryDMA::zero16(size_t address, size_t numWords)
+{
+	zero(address, sizeof(uint16_t)*numWords);
+}
+
+
+void BASpiMemoryDMA::read(size_t address, uint8_t *dest, size_t numBytes)
+{
+	readAsync(address, dest, numBytes);
 }
 
 
@@ -457,15 +1040,32 @@ void BASpiMemoryDMA::read16(size_t address, uint16_t *dest, size_t numWords)
 	read(address, reinterpret_cast<uint8_t*>(dest), sizeof(uint16_t)*numWords);
 }
 
+void BASpiMemoryDMA::readGather(const SpiGatherEntry *entries, size_t numEntries)
+{
+	readGatherAsync(entries, numEntries);
+}
+
 
-bool BASpiMemoryDMA::isWriteBusy(void) const
+bool BASpiMemoryDMA::isWriteBusy(void)
 {
-	return (m_txTransfer[0].busy() or m_txTransfer[1].busy());
+	service();
+	for (size_t i=0; i < m_queueDepth; i++) {
+		if (!m_queue[i].isRead && (m_queue[i].state != DmaQueueEntry::State::FREE)) {
+			return true;
+		}
+	}
+	return false;
 }
 
-bool BASpiMemoryDMA::isReadBusy(void) const
+bool BASpiMemoryDMA::isReadBusy(void)
 {
-	return (m_rxTransfer[0].busy() or m_rxTransfer[1].busy());
+	service();
+	for (size_t i=0; i < m_queueDepth; i++) {
+		if (m_queue[i].isRead && (m_queue[i].state != DmaQueueEntry::State::FREE)) {
+			return true;
+		}
+	}
+	return false;
 }
 
 } /* namespace BAGuitar */